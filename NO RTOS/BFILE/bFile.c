@@ -89,6 +89,7 @@ typedef struct BFILE_FILELIST_td
 
 /* Private variables ---------------------------------------------------------*/
 static uint8_t flags;
+static BFLASH_Device_td *flashDevice;
 static BFILE_FILELIST_td* fileListStart;
 static BFILE_FILELIST_td* fileListEnd;
 static uint8_t bfileBuffer[30];
@@ -100,6 +101,18 @@ void Error_Handler(void);
 
 /* Private functions ---------------------------------------------------------*/
 
+/**
+  * @brief 	Set the flash the files are stored on. Indexing starts once it
+  * 		is ready
+  * @param 	device: pointer to the flash device
+  * @retval None
+  */
+void BFILE_Init(BFLASH_Device_td *device)
+{
+	flashDevice = device;
+}
+
+/* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Index manager
   * @param 	None
@@ -130,12 +143,12 @@ static void BFILE_Indexer(void)
 		indexer = BFIL_INDEXERSTATE_AWAITFLASH;
 
 	case BFIL_INDEXERSTATE_AWAITFLASH:
-		if(!BFLASH_GetInfo()->isReady)
+		if((flashDevice == NULL) || !BFLASH_GetInfo(flashDevice)->isReady)
 			break;
 		indexer = BFIL_INDEXERSTATE_READHEADER;
 
 	case BFIL_INDEXERSTATE_READHEADER:
-		if(address >= BFLASH_GetInfo()->flashSize)
+		if(address >= BFLASH_GetInfo(flashDevice)->flashSize)
 		{
 			indexer = BFIL_INDEXERSTATE_COMPLETE;
 			break;
@@ -144,7 +157,7 @@ static void BFILE_Indexer(void)
 		flash.address = address;
 		flash.data = bfileBuffer;
 		flash.size = 30;
-		if(BFLASH_Read(&flash) != BFLASH_ERROK)
+		if(BFLASH_Read(flashDevice, &flash) != BFLASH_ERROK)
 			break;
 		indexer = BFIL_INDEXERSTATE_PARSEHEADER;
 		break;
@@ -161,14 +174,14 @@ static void BFILE_Indexer(void)
 		BFILE_IDXSEG_td tmpSeg;
 		if(!BFILE_ParseHeader(bfileBuffer, &tmpSeg))
 		{
-			address = BLOCKNEXT(address, BFLASH_GetInfo()->sectorSize);
+			address = BLOCKNEXT(address, BFLASH_GetInfo(flashDevice)->sectorSize);
 			indexer = BFIL_INDEXERSTATE_READHEADER;
 			break;
 		}
 
 		if(!(tmpSeg.flags & BFILE_HEADERFLAG_VALID))
 		{
-			address = BLOCKNEXT(address, BFLASH_GetInfo()->sectorSize);
+			address = BLOCKNEXT(address, BFLASH_GetInfo(flashDevice)->sectorSize);
 			indexer = BFIL_INDEXERSTATE_READHEADER;
 			break;
 		}
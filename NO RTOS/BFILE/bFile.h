@@ -10,12 +10,14 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "stdbool.h"
+#include "bSPIFlash.h"
 
 /* Public typedef ------------------------------------------------------------*/
 /* Public define -------------------------------------------------------------*/
 /* Public macro --------------------------------------------------------------*/
 /* Public variables ----------------------------------------------------------*/
 /* Public function prototypes ------------------------------------------------*/
+void BFILE_Init(BFLASH_Device_td *device);
 void BFILE_tickFast(void);
 bool BFILE_IsIndexingComplete(void);
 
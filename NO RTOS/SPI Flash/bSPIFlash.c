@@ -4,6 +4,110 @@
  *  Created on: Jun 20, 2024
  *      Author: ben-linux
  */
+/*
+ * INFORMATION
+ *
+ * DEVICES
+ *
+ * 	o Each flash is a BFLASH_Device_td, initialised with BFLASH_Init on the
+ * 	  transport of its SPI bus. All state is held in the device, so flashes
+ * 	  on separate buses run their queues in parallel from the same ticks
+ * 	o The transport routines are passed the device, device->context
+ * 	  identifying the bus. Complete handlers are called with the device
+ * 	o One device per SPI bus. Devices sharing a bus would interleave their
+ * 	  commands
+ * 	o An access belongs to one device until complete. The device is set in
+ * 	  access->device for the complete callback
+ *
+ * QUEUE
+ *
+ * 	o Accesses are queued rather than refused while the flash is in use.
+ * 	  GetID, Read, Write and the erases return BFLASH_ERROK once queued, and
+ * 	  BFLASH_ERRBUSY if the access is already queued or in progress
+ * 	o The queue is ordered by priority, then first in first out. An access
+ * 	  is started from the fast tick that completes the last, so the SPI is
+ * 	  not left idle between accesses
+ * 	o An access may be queued again from its complete callback
+ * 	o The access struct belongs to the driver until complete, and must not
+ * 	  be changed while queued
+ * 	o Queue depth and the time accesses wait are kept in the queue stats
+ *
+ * READ MODES
+ *
+ * 	o Reads use the fastest mode supported by both the flash and the
+ * 	  transport, chosen when the flash is configured. BFLASH_SetReadMode
+ * 	  selects another
+ * 	o Fast read sends a dummy byte after the address and needs nothing of
+ * 	  the transport. Dual and quad output reads send the instruction, address
+ * 	  and dummy byte on one line then receive the data on 2 or 4 lines, with
+ * 	  the transport dualReceive or quadReceive. A transport without them
+ * 	  leaves them NULL
+ * 	o Quad output needs the QE bit set in the flash status register. This
+ * 	  is not set by the driver, a transport reporting quad must ensure it
+ *
+ * RANGE ERASE
+ *
+ * 	o BFLASH_EraseRange erases a sector aligned range as one access, with
+ * 	  one complete callback
+ * 	o Each step uses the largest erase type aligned at the address that
+ * 	  fits in the rest of the range, so 1MB on a 64K block boundary is 16
+ * 	  block erases rather than 256 sector erases. The whole flash is erased
+ * 	  with chip erase
+ *
+ * EVENT DRIVEN
+ *
+ * 	o With BFLASH_EVENTDRIVEN the SPI complete handlers advance the state
+ * 	  machine from the interrupt, starting the next command phase straight
+ * 	  away rather than on the next fast tick
+ * 	o Long work is left to the fast tick. Status is polled from the tick
+ * 	  while the flash is busy programming or erasing, complete callbacks are
+ * 	  run from the tick, and the next queued access is started from it
+ * 	o An interrupt arriving while the driver is running from the tick or an
+ * 	  API call is left for the fast tick
+ * 	o The complete handlers must be called from interrupts of one priority
+ *
+ * SUSPEND
+ *
+ * 	o A high priority read queued behind a write, sector erase or range
+ * 	  erase preempts it. While the flash is busy it is suspended with 0x75,
+ * 	  otherwise it is held between pages or erase steps. Queued high
+ * 	  priority reads are run, then the access is resumed with 0x7A
+ * 	o The access is checked each time the busy status is polled, so a
+ * 	  read waits at most a fast tick, the suspend latency (tSUS, 20us on the
+ * 	  W25Q64) and the read itself, plus up to BFLASH_SUSPENDHOLD + 1ms if the
+ * 	  access has just been resumed. The hold lets a suspended erase make
+ * 	  progress, and counts whole ticks so it is never cut short
+ * 	o Chip erase cannot be suspended
+ * 	o Data being erased or programmed must not be read while suspended
+ *
+ * DISCOVERY
+ *
+ * 	o BFLASH_Discover reads the JEDEC ID then the SFDP header and basic
+ * 	  flash parameter table (JESD216), through the queue like any other
+ * 	  access, and configures the flash from them. Parts without SFDP fall
+ * 	  back to the JEDEC ID table in BFLASH_ConfigureFlash
+ * 	o Size, page size, erase types and their typical times, program and
+ * 	  chip erase times, dual and quad output read instructions and dummy
+ * 	  clocks, and the address bytes are taken from the table. Fast read
+ * 	  (0x0B, 8 dummy clocks) is assumed
+ * 	o Read modes whose dummy clocks are not whole bytes are not used
+ * 	o The largest erase types and fastest read supported are then used
+ * 	  automatically
+ *
+ * 4 BYTE ADDRESSING
+ *
+ * 	o Parts above 16MB, or only accepting 4 byte addresses, are sent 4 byte
+ * 	  addresses for read, program and erase. SFDP is always read with 3
+ * 	  byte addresses
+ * 	o Where the part has the dedicated 4 byte instruction set (SFDP DWORD16)
+ * 	  it is used: 0x13/0x0C/0x3C/0x6C read, 0x12 program, 0x21/0x5C/0xDC
+ * 	  erase. These take a 4 byte address whatever the address mode, so
+ * 	  nothing is lost if the flash is reset behind the driver
+ * 	o Parts always in 4 byte address mode keep the 3 byte instructions
+ * 	o Parts that can only enter 4 byte mode (0xB7), or use a bank or
+ * 	  extended address register, are not supported
+ * 	o Read modes and erase types without a 4 byte instruction are dropped
+ */
 
 /* Includes ------------------------------------------------------------------*/
 #include "bSPIFlash.h"
@@ -17,6 +121,9 @@
 //INSTRUCTIONS
 #define bFLASH_READJEDECID								0x9F
 #define bFLASH_READ										0x03
+#define bFLASH_FASTREAD									0x0B
+#define bFLASH_FASTREADDUAL								0x3B
+#define bFLASH_FASTREADQUAD								0x6B
 #define bFLASH_WRITEENABLE								0x06
 #define bFLASH_PAGEPROGRAM								0x02
 #define bFLASH_READSTATUS								0x05
@@ -24,6 +131,19 @@
 #define 	bFLASH_READSTATUS_WEL						0x02
 #define bFLASH_ERASEFLASH								0x60
 #define bFLASH_ERASESECTOR								0x20
+#define bFLASH_ERASEBLOCK32								0x52
+#define bFLASH_ERASEBLOCK64								0xD8
+#define bFLASH_SUSPEND									0x75
+#define bFLASH_RESUME									0x7A
+#define bFLASH_READSFDP									0x5A
+#define bFLASH_READ4B									0x13
+#define bFLASH_FASTREAD4B								0x0C
+#define bFLASH_FASTREADDUAL4B							0x3C
+#define bFLASH_FASTREADQUAD4B							0x6C
+#define bFLASH_PAGEPROGRAM4B							0x12
+#define bFLASH_ERASESECTOR4B							0x21
+#define bFLASH_ERASEBLOCK324B							0x5C
+#define bFLASH_ERASEBLOCK644B							0xDC
 
 //STATES
 enum BFLASH_STATEs
@@ -64,6 +184,20 @@ enum BFLASH_STATEs
 	BFLASH_STATE_ERASESECTORREADSTATUS,
 	BFLASH_STATE_AWAITERASESECTORREADSTATUS,
 	BFLASH_STATE_AWAITERASESECTORCMPLT,
+	BFLASH_STATE_ERASERANGE,
+	BFLASH_STATE_AWAITERASERANGEWRITEENABLE,
+	BFLASH_STATE_ERASERANGEINS,
+	BFLASH_STATE_AWAITERASERANGEINS,
+	BFLASH_STATE_ERASERANGEREADSTATUS,
+	BFLASH_STATE_AWAITERASERANGEREADSTATUS,
+	BFLASH_STATE_AWAITERASERANGECMPLT,
+	BFLASH_STATE_SUSPEND,
+	BFLASH_STATE_AWAITSUSPENDINS,
+	BFLASH_STATE_SUSPENDREADSTATUS,
+	BFLASH_STATE_AWAITSUSPENDREADSTATUS,
+	BFLASH_STATE_AWAITSUSPENDCMPLT,
+	BFLASH_STATE_RESUME,
+	BFLASH_STATE_AWAITRESUMEINS,
 };
 
 //FLAGS
@@ -74,127 +208,862 @@ enum BFLASH_FLAGs
 	BFLASH_FLAG_TXRXCOMPLETE = 0x04,
 };
 
+//OPERATIONS
+enum BFLASH_OPERATIONs
+{
+	BFLASH_OPERATION_GETID = 0,
+	BFLASH_OPERATION_READ,
+	BFLASH_OPERATION_WRITE,
+	BFLASH_OPERATION_ERASEFLASH,
+	BFLASH_OPERATION_ERASESECTOR,
+	BFLASH_OPERATION_ERASERANGE,
+	BFLASH_OPERATION_READSFDP,
+};
+
+//DISCOVERY
+enum BFLASH_DISCOVERs
+{
+	BFLASH_DISCOVER_ID = 0,
+	BFLASH_DISCOVER_HEADER,
+	BFLASH_DISCOVER_BFPT,
+};
+
 /* Private macro -------------------------------------------------------------*/
 #define PAGEOFFSET(ADD, SIZE)				(ADD & (SIZE - 1))
 #define PAGESPACE(ADD, SIZE)				(SIZE - PAGEOFFSET(ADD, SIZE))
 #define SECTOROFFSET(ADD, SIZE)				(ADD & (SIZE - 1))
 #define SECTORSPACE(ADD, SIZE)				(SIZE - SECTOROFFSET(ADD, SIZE))
+#define BFPTDWORD(TABLE, N)					((uint32_t)BYTESTOUINT32(TABLE, ((N) - 1) * 4))
 
 /* Private variables ---------------------------------------------------------*/
-static BFLASH_Info_td flashInfo;
-static uint8_t buffer[20];
-static BFLASH_Access_td *currentUser;
-
-static uint8_t state;
-static uint8_t flags;
-static uint8_t spiTmr;
-static uint32_t offset;
+static BFLASH_Device_td *baseDevice;
 
 /* Private function prototypes -----------------------------------------------*/
-void BFLASH_ChipSelectCallback(uint8_t pinState);
-BFLASH_ERR BFLASH_TransmitCallback(uint8_t *data, uint32_t length);
-BFLASH_ERR BFLASH_TransmitReceiveCallback(uint8_t * txData, uint8_t *rxData, uint32_t length);
-BFLASH_ERR BFLASH_GetSPIStatus(void);
-
-static void BFLASH_ManageGetID (void);
-static void BFLASH_ManageRead (void);
-static void BFLASH_ManageWrite (void);
-static void BFLASH_ManageEraseFlash(void);
-static void BFLASH_ManageEraseSector(void);
+static BFLASH_ERR BFLASH_Queue(BFLASH_Device_td *device, BFLASH_Access_td *user, uint8_t operation);
+static void BFLASH_StartNext(BFLASH_Device_td *device);
+static void BFLASH_Release(BFLASH_Device_td *device, BFLASH_ERR result);
+static void BFLASH_Notify(BFLASH_Device_td *device);
+static void BFLASH_Manage(BFLASH_Device_td *device);
+#if BFLASH_EVENTDRIVEN
+static void BFLASH_Advance(BFLASH_Device_td *device);
+static void BFLASH_Interrupt(BFLASH_Device_td *device);
+#endif
+static uint8_t BFLASH_GetReadModes(BFLASH_Device_td *device);
+static BFLASH_ERR BFLASH_ConfigureSFDP(BFLASH_Device_td *device, uint32_t jedecID, uint8_t *bfpt, uint32_t length);
+static BFLASH_ERR BFLASH_FinishConfigure(BFLASH_Device_td *device, uint8_t instructions4Byte);
+static uint8_t BFLASH_Get4ByteInstruction(uint8_t instruction);
+static uint8_t BFLASH_PutAddress(uint8_t *data, uint32_t address, uint8_t addressBytes);
+static void BFLASH_DiscoverComplete(BFLASH_Access_td *access, BFLASH_ERR result);
+static void BFLASH_DiscoverDone(BFLASH_Device_td *device, BFLASH_ERR result);
+static void BFLASH_ManageGetID (BFLASH_Device_td *device);
+static void BFLASH_ManageRead (BFLASH_Device_td *device);
+static void BFLASH_ManageWrite (BFLASH_Device_td *device);
+static void BFLASH_ManageEraseFlash(BFLASH_Device_td *device);
+static void BFLASH_ManageEraseSector(BFLASH_Device_td *device);
+static void BFLASH_ManageEraseRange(BFLASH_Device_td *device);
+static void BFLASH_ManageSuspend(BFLASH_Device_td *device);
+static uint8_t BFLASH_IsPreempting(BFLASH_Access_td *user);
+static void BFLASH_CheckSuspend(BFLASH_Device_td *device, uint8_t suspend);
+static void BFLASH_Park(BFLASH_Device_td *device);
 
 /* Private functions ---------------------------------------------------------*/
 /**
-  * @brief 	Tick interface at a 100us/10us for faster SPI
+  * @brief 	Tick interface at a 100us/10us for faster SPI. Runs every device
   * @param 	None
   * @retval None
   */
 void BFLASH_fastTick (void)
 {
-	if(currentUser == NULL)
-		return;
+	BFLASH_Device_td *device = baseDevice;
+	while(device != NULL)
+	{
+		device->managing = 1;
+		device->flashBusy = 0;
 
-	BFLASH_ManageGetID();
-	BFLASH_ManageRead();
-	BFLASH_ManageWrite();
-	BFLASH_ManageEraseFlash();
-	BFLASH_ManageEraseSector();
+		if(device->currentUser != NULL)
+		{
+#if BFLASH_EVENTDRIVEN
+			BFLASH_Advance(device);
+#else
+			BFLASH_Manage(device);
+#endif
+		}
+
+		//Completed in the interrupt
+		BFLASH_Notify(device);
+
+		//Back to back
+		if(device->currentUser == NULL)
+			BFLASH_StartNext(device);
+
+		device->managing = 0;
+		device = device->next;
+	}
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
-  * @brief 	Tick interface at standard 1 millisecond
+  * @brief 	Tick interface at standard 1 millisecond. Runs every device
   * @param 	None
   * @retval None
   */
 void BFLASH_tick (void)
 {
-	if(spiTmr > 0)
-		spiTmr--;
+	BFLASH_Device_td *device = baseDevice;
+	while(device != NULL)
+	{
+		device->flashTime++;
+		if(device->spiTmr > 0)
+			device->spiTmr--;
+		if(device->suspendHold > 0)
+			device->suspendHold--;
+		device = device->next;
+	}
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Initialise a flash device on its transport and add it to those
+  * 		ticked. The device is configured with BFLASH_Discover or
+  * 		BFLASH_ConfigureFlash
+  * @param 	device: pointer to the flash device
+  * @param 	transport: SPI routines of the bus the flash is on
+  * @param 	context: passed to the transport through device->context
+  * @retval BFLASH_ERR
+  */
+BFLASH_ERR BFLASH_Init(BFLASH_Device_td *device, const BFLASH_Transport_td *transport, void *context)
+{
+	if((transport == NULL) || (transport->chipSelect == NULL) || (transport->transmit == NULL) || (transport->transmitReceive == NULL))
+		return BFLASH_ERRNOTSUPPORTED;
+
+	//Once only
+	BFLASH_Device_td *srch = baseDevice;
+	while(srch != NULL)
+	{
+		if(srch == device)
+			return BFLASH_ERRINUSE;
+		srch = srch->next;
+	}
+
+	memset(device, 0, sizeof(BFLASH_Device_td));
+	device->transport = transport;
+	device->context = context;
+
+	device->next = baseDevice;
+	baseDevice = device;
+	return BFLASH_ERROK;
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Configure the flash using the JEDEC ID
+  * @param 	device: pointer to the flash device
   * @param 	jedecID: JEDEC ID of the flash
   * @retval None
   */
-BFLASH_ERR BFLASH_ConfigureFlash (uint32_t jedecID)
+BFLASH_ERR BFLASH_ConfigureFlash (BFLASH_Device_td *device, uint32_t jedecID)
 {
-	flashInfo.jedecID = jedecID;
 	switch(jedecID)
 	{
 	//Winbond
 	case 0xef4017:
-		flashInfo.flashSize = 0x800000;
-		flashInfo.pageSize = 0x100;
-		flashInfo.sectorSize = 0x1000;
-		flashInfo.isReady = 1;
-		return BFLASH_ERROK;
+		device->info.flashSize = 0x800000;
+		device->info.pageSize = 0x100;
+		device->info.sectorSize = 0x1000;
+		device->info.readModes = (1 << BFLASH_READMODE_STANDARD) | (1 << BFLASH_READMODE_FAST) | (1 << BFLASH_READMODE_DUAL) | (1 << BFLASH_READMODE_QUAD);
+		device->info.readInstructions[BFLASH_READMODE_DUAL] = bFLASH_FASTREADDUAL;
+		device->info.readDummyBytes[BFLASH_READMODE_DUAL] = 1;
+		device->info.readInstructions[BFLASH_READMODE_QUAD] = bFLASH_FASTREADQUAD;
+		device->info.readDummyBytes[BFLASH_READMODE_QUAD] = 1;
+		device->info.eraseTypes[0] = (BFLASH_EraseType_td){0x10000, 150, bFLASH_ERASEBLOCK64};
+		device->info.eraseTypes[1] = (BFLASH_EraseType_td){0x8000, 120, bFLASH_ERASEBLOCK32};
+		device->info.eraseTypes[2] = (BFLASH_EraseType_td){0x1000, 45, bFLASH_ERASESECTOR};
+		device->info.eraseTypes[3] = (BFLASH_EraseType_td){0, 0, 0};
+		device->info.sectorErase = bFLASH_ERASESECTOR;
+		device->info.pageProgramTime = 400;
+		device->info.chipEraseTime = 20000;
+		device->info.addressBytes = 3;
+		break;
+
+	default:
+		return BFLASH_ERRNOTSUPPORTED;
 	}
-	return BFLASH_ERRNOTSUPPORTED;
+
+	device->info.jedecID = jedecID;
+	device->info.fromSFDP = 0;
+	return BFLASH_FinishConfigure(device, 0);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Configure the flash from the SFDP basic flash parameter table
+  * @param 	device: pointer to the flash device
+  * @param 	jedecID: JEDEC ID of the flash
+  * @param 	bfpt: pointer to the table
+  * @param 	length: bytes of the table read
+  * @retval BFLASH_ERR
+  */
+static BFLASH_ERR BFLASH_ConfigureSFDP(BFLASH_Device_td *device, uint32_t jedecID, uint8_t *bfpt, uint32_t length)
+{
+	static const uint16_t eraseUnits[] = {1, 16, 128, 1000};
+	static const uint32_t chipEraseUnits[] = {16, 256, 4000, 64000};
+
+	//JESD216 tables are at least 9 DWORDs
+	if(length < (9 * 4))
+		return BFLASH_ERRNOTSUPPORTED;
+
+	uint32_t dword1 = BFPTDWORD(bfpt, 1);
+	uint32_t dword2 = BFPTDWORD(bfpt, 2);
+
+	//Addressing, 3 byte only, 3 or 4 byte, or 4 byte only
+	uint8_t addressing = (dword1 >> 17) & 0x03;
+	if(addressing == 3)
+		return BFLASH_ERRNOTSUPPORTED;
+
+	//Density in bits, 2^N above 2Gb
+	uint32_t flashSize;
+	if(dword2 & 0x80000000)
+	{
+		uint32_t n = dword2 & 0x7FFFFFFF;
+		if((n < 3) || (n > 34))
+			return BFLASH_ERRNOTSUPPORTED;
+		flashSize = (n == 34) ? 0x80000000 : (1UL << (n - 3));
+	}
+	else
+		flashSize = (dword2 >> 3) + 1;
+
+	//Erase types, size and instruction pairs in DWORDs 8 and 9
+	BFLASH_EraseType_td types[BFLASH_ERASETYPECOUNT];
+	uint32_t dword10 = (length >= (10 * 4)) ? BFPTDWORD(bfpt, 10) : 0;
+	uint8_t count = 0;
+	for(uint8_t i = 0; i < BFLASH_ERASETYPECOUNT; i++)
+	{
+		uint8_t sizeExponent = bfpt[28 + (i * 2)];
+		if((sizeExponent == 0) || (sizeExponent > 24))
+			continue;
+
+		BFLASH_EraseType_td type;
+		type.size = 1UL << sizeExponent;
+		type.instruction = bfpt[29 + (i * 2)];
+		type.time = 0;
+		if(dword10 != 0)
+		{
+			uint32_t field = dword10 >> (4 + (i * 7));
+			type.time = ((field & 0x1F) + 1) * eraseUnits[(field >> 5) & 0x03];
+		}
+
+		//Largest first
+		uint8_t j = count++;
+		while((j > 0) && (types[j - 1].size < type.size))
+		{
+			types[j] = types[j - 1];
+			j--;
+		}
+		types[j] = type;
+	}
+	if((count == 0) || (types[count - 1].size > 0x8000))
+		return BFLASH_ERRNOTSUPPORTED;
+
+	//Read modes, fast read assumed
+	device->info.readModes = (1 << BFLASH_READMODE_STANDARD) | (1 << BFLASH_READMODE_FAST);
+	if(dword1 & (1UL << 16))
+	{
+		//1-1-2
+		uint32_t dword4 = BFPTDWORD(bfpt, 4);
+		uint8_t clocks = (dword4 & 0x1F) + ((dword4 >> 5) & 0x07);
+		device->info.readInstructions[BFLASH_READMODE_DUAL] = (uint8_t)(dword4 >> 8);
+		device->info.readDummyBytes[BFLASH_READMODE_DUAL] = clocks / 8;
+		if((clocks % 8) == 0)
+			device->info.readModes |= (1 << BFLASH_READMODE_DUAL);
+	}
+	if(dword1 & (1UL << 22))
+	{
+		//1-1-4
+		uint32_t dword3 = BFPTDWORD(bfpt, 3);
+		uint8_t clocks = ((dword3 >> 16) & 0x1F) + ((dword3 >> 21) & 0x07);
+		device->info.readInstructions[BFLASH_READMODE_QUAD] = (uint8_t)(dword3 >> 24);
+		device->info.readDummyBytes[BFLASH_READMODE_QUAD] = clocks / 8;
+		if((clocks % 8) == 0)
+			device->info.readModes |= (1 << BFLASH_READMODE_QUAD);
+	}
+
+	//Page size and times, JESD216A onwards
+	device->info.pageSize = 0x100;
+	device->info.pageProgramTime = 0;
+	device->info.chipEraseTime = 0;
+	if(length >= (11 * 4))
+	{
+		uint32_t dword11 = BFPTDWORD(bfpt, 11);
+		device->info.pageSize = 1 << ((dword11 >> 4) & 0x0F);
+		device->info.pageProgramTime = (((dword11 >> 8) & 0x1F) + 1) * ((dword11 & (1UL << 13)) ? 64 : 8);
+		device->info.chipEraseTime = (((dword11 >> 24) & 0x1F) + 1) * chipEraseUnits[(dword11 >> 29) & 0x03];
+	}
+
+	//3 byte addresses reach 16MB. Above that the dedicated 4 byte instructions
+	//are used, unless the part is always in 4 byte address mode
+	uint8_t instructions4Byte = 0;
+	device->info.addressBytes = 3;
+	if((addressing == 2) || (flashSize > 0x1000000))
+	{
+		device->info.addressBytes = 4;
+		if(addressing != 2)
+		{
+			uint8_t enter4Byte = (length >= (16 * 4)) ? (uint8_t)(BFPTDWORD(bfpt, 16) >> 24) : 0;
+			if(enter4Byte & 0x20)
+				instructions4Byte = !(enter4Byte & 0x40);
+			else if(!(enter4Byte & 0x40))
+				return BFLASH_ERRNOTSUPPORTED;
+		}
+	}
+
+	device->info.flashSize = flashSize;
+	for(uint8_t i = 0; i < BFLASH_ERASETYPECOUNT; i++)
+		device->info.eraseTypes[i] = (i < count) ? types[i] : (BFLASH_EraseType_td){0, 0, 0};
+	device->info.sectorSize = (uint16_t)types[count - 1].size;
+	device->info.sectorErase = types[count - 1].instruction;
+	device->info.jedecID = jedecID;
+	device->info.fromSFDP = 1;
+	return BFLASH_FinishConfigure(device, instructions4Byte);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Set the instructions common to all parts, swap to the 4 byte
+  * 		instructions if needed and select the fastest read
+  * @param 	device: pointer to the flash device
+  * @param 	instructions4Byte: 1 to use the dedicated 4 byte instructions
+  * @retval BFLASH_ERR
+  */
+static BFLASH_ERR BFLASH_FinishConfigure(BFLASH_Device_td *device, uint8_t instructions4Byte)
+{
+	device->info.readInstructions[BFLASH_READMODE_STANDARD] = bFLASH_READ;
+	device->info.readDummyBytes[BFLASH_READMODE_STANDARD] = 0;
+	device->info.readInstructions[BFLASH_READMODE_FAST] = bFLASH_FASTREAD;
+	device->info.readDummyBytes[BFLASH_READMODE_FAST] = 1;
+	device->info.pageProgram = bFLASH_PAGEPROGRAM;
+
+	if(instructions4Byte)
+	{
+		device->info.pageProgram = bFLASH_PAGEPROGRAM4B;
+
+		//Read modes without a 4 byte instruction dropped
+		for(uint8_t mode = BFLASH_READMODE_STANDARD; mode < BFLASH_READMODECOUNT; mode++)
+		{
+			device->info.readInstructions[mode] = BFLASH_Get4ByteInstruction(device->info.readInstructions[mode]);
+			if(device->info.readInstructions[mode] == 0)
+				device->info.readModes &= ~(1 << mode);
+		}
+
+		//As are erase types, largest first kept
+		uint8_t count = 0;
+		for(uint8_t i = 0; i < BFLASH_ERASETYPECOUNT; i++)
+		{
+			BFLASH_EraseType_td type = device->info.eraseTypes[i];
+			type.instruction = BFLASH_Get4ByteInstruction(type.instruction);
+			device->info.eraseTypes[i] = (BFLASH_EraseType_td){0, 0, 0};
+			if((type.size != 0) && (type.instruction != 0))
+				device->info.eraseTypes[count++] = type;
+		}
+		if((count == 0) || (device->info.eraseTypes[count - 1].size > 0x8000))
+		{
+			device->info.isReady = 0;
+			return BFLASH_ERRNOTSUPPORTED;
+		}
+		device->info.sectorSize = (uint16_t)device->info.eraseTypes[count - 1].size;
+		device->info.sectorErase = device->info.eraseTypes[count - 1].instruction;
+	}
+
+	//Fastest read
+	uint8_t modes = BFLASH_GetReadModes(device);
+	device->info.readMode = BFLASH_READMODE_STANDARD;
+	for(uint8_t mode = BFLASH_READMODE_STANDARD; mode <= BFLASH_READMODE_QUAD; mode++)
+	{
+		if(modes & (1 << mode))
+			device->info.readMode = mode;
+	}
+	device->info.isReady = 1;
+	return BFLASH_ERROK;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Get the dedicated 4 byte address equivalent of an instruction
+  * @param 	instruction: 3 byte address instruction
+  * @retval Instruction, 0 if there is none
+  */
+static uint8_t BFLASH_Get4ByteInstruction(uint8_t instruction)
+{
+	switch(instruction)
+	{
+	case bFLASH_READ:			return bFLASH_READ4B;
+	case bFLASH_FASTREAD:		return bFLASH_FASTREAD4B;
+	case bFLASH_FASTREADDUAL:	return bFLASH_FASTREADDUAL4B;
+	case bFLASH_FASTREADQUAD:	return bFLASH_FASTREADQUAD4B;
+	case bFLASH_PAGEPROGRAM:	return bFLASH_PAGEPROGRAM4B;
+	case bFLASH_ERASESECTOR:	return bFLASH_ERASESECTOR4B;
+	case bFLASH_ERASEBLOCK32:	return bFLASH_ERASEBLOCK324B;
+	case bFLASH_ERASEBLOCK64:	return bFLASH_ERASEBLOCK644B;
+	default:					return 0;
+	}
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Put an address into a command, most significant byte first
+  * @param 	data: pointer to the address in the command
+  * @param 	address: address to put
+  * @param 	addressBytes: 3 or 4
+  * @retval Bytes put
+  */
+static uint8_t BFLASH_PutAddress(uint8_t *data, uint32_t address, uint8_t addressBytes)
+{
+	for(uint8_t i = 0; i < addressBytes; i++)
+		data[i] = (uint8_t)(address >> ((addressBytes - 1 - i) * 8));
+	return addressBytes;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Select the read mode. Takes effect from the next read
+  * @param 	device: pointer to the flash device
+  * @param 	mode: @ref BFLASH_ReadMode_Enum
+  * @retval BFLASH_ERR
+  */
+BFLASH_ERR BFLASH_SetReadMode(BFLASH_Device_td *device, BFLASH_ReadMode_Enum mode)
+{
+	if((mode > BFLASH_READMODE_QUAD) || !(BFLASH_GetReadModes(device) & (1 << mode)))
+		return BFLASH_ERRNOTSUPPORTED;
+	device->info.readMode = mode;
+	return BFLASH_ERROK;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Get the read modes supported by both the flash and the transport
+  * @param 	device: pointer to the flash device
+  * @retval Bit per BFLASH_ReadMode_Enum
+  */
+static uint8_t BFLASH_GetReadModes(BFLASH_Device_td *device)
+{
+	uint8_t modes = device->info.readModes;
+	if(device->transport->dualReceive == NULL)
+		modes &= ~(1 << BFLASH_READMODE_DUAL);
+	if(device->transport->quadReceive == NULL)
+		modes &= ~(1 << BFLASH_READMODE_QUAD);
+	return modes;
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Configure the flash using the JEDEC ID
+  * @param 	device: pointer to the flash device
   * @param 	jedecID: JEDEC ID of the flash
   * @retval None
   */
-BFLASH_Info_td *BFLASH_GetInfo(void)
+BFLASH_Info_td *BFLASH_GetInfo(BFLASH_Device_td *device)
+{
+	return &device->info;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Get the access queue statistics
+  * @param 	device: pointer to the flash device
+  * @retval Pointer to the statistics
+  */
+BFLASH_QueueStats_td *BFLASH_GetQueueStats(BFLASH_Device_td *device)
 {
-	return &flashInfo;
+	return &device->queueStats;
 }
 
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Reset the access queue statistics. The depth is kept
+  * @param 	device: pointer to the flash device
+  * @retval None
+  */
+void BFLASH_ResetQueueStats(BFLASH_Device_td *device)
+{
+	uint16_t depth = device->queueStats.depth;
+	memset(&device->queueStats, 0, sizeof(device->queueStats));
+	device->queueStats.depth = depth;
+	device->queueStats.maxDepth = depth;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Queue an access behind those of the same or higher priority, and
+  * 		start it if the flash is idle
+  * @param 	device: pointer to the flash device
+  * @param 	user: pointer to the user requesting the access
+  * @param 	operation: @ref BFLASH_OPERATIONs
+  * @retval BFLASH_ERR
+  */
+static BFLASH_ERR BFLASH_Queue(BFLASH_Device_td *device, BFLASH_Access_td *user, uint8_t operation)
+{
+	//Still in progress, suspended, or its callback not yet made
+	if((device->currentUser == user) || (device->suspendedUser == user) || (device->completedUser == user))
+		return BFLASH_ERRBUSY;
+
+	BFLASH_Access_td *srch = device->queueHead;
+	BFLASH_Access_td *prev = NULL;
+	while(srch != NULL)
+	{
+		if(srch == user)
+			return BFLASH_ERRBUSY;
+		srch = srch->next;
+	}
+
+	user->complete = 0;
+	user->device = device;
+	user->operation = operation;
+	user->queueTime = device->flashTime;
+
+	srch = device->queueHead;
+	while((srch != NULL) && (srch->priority >= user->priority))
+	{
+		prev = srch;
+		srch = srch->next;
+	}
+	user->next = srch;
+	if(prev == NULL)
+		device->queueHead = user;
+	else
+		prev->next = user;
+
+	device->queueStats.depth++;
+	if(device->queueStats.depth > device->queueStats.maxDepth)
+		device->queueStats.maxDepth = device->queueStats.depth;
+
+	if(device->currentUser == NULL)
+		BFLASH_StartNext(device);
+
+	return BFLASH_ERROK;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Start the access at the head of the queue
+  * @param 	device: pointer to the flash device
+  * @retval None
+  */
+static void BFLASH_StartNext(BFLASH_Device_td *device)
+{
+	//Callbacks in order
+	if((device->currentUser != NULL) || (device->completedUser != NULL))
+		return;
+
+	//Resume once the reads preempting it are done
+	if((device->suspendedUser != NULL) && !BFLASH_IsPreempting(device->queueHead))
+	{
+		device->currentUser = device->suspendedUser;
+		device->suspendedUser = NULL;
+		device->offset = device->suspendedOffset;
+
+		uint8_t wasManaging = device->managing;
+		device->managing = 1;
+		device->state = BFLASH_STATE_RESUME;
+		BFLASH_ManageSuspend(device);
+		device->managing = wasManaging;
+		return;
+	}
+
+	if(device->queueHead == NULL)
+		return;
+
+	BFLASH_Access_td *user = device->queueHead;
+	device->queueHead = user->next;
+	user->next = NULL;
+
+	uint32_t wait = device->flashTime - user->queueTime;
+	device->queueStats.depth--;
+	device->queueStats.accesses++;
+	device->queueStats.waitTime += wait;
+	if(wait > device->queueStats.maxWait)
+		device->queueStats.maxWait = wait;
+
+	device->currentUser = user;
+	device->offset = 0;
+
+	uint8_t wasManaging = device->managing;
+	device->managing = 1;
+	switch(user->operation)
+	{
+	case BFLASH_OPERATION_GETID:
+		device->state = BFLASH_STATE_GETID;
+		BFLASH_ManageGetID(device);
+		break;
+
+	case BFLASH_OPERATION_READ:
+	case BFLASH_OPERATION_READSFDP:
+		device->state = BFLASH_STATE_READ;
+		BFLASH_ManageRead(device);
+		break;
+
+	case BFLASH_OPERATION_WRITE:
+		device->state = BFLASH_STATE_WRITE;
+		BFLASH_ManageWrite(device);
+		break;
+
+	case BFLASH_OPERATION_ERASEFLASH:
+		device->state = BFLASH_STATE_ERASEFLASH;
+		BFLASH_ManageEraseFlash(device);
+		break;
+
+	case BFLASH_OPERATION_ERASESECTOR:
+		device->state = BFLASH_STATE_ERASESECTOR;
+		BFLASH_ManageEraseSector(device);
+		break;
+
+	case BFLASH_OPERATION_ERASERANGE:
+		device->state = BFLASH_STATE_ERASERANGE;
+		BFLASH_ManageEraseRange(device);
+		break;
+	}
+	device->managing = wasManaging;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Release the current access. The callback is deferred to the
+  * 		fast tick when releasing from the interrupt
+  * @param 	device: pointer to the flash device
+  * @param 	result: result of the access
+  * @retval None
+  */
+static void BFLASH_Release(BFLASH_Device_td *device, BFLASH_ERR result)
+{
+	BFLASH_Access_td *user = device->currentUser;
+	user->result = result;
+	device->currentUser = NULL;
+	device->state = BFLASH_STATE_IDLE;
+
+	if(device->inInterrupt)
+	{
+		device->completedUser = user;
+		return;
+	}
+
+	user->complete = 1;
+	if(user->completeCallback != NULL)
+		user->completeCallback(user, user->result);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Complete an access released from the interrupt
+  * @param 	device: pointer to the flash device
+  * @retval None
+  */
+static void BFLASH_Notify(BFLASH_Device_td *device)
+{
+	BFLASH_Access_td *user = device->completedUser;
+	if(user == NULL)
+		return;
+	device->completedUser = NULL;
+
+	user->complete = 1;
+	if(user->completeCallback != NULL)
+		user->completeCallback(user, user->result);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Run the current state
+  * @param 	device: pointer to the flash device
+  * @retval None
+  */
+static void BFLASH_Manage(BFLASH_Device_td *device)
+{
+	BFLASH_ManageGetID(device);
+	BFLASH_ManageRead(device);
+	BFLASH_ManageWrite(device);
+	BFLASH_ManageEraseFlash(device);
+	BFLASH_ManageEraseSector(device);
+	BFLASH_ManageEraseRange(device);
+	BFLASH_ManageSuspend(device);
+}
+
+#if BFLASH_EVENTDRIVEN
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Run states until waiting on the SPI, or on the flash being busy
+  * @param 	device: pointer to the flash device
+  * @retval None
+  */
+static void BFLASH_Advance(BFLASH_Device_td *device)
+{
+	uint8_t lastState;
+	do
+	{
+		lastState = device->state;
+		BFLASH_Manage(device);
+	}while((device->state != lastState) && (device->currentUser != NULL) && !device->flashBusy);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Advance from an SPI complete interrupt. Left to the fast tick if
+  * 		interrupting the driver
+  * @param 	device: pointer to the flash device
+  * @retval None
+  */
+static void BFLASH_Interrupt(BFLASH_Device_td *device)
+{
+	if(device->managing || (device->currentUser == NULL))
+		return;
+
+	device->managing = 1;
+	device->inInterrupt = 1;
+	BFLASH_Advance(device);
+	device->inInterrupt = 0;
+	device->managing = 0;
+}
+#endif
+
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Request the ID of the spi flash. The access struct will be marked as
   * 		complete when complete, and the completeCallback will be called.
+  * @param 	device: pointer to the flash device
   * @param 	user: pointer to the user requesting the information
   * @retval BFLASH_ERR
   */
-BFLASH_ERR BFLASH_GetID (BFLASH_Access_td *user)
+BFLASH_ERR BFLASH_GetID (BFLASH_Device_td *device, BFLASH_Access_td *user)
 {
-	if((currentUser != NULL) && (currentUser != user))
-		return BFLASH_ERRINUSE;
-	if(currentUser == user)
+	return BFLASH_Queue(device, user, BFLASH_OPERATION_GETID);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Identify and configure the flash, from its SFDP tables if it has
+  * 		them. The access data receives the JEDEC ID, 3 bytes, if not NULL.
+  * 		The access struct will be marked as complete when complete, and
+  * 		the completeCallback will be called.
+  * @param 	device: pointer to the flash device
+  * @param 	user: pointer to the user requesting the discovery
+  * @retval BFLASH_ERR
+  */
+BFLASH_ERR BFLASH_Discover(BFLASH_Device_td *device, BFLASH_Access_td *user)
+{
+	if(device->discoverUser == user)
 		return BFLASH_ERRBUSY;
-	currentUser = user;
+	if(device->discoverUser != NULL)
+		return BFLASH_ERRINUSE;
 
+	device->discoverUser = user;
+	device->discoverStage = BFLASH_DISCOVER_ID;
 	user->complete = 0;
+	user->device = device;
+
+	device->discoverAccess.data = device->sfdp;
+	device->discoverAccess.priority = user->priority;
+	device->discoverAccess.completeCallback = BFLASH_DiscoverComplete;
+	BFLASH_ERR result = BFLASH_GetID(device, &device->discoverAccess);
+	if(result != BFLASH_ERROK)
+		device->discoverUser = NULL;
+	return result;
+}
 
-	state = BFLASH_STATE_GETID;
-	BFLASH_ManageGetID();
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Discovery access complete, read the next table or configure
+  * @param 	access: pointer to the discovery access
+  * @param 	result: result of the access
+  * @retval None
+  */
+static void BFLASH_DiscoverComplete(BFLASH_Access_td *access, BFLASH_ERR result)
+{
+	BFLASH_Device_td *device = access->device;
 
-	return BFLASH_ERROK;
+	if(result != BFLASH_ERROK)
+	{
+		BFLASH_DiscoverDone(device, result);
+		return;
+	}
+
+	switch(device->discoverStage)
+	{
+	case BFLASH_DISCOVER_ID:
+		device->discoverID = BYTESTOUINT24BIGENDIAN(device->sfdp, 0);
+
+		//Header and first parameter header, always the basic flash parameter table
+		device->discoverStage = BFLASH_DISCOVER_HEADER;
+		access->address = 0;
+		access->size = 16;
+		BFLASH_ReadSFDP(device, access);
+		break;
+
+	case BFLASH_DISCOVER_HEADER:
+	{
+		uint32_t length = (uint32_t)device->sfdp[11] * 4;
+		if((BFPTDWORD(device->sfdp, 1) != 0x50444653) || (device->sfdp[8] != 0x00) || (device->sfdp[15] != 0xFF) || (length < (9 * 4)))
+		{
+			//No SFDP
+			BFLASH_DiscoverDone(device, BFLASH_ConfigureFlash(device, device->discoverID));
+			break;
+		}
+
+		device->discoverStage = BFLASH_DISCOVER_BFPT;
+		access->address = BYTESTOUINT24(device->sfdp, 12);
+		access->size = (length > sizeof(device->sfdp)) ? sizeof(device->sfdp) : length;
+		BFLASH_ReadSFDP(device, access);
+		break;
+	}
+
+	case BFLASH_DISCOVER_BFPT:
+		result = BFLASH_ConfigureSFDP(device, device->discoverID, device->sfdp, access->size);
+		if(result != BFLASH_ERROK)
+			result = BFLASH_ConfigureFlash(device, device->discoverID);
+		BFLASH_DiscoverDone(device, result);
+		break;
+	}
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Complete the discovery user
+  * @param 	device: pointer to the flash device
+  * @param 	result: result of the discovery
+  * @retval None
+  */
+static void BFLASH_DiscoverDone(BFLASH_Device_td *device, BFLASH_ERR result)
+{
+	BFLASH_Access_td *user = device->discoverUser;
+	device->discoverUser = NULL;
+
+	if(user->data != NULL)
+	{
+		user->data[0] = (uint8_t)(device->discoverID >> 16);
+		user->data[1] = (uint8_t)(device->discoverID >> 8);
+		user->data[2] = (uint8_t)(device->discoverID);
+	}
+	user->result = result;
+	user->complete = 1;
+	if(user->completeCallback != NULL)
+		user->completeCallback(user, result);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Read the SFDP tables. The access struct will be marked as
+  * 		complete when complete, and the completeCallback will be called.
+  * @param 	device: pointer to the flash device
+  * @param 	user: pointer to the user requesting the information
+  * @retval BFLASH_ERR
+  */
+BFLASH_ERR BFLASH_ReadSFDP(BFLASH_Device_td *device, BFLASH_Access_td *user)
+{
+	return BFLASH_Queue(device, user, BFLASH_OPERATION_READSFDP);
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Manage the process of retrieving the ID
-  * @param 	None
+  * @param 	device: pointer to the flash device
   * @retval None
   */
-static void BFLASH_ManageGetID (void)
+static void BFLASH_ManageGetID (BFLASH_Device_td *device)
 {
 	//GET JEDEC ID
 	/*
@@ -206,49 +1075,43 @@ static void BFLASH_ManageGetID (void)
 	 *  o Release
 	 */
 
-	switch(state)
+	switch(device->state)
 	{
 	case BFLASH_STATE_GETID:
-		BFLASH_ChipSelectCallback(0);
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_READJEDECID;
-		buffer[1] = 0x00;
-		buffer[2] = 0x00;
-		buffer[3] = 0x00;
+		device->buffer[0] = bFLASH_READJEDECID;
+		device->buffer[1] = 0x00;
+		device->buffer[2] = 0x00;
+		device->buffer[3] = 0x00;
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 4) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 4) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITID;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITID;
+			device->spiTmr = 10;
 		}
 		break;
 
 	case BFLASH_STATE_AWAITID:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			currentUser->result =  BFLASH_ERROK;
-			state = BFLASH_STATE_CMPLTID;
+			device->currentUser->result =  BFLASH_ERROK;
+			device->state = BFLASH_STATE_CMPLTID;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			currentUser->result =  BFLASH_ERRTIMEOUT;
-			state = BFLASH_STATE_GETID;
+			device->currentUser->result =  BFLASH_ERRTIMEOUT;
+			device->state = BFLASH_STATE_GETID;
 		}
 		else
 			break;
 
 	case BFLASH_STATE_CMPLTID:
-		BFLASH_ChipSelectCallback(1);
+		device->transport->chipSelect(device, 1);
 
-		memcpy(currentUser->data, &buffer[1], 3);
-		currentUser->complete = 1;
-		BFLASH_Access_td *user = currentUser;
-		currentUser = NULL;
-		state = BFLASH_STATE_IDLE;
-
-		if(user->completeCallback != NULL)
-			user->completeCallback(user, user->result);
+		memcpy(device->currentUser->data, &device->buffer[1], 3);
+		BFLASH_Release(device, device->currentUser->result);
 		break;
 	}
 }
@@ -256,32 +1119,22 @@ static void BFLASH_ManageGetID (void)
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Read data from the flash.
+  * @param 	device: pointer to the flash device
   * @param 	user: pointer to the user requesting the information
   * @retval BFLASH_ERR
   */
-BFLASH_ERR BFLASH_Read (BFLASH_Access_td *user)
+BFLASH_ERR BFLASH_Read (BFLASH_Device_td *device, BFLASH_Access_td *user)
 {
-	if((currentUser != NULL) && (currentUser != user))
-		return BFLASH_ERRINUSE;
-	if(currentUser == user)
-		return BFLASH_ERRBUSY;
-	currentUser = user;
-
-	user->complete = 0;
-
-	state = BFLASH_STATE_READ;
-	BFLASH_ManageRead();
-
-	return BFLASH_ERROK;
+	return BFLASH_Queue(device, user, BFLASH_OPERATION_READ);
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Manage the process of reading data from the flash
-  * @param 	None
+  * @param 	device: pointer to the flash device
   * @retval None
   */
-static void BFLASH_ManageRead (void)
+static void BFLASH_ManageRead (BFLASH_Device_td *device)
 {
 	//Read
 	/*
@@ -295,82 +1148,92 @@ static void BFLASH_ManageRead (void)
 	 *  o Release
 	 */
 
-	switch(state)
+	switch(device->state)
 	{
 	case BFLASH_STATE_READ:
+	{
+		uint8_t dummyBytes;
+		uint8_t length;
 
-		BFLASH_ChipSelectCallback(0);
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_READ;
-		buffer[1] = (uint8_t)(currentUser->address >> 16);
-		buffer[2] = (uint8_t)(currentUser->address >> 8);
-		buffer[3] = (uint8_t)(currentUser->address);
+		//Mode held for the whole read. SFDP is read single line, 3 byte address, 8 dummy clocks
+		if(device->currentUser->operation == BFLASH_OPERATION_READSFDP)
+		{
+			device->readMode = BFLASH_READMODE_FAST;
+			device->buffer[0] = bFLASH_READSFDP;
+			length = 1 + BFLASH_PutAddress(&device->buffer[1], device->currentUser->address, 3);
+			dummyBytes = 1;
+		}
+		else
+		{
+			device->readMode = device->info.readMode;
+			device->buffer[0] = device->info.readInstructions[device->readMode];
+			length = 1 + BFLASH_PutAddress(&device->buffer[1], device->currentUser->address, device->info.addressBytes);
+			dummyBytes = device->info.readDummyBytes[device->readMode];
+		}
+		memset(&device->buffer[length], 0x00, dummyBytes);
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 4) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, length + dummyBytes) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITREADADD;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITREADADD;
+			device->spiTmr = 10;
 		}
 		break;
+	}
 
 	case BFLASH_STATE_AWAITREADADD:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			state = BFLASH_STATE_READDATA;
+			device->state = BFLASH_STATE_READDATA;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
-
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
+			device->transport->chipSelect(device, 1);
 
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 			break;
 		}
 		else
 			break;
 
 	case BFLASH_STATE_READDATA:
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(currentUser->data, currentUser->data, currentUser->size) == BFLASH_ERROK)
+	{
+		BFLASH_ERR result;
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->readMode == BFLASH_READMODE_QUAD)
+			result = device->transport->quadReceive(device, device->currentUser->data, device->currentUser->size);
+		else if(device->readMode == BFLASH_READMODE_DUAL)
+			result = device->transport->dualReceive(device, device->currentUser->data, device->currentUser->size);
+		else
+			result = device->transport->transmitReceive(device, device->currentUser->data, device->currentUser->data, device->currentUser->size);
+		if(result == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITREADDATA;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITREADDATA;
+			device->spiTmr = 10;
 		}
 		break;
+	}
 
 	case BFLASH_STATE_AWAITREADDATA:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			currentUser->result = BFLASH_ERROK;
-			state = BFLASH_STATE_READCMPLT;
+			device->currentUser->result = BFLASH_ERROK;
+			device->state = BFLASH_STATE_READCMPLT;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			state = BFLASH_STATE_READCMPLT;
+			device->currentUser->result = BFLASH_ERRTIMEOUT;
+			device->state = BFLASH_STATE_READCMPLT;
 		}
 		else
 			break;
 
 	case BFLASH_STATE_READCMPLT:
-		BFLASH_ChipSelectCallback(1);
-
-		state = BFLASH_STATE_IDLE;
+		device->transport->chipSelect(device, 1);
 
-		currentUser->complete = 1;
-		BFLASH_Access_td *user = currentUser;
-		currentUser = NULL;
-
-		if(user->completeCallback != NULL)
-			user->completeCallback(user, user->result);
+		BFLASH_Release(device, device->currentUser->result);
 		break;
 	}
 }
@@ -379,33 +1242,22 @@ static void BFLASH_ManageRead (void)
 /**
   * @brief 	Write data to the flash. When complete, the access struct complete
   * 		will be set, and the access struct callback will be executed
+  * @param 	device: pointer to the flash device
   * @param 	user: pointer to the user requesting the information
   * @retval BFLASH_ERR
   */
-BFLASH_ERR BFLASH_Write(BFLASH_Access_td *user)
+BFLASH_ERR BFLASH_Write(BFLASH_Device_td *device, BFLASH_Access_td *user)
 {
-	if((currentUser != NULL) && (currentUser != user))
-		return BFLASH_ERRINUSE;
-	if(currentUser == user)
-		return BFLASH_ERRBUSY;
-	currentUser = user;
-
-	user->complete = 0;
-	offset = 0;
-
-	state = BFLASH_STATE_WRITE;
-	BFLASH_ManageWrite();
-
-	return BFLASH_ERROK;
+	return BFLASH_Queue(device, user, BFLASH_OPERATION_WRITE);
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Manage the process of reading data from the flash
-  * @param 	None
+  * @param 	device: pointer to the flash device
   * @retval None
   */
-static void BFLASH_ManageWrite(void)
+static void BFLASH_ManageWrite(BFLASH_Device_td *device)
 {
 	//Write
 	/*
@@ -429,78 +1281,62 @@ static void BFLASH_ManageWrite(void)
 	 *  o Check result
 	 *  o Repeat check/Write again/Release
 	 */
-	switch(state)
+	switch(device->state)
 	{
 	case BFLASH_STATE_WRITE:
-		BFLASH_ChipSelectCallback(0);
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_WRITEENABLE;
+		device->buffer[0] = bFLASH_WRITEENABLE;
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 1) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 1) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITWRITEENABLE;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITWRITEENABLE;
+			device->spiTmr = 10;
 		}
 		break;
 
 	case BFLASH_STATE_AWAITWRITEENABLE:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			BFLASH_ChipSelectCallback(1);
+			device->transport->chipSelect(device, 1);
 
-			state = BFLASH_STATE_WRITEADD;
+			device->state = BFLASH_STATE_WRITEADD;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
+			device->transport->chipSelect(device, 1);
 
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 		}
 		break;
 
 	case BFLASH_STATE_WRITEADD:
-		BFLASH_ChipSelectCallback(0);
+	{
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_PAGEPROGRAM;
-		buffer[1] = (uint8_t)((currentUser->address + offset) >> 16);
-		buffer[2] = (uint8_t)((currentUser->address + offset) >> 8);
-		buffer[3] = (uint8_t)((currentUser->address + offset));
+		device->buffer[0] = device->info.pageProgram;
+		uint8_t length = 1 + BFLASH_PutAddress(&device->buffer[1], device->currentUser->address + device->offset, device->info.addressBytes);
 
-		flags &= ~BFLASH_FLAG_TXCOMPLETE;
-		if(BFLASH_TransmitCallback(buffer, 4) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXCOMPLETE;
+		if(device->transport->transmit(device, device->buffer, length) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITWRITEADD;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITWRITEADD;
+			device->spiTmr = 10;
 		}
 		break;
+	}
 
 	case BFLASH_STATE_AWAITWRITEADD:
-		if(flags & BFLASH_FLAG_TXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXCOMPLETE)
 		{
-			state = BFLASH_STATE_WRITEDATA;
+			device->state = BFLASH_STATE_WRITEDATA;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
+			device->transport->chipSelect(device, 1);
 
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 			break;
 		}
 		else
@@ -508,109 +1344,89 @@ static void BFLASH_ManageWrite(void)
 
 	case BFLASH_STATE_WRITEDATA:
 	{
-		uint32_t length = currentUser->size - offset;
-		if(length > (PAGESPACE((currentUser->address + offset), flashInfo.pageSize)))
-			length = (PAGESPACE((currentUser->address + offset), flashInfo.pageSize));
+		uint32_t length = device->currentUser->size - device->offset;
+		if(length > (PAGESPACE((device->currentUser->address + device->offset), device->info.pageSize)))
+			length = (PAGESPACE((device->currentUser->address + device->offset), device->info.pageSize));
 
-		flags &= ~BFLASH_FLAG_TXCOMPLETE;
-		if(BFLASH_TransmitCallback(&currentUser->data[offset], length) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXCOMPLETE;
+		if(device->transport->transmit(device, &device->currentUser->data[device->offset], length) == BFLASH_ERROK)
 		{
-			offset += length;
-			state = BFLASH_STATE_AWAITWRITEDATA;
-			spiTmr = 10;
+			device->offset += length;
+			device->state = BFLASH_STATE_AWAITWRITEDATA;
+			device->spiTmr = 10;
 		}
 		break;
 	}
 
 	case BFLASH_STATE_AWAITWRITEDATA:
-		if(BFLASH_GetSPIStatus() == BFLASH_ERROK)
+		//Without getStatus the transmit complete means the SPI is ready
+		if((device->transport->getStatus != NULL) ? (device->transport->getStatus(device) == BFLASH_ERROK) : (device->flags & BFLASH_FLAG_TXCOMPLETE))
 		{
-			BFLASH_ChipSelectCallback(1);
-			state = BFLASH_STATE_WRITEREADSTATUS;
+			device->transport->chipSelect(device, 1);
+			device->state = BFLASH_STATE_WRITEREADSTATUS;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
+			device->transport->chipSelect(device, 1);
 
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 			break;
 		}
 		break;
 
 	case BFLASH_STATE_WRITEREADSTATUS:
 
-		BFLASH_ChipSelectCallback(0);
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_READSTATUS;
+		device->buffer[0] = bFLASH_READSTATUS;
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 2) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 2) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITWRITEREADSTATUS;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITWRITEREADSTATUS;
+			device->spiTmr = 10;
 		}
 		break;
 
 	case BFLASH_STATE_AWAITWRITEREADSTATUS:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			state = BFLASH_STATE_AWAITWRITECMPLT;
+			device->state = BFLASH_STATE_AWAITWRITECMPLT;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
+			device->transport->chipSelect(device, 1);
 
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 			break;
 		}
 		else
 			break;
 
 	case BFLASH_STATE_AWAITWRITECMPLT:
-		BFLASH_ChipSelectCallback(1);
+		device->transport->chipSelect(device, 1);
 
-		if(buffer[1] & (bFLASH_READSTATUS_BSY | bFLASH_READSTATUS_WEL))
+		if(device->buffer[1] & (bFLASH_READSTATUS_BSY | bFLASH_READSTATUS_WEL))
 		{
-			state = BFLASH_STATE_WRITEREADSTATUS;
+			device->flashBusy = 1;
+			device->state = BFLASH_STATE_WRITEREADSTATUS;
+			BFLASH_CheckSuspend(device, 1);
 			break;
 		}
-		else if (offset < currentUser->size)
+		else if (device->offset < device->currentUser->size)
 		{
-			state = BFLASH_STATE_WRITE;
+			device->state = BFLASH_STATE_WRITE;
+			BFLASH_CheckSuspend(device, 0);
 			break;
 		}
 		else
 		{
-			state = BFLASH_STATE_WRITECMPLT;
+			device->state = BFLASH_STATE_WRITECMPLT;
 		}
 
 	case BFLASH_STATE_WRITECMPLT:
 
-		state = BFLASH_STATE_IDLE;
-
-		currentUser->result = BFLASH_ERROK;
-		currentUser->complete = 1;
-		BFLASH_Access_td *user = currentUser;
-		currentUser = NULL;
-
-		if(user->completeCallback != NULL)
-			user->completeCallback(user, user->result);
+		BFLASH_Release(device, BFLASH_ERROK);
 		break;
 	}
 }
@@ -619,33 +1435,22 @@ static void BFLASH_ManageWrite(void)
 /**
   * @brief 	Erase the entire flash. When complete, the access struct complete
   * 		will be set, and the access struct callback will be executed
+  * @param 	device: pointer to the flash device
   * @param 	user: pointer to the user requesting the information
   * @retval BFLASH_ERR
   */
-BFLASH_ERR BFLASH_EraseFlash(BFLASH_Access_td *user)
+BFLASH_ERR BFLASH_EraseFlash(BFLASH_Device_td *device, BFLASH_Access_td *user)
 {
-	if((currentUser != NULL) && (currentUser != user))
-		return BFLASH_ERRINUSE;
-	if(currentUser == user)
-		return BFLASH_ERRBUSY;
-	currentUser = user;
-
-	user->complete = 0;
-	offset = 0;
-
-	state = BFLASH_STATE_ERASEFLASH;
-	BFLASH_ManageEraseFlash();
-
-	return BFLASH_ERROK;
+	return BFLASH_Queue(device, user, BFLASH_OPERATION_ERASEFLASH);
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Manage the process of reading data from the flash
-  * @param 	None
+  * @param 	device: pointer to the flash device
   * @retval None
   */
-static void BFLASH_ManageEraseFlash(void)
+static void BFLASH_ManageEraseFlash(BFLASH_Device_td *device)
 {
 	//Erase
 	/*
@@ -667,135 +1472,104 @@ static void BFLASH_ManageEraseFlash(void)
 	 *  o Check result
 	 *  o Repeat check/Release
 	 */
-	switch(state)
+	switch(device->state)
 	{
 	case BFLASH_STATE_ERASEFLASH:
-		BFLASH_ChipSelectCallback(0);
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_WRITEENABLE;
+		device->buffer[0] = bFLASH_WRITEENABLE;
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 1) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 1) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITERASEFLASHWRITEENABLE;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITERASEFLASHWRITEENABLE;
+			device->spiTmr = 10;
 		}
 		break;
 
 	case BFLASH_STATE_AWAITERASEFLASHWRITEENABLE:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			BFLASH_ChipSelectCallback(1);
+			device->transport->chipSelect(device, 1);
 
-			state = BFLASH_STATE_ERASEFLASHINS;
+			device->state = BFLASH_STATE_ERASEFLASHINS;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
+			device->transport->chipSelect(device, 1);
 
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 		}
 		break;
 
 	case BFLASH_STATE_ERASEFLASHINS:
-		BFLASH_ChipSelectCallback(0);
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_ERASEFLASH;
+		device->buffer[0] = bFLASH_ERASEFLASH;
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 1) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 1) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITERASEFLASHINS;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITERASEFLASHINS;
+			device->spiTmr = 10;
 		}
 		break;
 
 	case BFLASH_STATE_AWAITERASEFLASHINS:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			BFLASH_ChipSelectCallback(1);
-			state = BFLASH_STATE_ERASEFLASHREADSTATUS;
+			device->transport->chipSelect(device, 1);
+			device->state = BFLASH_STATE_ERASEFLASHREADSTATUS;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
+			device->transport->chipSelect(device, 1);
 
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 		}
 		break;
 
 	case BFLASH_STATE_ERASEFLASHREADSTATUS:
 
-		BFLASH_ChipSelectCallback(0);
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_READSTATUS;
+		device->buffer[0] = bFLASH_READSTATUS;
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 2) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 2) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITERASEFLASHREADSTATUS;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITERASEFLASHREADSTATUS;
+			device->spiTmr = 10;
 		}
 		break;
 
 	case BFLASH_STATE_AWAITERASEFLASHREADSTATUS:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			state = BFLASH_STATE_AWAITERASEFLASHCMPLT;
+			device->state = BFLASH_STATE_AWAITERASEFLASHCMPLT;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
+			device->transport->chipSelect(device, 1);
 
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 			break;
 		}
 		else
 			break;
 
 	case BFLASH_STATE_AWAITERASEFLASHCMPLT:
-		BFLASH_ChipSelectCallback(1);
+		device->transport->chipSelect(device, 1);
 
-		if(buffer[1] & (bFLASH_READSTATUS_BSY | bFLASH_READSTATUS_WEL))
+		if(device->buffer[1] & (bFLASH_READSTATUS_BSY | bFLASH_READSTATUS_WEL))
 		{
-			state = BFLASH_STATE_ERASEFLASHREADSTATUS;
+			device->flashBusy = 1;
+			device->state = BFLASH_STATE_ERASEFLASHREADSTATUS;
 			break;
 		}
 		else
 		{
-			state = BFLASH_STATE_IDLE;
-
-			currentUser->result = BFLASH_ERROK;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERROK);
 		}
 	}
 }
@@ -806,32 +1580,22 @@ static void BFLASH_ManageEraseFlash(void)
   * 		Specify the address of the sector from which to erase
   * 		When complete, the access struct complete
   * 		will be set, and the access struct callback will be executed
+  * @param 	device: pointer to the flash device
   * @param 	user: pointer to the user requesting the information
   * @retval BFLASH_ERR
   */
-BFLASH_ERR BFLASH_EraseSector(BFLASH_Access_td *user)
+BFLASH_ERR BFLASH_EraseSector(BFLASH_Device_td *device, BFLASH_Access_td *user)
 {
-	if((currentUser != NULL) && (currentUser != user))
-		return BFLASH_ERRINUSE;
-	if(currentUser == user)
-		return BFLASH_ERRBUSY;
-	currentUser = user;
-
-	user->complete = 0;
-
-	state = BFLASH_STATE_ERASESECTOR;
-	BFLASH_ManageEraseSector();
-
-	return BFLASH_ERROK;
+	return BFLASH_Queue(device, user, BFLASH_OPERATION_ERASESECTOR);
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Manage the process of erasing a sector from flash
-  * @param 	None
+  * @param 	device: pointer to the flash device
   * @retval None
   */
-static void BFLASH_ManageEraseSector(void)
+static void BFLASH_ManageEraseSector(BFLASH_Device_td *device)
 {
 	//Erase
 	/*
@@ -853,138 +1617,107 @@ static void BFLASH_ManageEraseSector(void)
 	 *  o Check result
 	 *  o Repeat check/Release
 	 */
-	switch(state)
+	switch(device->state)
 	{
 	case BFLASH_STATE_ERASESECTOR:
-		BFLASH_ChipSelectCallback(0);
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_WRITEENABLE;
+		device->buffer[0] = bFLASH_WRITEENABLE;
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 1) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 1) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITERASESECTORWRITEENABLE;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITERASESECTORWRITEENABLE;
+			device->spiTmr = 10;
 		}
 		break;
 
 	case BFLASH_STATE_AWAITERASESECTORWRITEENABLE:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			BFLASH_ChipSelectCallback(1);
+			device->transport->chipSelect(device, 1);
 
-			state = BFLASH_STATE_ERASESECTORINS;
+			device->state = BFLASH_STATE_ERASESECTORINS;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
+			device->transport->chipSelect(device, 1);
 
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 		}
 		break;
 
 	case BFLASH_STATE_ERASESECTORINS:
-		BFLASH_ChipSelectCallback(0);
-
-		buffer[0] = bFLASH_ERASESECTOR;
-		buffer[1] = (uint8_t)((currentUser->address) >> 16);
-		buffer[2] = (uint8_t)((currentUser->address) >> 8);
-		buffer[3] = (uint8_t)((currentUser->address));
+	{
+		device->transport->chipSelect(device, 0);
 
+		device->buffer[0] = device->info.sectorErase;
+		uint8_t length = 1 + BFLASH_PutAddress(&device->buffer[1], device->currentUser->address, device->info.addressBytes);
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 4) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, length) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITERASESECTORINS;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITERASESECTORINS;
+			device->spiTmr = 10;
 		}
 		break;
+	}
 
 	case BFLASH_STATE_AWAITERASESECTORINS:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			BFLASH_ChipSelectCallback(1);
-			state = BFLASH_STATE_ERASESECTORREADSTATUS;
+			device->transport->chipSelect(device, 1);
+			device->state = BFLASH_STATE_ERASESECTORREADSTATUS;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
-
-			state = BFLASH_STATE_IDLE;
-
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
+			device->transport->chipSelect(device, 1);
 
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 		}
 		break;
 
 	case BFLASH_STATE_ERASESECTORREADSTATUS:
 
-		BFLASH_ChipSelectCallback(0);
+		device->transport->chipSelect(device, 0);
 
-		buffer[0] = bFLASH_READSTATUS;
+		device->buffer[0] = bFLASH_READSTATUS;
 
-		flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
-		if(BFLASH_TransmitReceiveCallback(buffer, buffer, 2) == BFLASH_ERROK)
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 2) == BFLASH_ERROK)
 		{
-			state = BFLASH_STATE_AWAITERASESECTORREADSTATUS;
-			spiTmr = 10;
+			device->state = BFLASH_STATE_AWAITERASESECTORREADSTATUS;
+			device->spiTmr = 10;
 		}
 		break;
 
 	case BFLASH_STATE_AWAITERASESECTORREADSTATUS:
-		if(flags & BFLASH_FLAG_TXRXCOMPLETE)
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
 		{
-			state = BFLASH_STATE_AWAITERASESECTORCMPLT;
+			device->state = BFLASH_STATE_AWAITERASESECTORCMPLT;
 		}
-		else if (spiTmr == 0)
+		else if (device->spiTmr == 0)
 		{
-			BFLASH_ChipSelectCallback(1);
+			device->transport->chipSelect(device, 1);
 
-			state = BFLASH_STATE_IDLE;
-
-			currentUser->result = BFLASH_ERRTIMEOUT;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
 			break;
 		}
 		else
 			break;
 
 	case BFLASH_STATE_AWAITERASESECTORCMPLT:
-		BFLASH_ChipSelectCallback(1);
+		device->transport->chipSelect(device, 1);
 
-		if(buffer[1] & (bFLASH_READSTATUS_BSY | bFLASH_READSTATUS_WEL))
+		if(device->buffer[1] & (bFLASH_READSTATUS_BSY | bFLASH_READSTATUS_WEL))
 		{
-			state = BFLASH_STATE_ERASESECTORREADSTATUS;
+			device->flashBusy = 1;
+			device->state = BFLASH_STATE_ERASESECTORREADSTATUS;
+			BFLASH_CheckSuspend(device, 1);
 		}
 		else
 		{
-			state = BFLASH_STATE_IDLE;
-
-			currentUser->result = BFLASH_ERROK;
-			currentUser->complete = 1;
-			BFLASH_Access_td *user = currentUser;
-			currentUser = NULL;
-
-			if(user->completeCallback != NULL)
-				user->completeCallback(user, user->result);
+			BFLASH_Release(device, BFLASH_ERROK);
 		}
 		break;
 	}
@@ -992,87 +1725,393 @@ static void BFLASH_ManageEraseSector(void)
 
 /* ---------------------------------------------------------------------------*/
 /**
-  * @brief 	Chip select control callback
-  * @param 	pinState: the desired state of the chip select pin on the flash
+  * @brief 	Erase a range of the flash, with the largest erases that fit.
+  * 		Specify the address and size of the range, both sector aligned.
+  * 		When complete, the access struct complete
+  * 		will be set, and the access struct callback will be executed
+  * @param 	device: pointer to the flash device
+  * @param 	user: pointer to the user requesting the information
+  * @retval BFLASH_ERR
+  */
+BFLASH_ERR BFLASH_EraseRange(BFLASH_Device_td *device, BFLASH_Access_td *user)
+{
+	if(!device->info.isReady)
+		return BFLASH_ERRNOTSUPPORTED;
+	if(SECTOROFFSET(user->address, device->info.sectorSize) || SECTOROFFSET(user->size, device->info.sectorSize))
+		return BFLASH_ERRNOTSUPPORTED;
+	if((user->address > device->info.flashSize) || (user->size > (device->info.flashSize - user->address)))
+		return BFLASH_ERRNOTSUPPORTED;
+
+	return BFLASH_Queue(device, user, BFLASH_OPERATION_ERASERANGE);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Manage the process of erasing a range of the flash
+  * @param 	device: pointer to the flash device
   * @retval None
   */
-__attribute ((weak)) void BFLASH_ChipSelectCallback(uint8_t pinState)
+static void BFLASH_ManageEraseRange(BFLASH_Device_td *device)
 {
+	//Erase
+	/*
+	 * On call
+	 * 	o Release if the range is erased
+	 * 	o CS LOW
+	 * 	o SPI WRITE ENABLE
+	 * On RXTX complete
+	 *  o CS HI
+	 * On flash thread
+	 *  o CS LO
+	 * 	o SPI LARGEST ERASE START
+	 * On RXTX complete
+	 *  o CS HI
+	 * On flash thread
+	 *  o CS LO
+	 *  o SPI READ STATUS
+	 * on RXTX complete
+	 *  o CS HI
+	 *  o Check result
+	 *  o Repeat check/Erase next/Release
+	 */
+	switch(device->state)
+	{
+	case BFLASH_STATE_ERASERANGE:
+		if(device->offset >= device->currentUser->size)
+		{
+			BFLASH_Release(device, BFLASH_ERROK);
+			break;
+		}
+
+		device->transport->chipSelect(device, 0);
+
+		device->buffer[0] = bFLASH_WRITEENABLE;
+
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 1) == BFLASH_ERROK)
+		{
+			device->state = BFLASH_STATE_AWAITERASERANGEWRITEENABLE;
+			device->spiTmr = 10;
+		}
+		break;
+
+	case BFLASH_STATE_AWAITERASERANGEWRITEENABLE:
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
+		{
+			device->transport->chipSelect(device, 1);
+
+			device->state = BFLASH_STATE_ERASERANGEINS;
+		}
+		else if (device->spiTmr == 0)
+		{
+			device->transport->chipSelect(device, 1);
+
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
+		}
+		break;
+
+	case BFLASH_STATE_ERASERANGEINS:
+	{
+		uint32_t address = device->currentUser->address + device->offset;
+		uint32_t remaining = device->currentUser->size - device->offset;
+		uint8_t length = 1;
+
+		device->transport->chipSelect(device, 0);
+
+		if((address == 0) && (remaining == device->info.flashSize))
+		{
+			device->buffer[0] = bFLASH_ERASEFLASH;
+			device->eraseSize = remaining;
+		}
+		else
+		{
+			//Largest aligned erase that fits, sector erase at least
+			device->buffer[0] = device->info.sectorErase;
+			device->eraseSize = device->info.sectorSize;
+			for(uint8_t i = 0; i < BFLASH_ERASETYPECOUNT; i++)
+			{
+				BFLASH_EraseType_td *type = &device->info.eraseTypes[i];
+				if((type->size > device->eraseSize) && (type->size <= remaining) && !(address & (type->size - 1)))
+				{
+					device->buffer[0] = type->instruction;
+					device->eraseSize = type->size;
+				}
+			}
+			length += BFLASH_PutAddress(&device->buffer[1], address, device->info.addressBytes);
+		}
+
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, length) == BFLASH_ERROK)
+		{
+			device->state = BFLASH_STATE_AWAITERASERANGEINS;
+			device->spiTmr = 10;
+		}
+		break;
+	}
+
+	case BFLASH_STATE_AWAITERASERANGEINS:
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
+		{
+			device->transport->chipSelect(device, 1);
+			device->state = BFLASH_STATE_ERASERANGEREADSTATUS;
+		}
+		else if (device->spiTmr == 0)
+		{
+			device->transport->chipSelect(device, 1);
+
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
+		}
+		break;
+
+	case BFLASH_STATE_ERASERANGEREADSTATUS:
+
+		device->transport->chipSelect(device, 0);
+
+		device->buffer[0] = bFLASH_READSTATUS;
+
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 2) == BFLASH_ERROK)
+		{
+			device->state = BFLASH_STATE_AWAITERASERANGEREADSTATUS;
+			device->spiTmr = 10;
+		}
+		break;
+
+	case BFLASH_STATE_AWAITERASERANGEREADSTATUS:
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
+		{
+			device->state = BFLASH_STATE_AWAITERASERANGECMPLT;
+		}
+		else if (device->spiTmr == 0)
+		{
+			device->transport->chipSelect(device, 1);
+
+			BFLASH_Release(device, BFLASH_ERRTIMEOUT);
+			break;
+		}
+		else
+			break;
+
+	case BFLASH_STATE_AWAITERASERANGECMPLT:
+		device->transport->chipSelect(device, 1);
 
+		if(device->buffer[1] & (bFLASH_READSTATUS_BSY | bFLASH_READSTATUS_WEL))
+		{
+			device->flashBusy = 1;
+			device->state = BFLASH_STATE_ERASERANGEREADSTATUS;
+			if(device->eraseSize < device->info.flashSize)		//Not chip erase
+				BFLASH_CheckSuspend(device, 1);
+		}
+		else
+		{
+			device->offset += device->eraseSize;
+			device->state = BFLASH_STATE_ERASERANGE;
+			if(device->offset < device->currentUser->size)
+				BFLASH_CheckSuspend(device, 0);
+		}
+		break;
+	}
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
-  * @brief 	SPI transmit routine
-  * @param 	data: Pointer to the data to transmit
-  * @param 	length: Amount of data to transmit
-  * @retval BFLASH_ERR
+  * @brief 	Check if an access preempts writes and erases
+  * @param 	user: pointer to the access, may be NULL
+  * @retval 1 if preempting
   */
-__attribute ((weak)) BFLASH_ERR BFLASH_TransmitCallback(uint8_t *data, uint32_t length)
+static uint8_t BFLASH_IsPreempting(BFLASH_Access_td *user)
 {
-	return BFLASH_ERROK;
+	return ((user != NULL) && (user->operation == BFLASH_OPERATION_READ) && (user->priority >= BFLASH_PRIORITY_HIGH)) ? 1 : 0;
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
-  * @brief 	SPI transmit routine
-  * @param 	data: Pointer to the buffer into which to read
-  * @param 	length: Amount of data to transmit
-  * @retval BFLASH_ERR
+  * @brief 	Suspend the current access, continuing from the state set, if a
+  * 		high priority read is waiting
+  * @param 	device: pointer to the flash device
+  * @param 	suspend: 1 if the flash is busy and must be suspended first
+  * @retval None
   */
-__attribute ((weak)) BFLASH_ERR BFLASH_TransmitReceiveCallback(uint8_t * txData, uint8_t *rxData, uint32_t length)
+static void BFLASH_CheckSuspend(BFLASH_Device_td *device, uint8_t suspend)
 {
-	return BFLASH_ERROK;
+	if(!BFLASH_IsPreempting(device->queueHead) || (device->suspendHold > 0))
+		return;
+
+	device->resumeState = device->state;
+	if(suspend)
+		device->state = BFLASH_STATE_SUSPEND;
+	else
+		BFLASH_Park(device);
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
-  * @brief 	Get the SPI status
-  * @param 	None
-  * @retval OK if ready
+  * @brief 	Set the current access aside until resumed from BFLASH_StartNext
+  * @param 	device: pointer to the flash device
+  * @retval None
   */
-__attribute ((weak)) BFLASH_ERR BFLASH_GetSPIStatus(void)
+static void BFLASH_Park(BFLASH_Device_td *device)
 {
-	return BFLASH_ERROK;
+	device->suspendedUser = device->currentUser;
+	device->suspendedOffset = device->offset;
+	device->currentUser = NULL;
+	device->state = BFLASH_STATE_IDLE;
+	device->queueStats.suspends++;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Manage the process of suspending and resuming a write or erase
+  * @param 	device: pointer to the flash device
+  * @retval None
+  */
+static void BFLASH_ManageSuspend(BFLASH_Device_td *device)
+{
+	//Suspend
+	/*
+	 * On call
+	 * 	o CS LOW
+	 * 	o SPI SUSPEND
+	 * On RXTX complete
+	 *  o CS HI
+	 * On flash thread
+	 *  o CS LO
+	 *  o SPI READ STATUS
+	 * on RXTX complete
+	 *  o CS HI
+	 *  o Repeat check/Park
+	 */
+	//Resume
+	/*
+	 * On call
+	 * 	o CS LOW
+	 * 	o SPI RESUME
+	 * On RXTX complete
+	 *  o CS HI
+	 *  o Continue the access
+	 */
+	switch(device->state)
+	{
+	case BFLASH_STATE_SUSPEND:
+		device->transport->chipSelect(device, 0);
+
+		device->buffer[0] = bFLASH_SUSPEND;
+
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 1) == BFLASH_ERROK)
+		{
+			device->state = BFLASH_STATE_AWAITSUSPENDINS;
+			device->spiTmr = 10;
+		}
+		break;
+
+	case BFLASH_STATE_AWAITSUSPENDINS:
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
+		{
+			device->transport->chipSelect(device, 1);
+			device->state = BFLASH_STATE_SUSPENDREADSTATUS;
+		}
+		else if (device->spiTmr == 0)
+		{
+			device->transport->chipSelect(device, 1);
+			device->state = BFLASH_STATE_RESUME;
+		}
+		break;
+
+	case BFLASH_STATE_SUSPENDREADSTATUS:
+		device->transport->chipSelect(device, 0);
+
+		device->buffer[0] = bFLASH_READSTATUS;
+
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 2) == BFLASH_ERROK)
+		{
+			device->state = BFLASH_STATE_AWAITSUSPENDREADSTATUS;
+			device->spiTmr = 10;
+		}
+		break;
+
+	case BFLASH_STATE_AWAITSUSPENDREADSTATUS:
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
+		{
+			device->state = BFLASH_STATE_AWAITSUSPENDCMPLT;
+		}
+		else if (device->spiTmr == 0)
+		{
+			device->transport->chipSelect(device, 1);
+			device->state = BFLASH_STATE_RESUME;
+			break;
+		}
+		else
+			break;
+
+	case BFLASH_STATE_AWAITSUSPENDCMPLT:
+		device->transport->chipSelect(device, 1);
+
+		//Suspended, or completed before the suspend
+		if(device->buffer[1] & bFLASH_READSTATUS_BSY)
+			device->state = BFLASH_STATE_SUSPENDREADSTATUS;
+		else
+			BFLASH_Park(device);
+		break;
+
+	case BFLASH_STATE_RESUME:
+		device->transport->chipSelect(device, 0);
+
+		//Ignored by the flash if not suspended
+		device->buffer[0] = bFLASH_RESUME;
+
+		device->flags &= ~BFLASH_FLAG_TXRXCOMPLETE;
+		if(device->transport->transmitReceive(device, device->buffer, device->buffer, 1) == BFLASH_ERROK)
+		{
+			device->state = BFLASH_STATE_AWAITRESUMEINS;
+			device->spiTmr = 10;
+		}
+		break;
+
+	case BFLASH_STATE_AWAITRESUMEINS:
+		if(device->flags & BFLASH_FLAG_TXRXCOMPLETE)
+		{
+			device->transport->chipSelect(device, 1);
+			device->suspendHold = BFLASH_SUSPENDHOLD + 1;		//The first tick may come at once
+			device->state = device->resumeState;
+		}
+		else if (device->spiTmr == 0)
+		{
+			device->transport->chipSelect(device, 1);
+			device->state = BFLASH_STATE_RESUME;
+		}
+		break;
+	}
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Notify the system that the SPI transmit has completed
-  * @param 	None
+  * @param 	device: pointer to the flash device
   * @retval None
   */
-void BFLASH_TransmitCompleteHandler(void)
+void BFLASH_TransmitCompleteHandler(BFLASH_Device_td *device)
 {
-	flags |= BFLASH_FLAG_TXCOMPLETE;
-
-//	if(currentUser == NULL)
-//		return;
-//
-//	BFLASH_ManageGetID();
-//	BFLASH_ManageRead();
-//	BFLASH_ManageWrite();
-//	BFLASH_ManageEraseFlash();
-//	BFLASH_ManageEraseSector();
+	device->flags |= BFLASH_FLAG_TXCOMPLETE;
+
+#if BFLASH_EVENTDRIVEN
+	BFLASH_Interrupt(device);
+#endif
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Notify the system that the SPI transmit has completed
-  * @param 	None
+  * @param 	device: pointer to the flash device
   * @retval None
   */
-void BFLASH_TransmitReceiveCompleteHandler(void)
+void BFLASH_TransmitReceiveCompleteHandler(BFLASH_Device_td *device)
 {
-	flags |= BFLASH_FLAG_TXRXCOMPLETE;
-
-//	if(currentUser == NULL)
-//		return;
-//
-//	BFLASH_ManageGetID();
-//	BFLASH_ManageRead();
-//	BFLASH_ManageWrite();
-//	BFLASH_ManageEraseFlash();
-//	BFLASH_ManageEraseSector();
+	device->flags |= BFLASH_FLAG_TXRXCOMPLETE;
+
+#if BFLASH_EVENTDRIVEN
+	BFLASH_Interrupt(device);
+#endif
 }
 
@@ -12,13 +12,40 @@
 #include "stdint.h"
 
 /* Public typedef ------------------------------------------------------------*/
+#define BFLASH_ERASETYPECOUNT					4
+#define BFLASH_SFDPBUFFERSIZE					64			//Basic flash parameter table bytes read, 16 DWORDs
+typedef enum
+{
+	BFLASH_READMODE_STANDARD = 0,			//Read, lower clock limit
+	BFLASH_READMODE_FAST,					//Fast read, dummy byte
+	BFLASH_READMODE_DUAL,					//Fast read, data out on 2 lines
+	BFLASH_READMODE_QUAD,					//Fast read, data out on 4 lines
+	BFLASH_READMODECOUNT
+}BFLASH_ReadMode_Enum;
+typedef struct
+{
+	uint32_t size;							//0 if unused
+	uint16_t time;							//Typical erase time (ms)
+	uint8_t instruction;
+}BFLASH_EraseType_td;
 typedef struct
 {
 	uint32_t jedecID;
 	uint32_t flashSize;
 	uint16_t sectorSize;
 	uint16_t pageSize;
+	uint8_t readModes;						//Supported by the flash, bit per BFLASH_ReadMode_Enum
+	uint8_t readMode;						//@ref BFLASH_ReadMode_Enum
+	uint8_t readInstructions[BFLASH_READMODECOUNT];
+	uint8_t readDummyBytes[BFLASH_READMODECOUNT];	//Sent after the address
+	BFLASH_EraseType_td eraseTypes[BFLASH_ERASETYPECOUNT];	//Largest first
+	uint8_t sectorErase;					//Instruction erasing sectorSize
+	uint8_t pageProgram;					//Page program instruction
+	uint16_t pageProgramTime;				//Typical page program time (us)
+	uint32_t chipEraseTime;					//Typical chip erase time (ms)
+	uint8_t addressBytes;					//Address bytes sent, 4 above 16MB
 	uint8_t isReady:1;
+	uint8_t fromSFDP:1;						//Configured from the SFDP tables
 }BFLASH_Info_td;
 typedef enum
 {
@@ -29,6 +56,11 @@ typedef enum
 	BFLASH_ERRNOTSUPPORTED,					//Operation or feature not supported
 
 }BFLASH_ERR;
+typedef enum
+{
+	BFLASH_PRIORITY_NORMAL = 0,
+	BFLASH_PRIORITY_HIGH,					//Queued ahead of normal accesses
+}BFLASH_Priority_Enum;
 typedef struct BFLASH_Access_td
 {
 	uint32_t address;
@@ -36,26 +68,152 @@ typedef struct BFLASH_Access_td
 	uint32_t size;
 	uint8_t complete:1;
 	BFLASH_ERR result:7;
+	uint8_t priority;						//@ref BFLASH_Priority_Enum, higher first
 	void (*completeCallback)(struct BFLASH_Access_td *access, BFLASH_ERR result);
+
+	//Queue, set by the driver
+	struct BFLASH_Device_td *device;
+	uint8_t operation;
+	uint32_t queueTime;
+	struct BFLASH_Access_td *next;
 }BFLASH_Access_td;
+typedef struct
+{
+	uint32_t accesses;						//Accesses started
+	uint32_t waitTime;						//Total milliseconds accesses waited in the queue
+	uint32_t maxWait;
+	uint16_t depth;							//Accesses waiting now
+	uint16_t maxDepth;
+	uint32_t suspends;						//Writes and erases preempted by high priority reads
+}BFLASH_QueueStats_td;
+typedef struct
+{
+	/**
+	  * @brief 	Chip select control
+	  * @param 	device: pointer to the flash device
+	  * @param 	pinState: the desired state of the chip select pin on the flash
+	  * @retval None
+	  */
+	void (*chipSelect)(struct BFLASH_Device_td *device, uint8_t pinState);
+
+	/**
+	  * @brief 	SPI transmit. Complete with BFLASH_TransmitCompleteHandler
+	  * @param 	device: pointer to the flash device
+	  * @param 	data: Pointer to the data to transmit
+	  * @param 	length: Amount of data to transmit
+	  * @retval BFLASH_ERR
+	  */
+	BFLASH_ERR (*transmit)(struct BFLASH_Device_td *device, uint8_t *data, uint32_t length);
+
+	/**
+	  * @brief 	SPI transmit and receive. Complete with
+	  * 		BFLASH_TransmitReceiveCompleteHandler
+	  * @param 	device: pointer to the flash device
+	  * @param 	txData: Pointer to the data to transmit
+	  * @param 	rxData: Pointer to the buffer into which to read
+	  * @param 	length: Amount of data to transmit
+	  * @retval BFLASH_ERR
+	  */
+	BFLASH_ERR (*transmitReceive)(struct BFLASH_Device_td *device, uint8_t *txData, uint8_t *rxData, uint32_t length);
+
+	/**
+	  * @brief 	Get the SPI status. NULL if the transmit complete means the
+	  * 		SPI is ready
+	  * @param 	device: pointer to the flash device
+	  * @retval OK if ready
+	  */
+	BFLASH_ERR (*getStatus)(struct BFLASH_Device_td *device);
+
+	/**
+	  * @brief 	SPI dual receive, data on IO0 and IO1. Complete with
+	  * 		BFLASH_TransmitReceiveCompleteHandler. NULL if not supported
+	  * @param 	device: pointer to the flash device
+	  * @param 	rxData: Pointer to the buffer into which to read
+	  * @param 	length: Amount of data to receive
+	  * @retval BFLASH_ERR
+	  */
+	BFLASH_ERR (*dualReceive)(struct BFLASH_Device_td *device, uint8_t *rxData, uint32_t length);
+
+	/**
+	  * @brief 	SPI quad receive, data on IO0 to IO3. Complete with
+	  * 		BFLASH_TransmitReceiveCompleteHandler. NULL if not supported
+	  * @param 	device: pointer to the flash device
+	  * @param 	rxData: Pointer to the buffer into which to read
+	  * @param 	length: Amount of data to receive
+	  * @retval BFLASH_ERR
+	  */
+	BFLASH_ERR (*quadReceive)(struct BFLASH_Device_td *device, uint8_t *rxData, uint32_t length);
+}BFLASH_Transport_td;
+typedef struct BFLASH_Device_td
+{
+	const BFLASH_Transport_td *transport;
+	void *context;							//For the transport, the SPI bus
+
+	//Set by the driver
+	BFLASH_Info_td info;
+	BFLASH_QueueStats_td queueStats;
+	BFLASH_Access_td *currentUser;
+	BFLASH_Access_td *queueHead;
+	uint32_t flashTime;
+	uint8_t buffer[20];
+	uint8_t readMode;						//Held for the whole read
+	uint32_t eraseSize;						//Range erase step
+
+	//Suspend
+	BFLASH_Access_td *suspendedUser;
+	uint32_t suspendedOffset;
+	uint8_t resumeState;
+	uint8_t suspendHold;
+
+	//Discovery
+	BFLASH_Access_td discoverAccess;
+	BFLASH_Access_td *discoverUser;
+	uint8_t discoverStage;
+	uint32_t discoverID;
+	uint8_t sfdp[BFLASH_SFDPBUFFERSIZE];
+
+	BFLASH_Access_td *volatile completedUser;	//Complete in the interrupt, callback due
+	volatile uint8_t managing;
+	uint8_t inInterrupt;
+	uint8_t flashBusy;						//Status polled again from the tick. Apart from flags, which the interrupts set
+
+	uint8_t state;
+	volatile uint8_t flags;
+	uint8_t spiTmr;
+	uint32_t offset;
+
+	struct BFLASH_Device_td *next;
+}BFLASH_Device_td;
 
 /* Public define -------------------------------------------------------------*/
+#ifndef BFLASH_EVENTDRIVEN
+#define BFLASH_EVENTDRIVEN						0			//Advance the state machine from the SPI complete interrupts
+#endif
+#define BFLASH_SUSPENDHOLD						1			//Minimum milliseconds a resumed write or erase runs before it may be suspended again
+
 /* Public macro --------------------------------------------------------------*/
 /* Public variables ----------------------------------------------------------*/
 /* Public function prototypes ------------------------------------------------*/
 void BFLASH_fastTick (void);
 void BFLASH_tick (void);
 
-BFLASH_ERR BFLASH_ConfigureFlash (uint32_t jedecID);
-BFLASH_ERR BFLASH_GetID (BFLASH_Access_td *user);
-BFLASH_ERR BFLASH_Read (BFLASH_Access_td *user);
-BFLASH_ERR BFLASH_Write(BFLASH_Access_td *user);
-BFLASH_ERR BFLASH_EraseFlash(BFLASH_Access_td *user);
-BFLASH_ERR BFLASH_EraseSector(BFLASH_Access_td *user);
-BFLASH_Info_td *BFLASH_GetInfo(void);
+BFLASH_ERR BFLASH_Init(BFLASH_Device_td *device, const BFLASH_Transport_td *transport, void *context);
+BFLASH_ERR BFLASH_ConfigureFlash (BFLASH_Device_td *device, uint32_t jedecID);
+BFLASH_ERR BFLASH_GetID (BFLASH_Device_td *device, BFLASH_Access_td *user);
+BFLASH_ERR BFLASH_Discover(BFLASH_Device_td *device, BFLASH_Access_td *user);
+BFLASH_ERR BFLASH_ReadSFDP(BFLASH_Device_td *device, BFLASH_Access_td *user);
+BFLASH_ERR BFLASH_Read (BFLASH_Device_td *device, BFLASH_Access_td *user);
+BFLASH_ERR BFLASH_Write(BFLASH_Device_td *device, BFLASH_Access_td *user);
+BFLASH_ERR BFLASH_EraseFlash(BFLASH_Device_td *device, BFLASH_Access_td *user);
+BFLASH_ERR BFLASH_EraseSector(BFLASH_Device_td *device, BFLASH_Access_td *user);
+BFLASH_ERR BFLASH_EraseRange(BFLASH_Device_td *device, BFLASH_Access_td *user);
+BFLASH_Info_td *BFLASH_GetInfo(BFLASH_Device_td *device);
+BFLASH_ERR BFLASH_SetReadMode(BFLASH_Device_td *device, BFLASH_ReadMode_Enum mode);
+BFLASH_QueueStats_td *BFLASH_GetQueueStats(BFLASH_Device_td *device);
+void BFLASH_ResetQueueStats(BFLASH_Device_td *device);
 
 //SPI Control Routines
-void BFLASH_TransmitCompleteHandler(void);
-void BFLASH_TransmitReceiveCompleteHandler(void);
+void BFLASH_TransmitCompleteHandler(BFLASH_Device_td *device);
+void BFLASH_TransmitReceiveCompleteHandler(BFLASH_Device_td *device);
 
 #endif /* BSPIFLASH_BSPIFLASH_H_ */
@@ -6,7 +6,7 @@
  */
 
 /* Includes ------------------------------------------------------------------*/
-#include "bSPIFlash.h"
+#include "bSPIFlashDriver.h"
 #include "main.h"
 #include "utils.h"
 
@@ -14,8 +14,23 @@
 /* Private define ------------------------------------------------------------*/
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
+static BFLASH_Device_td flashDevice;
+
 /* Private function prototypes -----------------------------------------------*/
 static void BFLASHDRIV_GetICCompleteCallback(BFLASH_Access_td *access, BFLASH_ERR result);
+static void BFLASHDRIV_ChipSelect(BFLASH_Device_td *device, uint8_t pinState);
+static BFLASH_ERR BFLASHDRIV_Transmit(BFLASH_Device_td *device, uint8_t *data, uint32_t length);
+static BFLASH_ERR BFLASHDRIV_TransmitReceive(BFLASH_Device_td *device, uint8_t * txData, uint8_t *rxData, uint32_t length);
+static BFLASH_ERR BFLASHDRIV_GetSPIStatus(BFLASH_Device_td *device);
+
+//SPI1, single line
+static const BFLASH_Transport_td spi1Transport =
+{
+	.chipSelect = BFLASHDRIV_ChipSelect,
+	.transmit = BFLASHDRIV_Transmit,
+	.transmitReceive = BFLASHDRIV_TransmitReceive,
+	.getStatus = BFLASHDRIV_GetSPIStatus,
+};
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -28,12 +43,25 @@ void BFLASHDRIV_init(void)
 {
 	LL_SPI_Enable(SPI1);
 	LL_SPI_EnableDMAReq_TX(SPI1);
+	BFLASH_Init(&flashDevice, &spi1Transport, SPI1);
 
 	static BFLASH_Access_td getIDAccess;
 	static uint8_t id[3];
 	getIDAccess.data = id;
 	getIDAccess.completeCallback = BFLASHDRIV_GetICCompleteCallback;
-	BFLASH_GetID(&getIDAccess);
+	BFLASH_Discover(&flashDevice, &getIDAccess);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Get the board flash, for the users and the SPI1 DMA complete
+  * 		interrupts
+  * @param 	None
+  * @retval Pointer to the flash device
+  */
+BFLASH_Device_td *BFLASHDRIV_GetDevice(void)
+{
+	return &flashDevice;
 }
 /* ---------------------------------------------------------------------------*/
 /**
@@ -43,25 +71,21 @@ void BFLASHDRIV_init(void)
   */
 static void BFLASHDRIV_GetICCompleteCallback(BFLASH_Access_td *access, BFLASH_ERR result)
 {
-	if(result == BFLASH_ERROK)
-	{
-		uint32_t jedecID = BYTESTOUINT24BIGENDIAN(access->data, 0);
-		if(BFLASH_ConfigureFlash(jedecID) != BFLASH_ERROK)
-			Error_Handler();
-	}
-	else
-	{
-		BFLASH_GetID(access);
-	}
+	//Discovery configures the flash
+	if(result == BFLASH_ERRNOTSUPPORTED)
+		Error_Handler();
+	else if(result != BFLASH_ERROK)
+		BFLASH_Discover(access->device, access);
 }
 
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Chip select control callback
+  * @param 	device: pointer to the flash device
   * @param 	pinState: the desired state of the chip select pin on the flash
   * @retval None
   */
-void BFLASH_ChipSelectCallback(uint8_t pinState)
+static void BFLASHDRIV_ChipSelect(BFLASH_Device_td *device, uint8_t pinState)
 {
 	HAL_GPIO_WritePin(GPIO_FLASH_NCS_GPIO_Port, GPIO_FLASH_NCS_Pin, pinState);
 }
@@ -69,11 +93,12 @@ void BFLASH_ChipSelectCallback(uint8_t pinState)
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	SPI transmit routine
+  * @param 	device: pointer to the flash device
   * @param 	data: Pointer to the data to transmit
   * @param 	length: Amount of data to transmit
   * @retval BFLASH_ERR
   */
-BFLASH_ERR BFLASH_TransmitCallback(uint8_t *data, uint32_t length)
+static BFLASH_ERR BFLASHDRIV_Transmit(BFLASH_Device_td *device, uint8_t *data, uint32_t length)
 {
 	SPI1->CR1 |= SPI_CR1_BIDIOE;
 	SPI1->CR1 |= SPI_CR1_BIDIMODE;
@@ -93,11 +118,12 @@ BFLASH_ERR BFLASH_TransmitCallback(uint8_t *data, uint32_t length)
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	SPI transmit routine
+  * @param 	device: pointer to the flash device
   * @param 	data: Pointer to the buffer into which to read
   * @param 	length: Amount of data to transmit
   * @retval BFLASH_ERR
   */
-BFLASH_ERR BFLASH_TransmitReceiveCallback(uint8_t * txData, uint8_t *rxData, uint32_t length)
+static BFLASH_ERR BFLASHDRIV_TransmitReceive(BFLASH_Device_td *device, uint8_t * txData, uint8_t *rxData, uint32_t length)
 {
 	if(LL_SPI_IsActiveFlag_BSY(SPI1))
 		return BFLASH_ERRINUSE;
@@ -128,10 +154,10 @@ BFLASH_ERR BFLASH_TransmitReceiveCallback(uint8_t * txData, uint8_t *rxData, uin
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief 	Get the SPI status
-  * @param 	None
+  * @param 	device: pointer to the flash device
   * @retval OK if ready
   */
-BFLASH_ERR BFLASH_GetSPIStatus(void)
+static BFLASH_ERR BFLASHDRIV_GetSPIStatus(BFLASH_Device_td *device)
 {
 	if(LL_SPI_IsActiveFlag_BSY(SPI1))
 		return BFLASH_ERRBUSY;
@@ -9,11 +9,14 @@
 #define INC_BSPIFLASHDRIVER_H_
 
 /* Includes ------------------------------------------------------------------*/
+#include "bSPIFlash.h"
+
 /* Public typedef ------------------------------------------------------------*/
 /* Public define -------------------------------------------------------------*/
 /* Public macro --------------------------------------------------------------*/
 /* Public variables ----------------------------------------------------------*/
 /* Public function prototypes ------------------------------------------------*/
 void BFLASHDRIV_init(void);
+BFLASH_Device_td *BFLASHDRIV_GetDevice(void);
 
 #endif /* INC_BSPIFLASHDRIVER_H_ */
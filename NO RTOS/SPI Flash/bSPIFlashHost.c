@@ -0,0 +1,547 @@
+/*
+ * bSPIFlashHost.c
+ *
+ *  Created on: Aug 19, 2024
+ *      Author: ben-linux
+ */
+/*
+ * INFORMATION
+ *
+ * 	o Only built for the Linux host build, with bSPIFlash.c, bSPIFlashSim.c
+ * 	  and utils.c. Build with -DBFLASH_EVENTDRIVEN=1 for the event driven
+ * 	  driver
+ * 	o bflashHost <command>. Returns 0 if the flash saw no protocol errors
+ * 	  and the data was correct
+ * 		o erase: range erase against chained sector erases, with typical
+ * 		  W25Q64JV erase times (4K 45ms, 32K 120ms, 64K 150ms, chip 20s)
+ * 		o latency: time of single accesses, SPI at 1 byte/us by DMA, 100us
+ * 		  fast tick, 700us page program and 45ms sector erase
+ * 		o suspend: read latency during a 400ms sector erase and a 16 page
+ * 		  write, reads at normal then high priority, 20us tSUS
+ * 		o sfdp: BFLASH_Discover configures the simulated W25Q64 from its SFDP
+ * 		  tables as BFLASH_ConfigureFlash does from its JEDEC ID. Typical
+ * 		  times may differ by the SFDP unit they are held in
+ * 		o fourbyte: BFLASH_Discover on the simulated 64MB W25Q512 selects 4
+ * 		  byte addresses and the 4 byte instruction set. Range erase, write
+ * 		  and read across the 16MB boundary use only 4 byte instructions
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "bSPIFlashSim.h"
+#if defined(__linux__)
+#include "stdio.h"
+#include "string.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+	const char *name;
+	uint8_t (*run)(void);
+}BFLASHHOST_Command_td;
+
+/* Private define ------------------------------------------------------------*/
+#define BFLASHHOST_TIMELIMIT					200000000	//Microseconds before an access is abandoned
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static BFLASH_Device_td bflashhostDevice;
+static BFLASHSIM_Stats_td bflashhostStats;
+static volatile uint8_t bflashhostDone;
+static BFLASH_ERR bflashhostResult;
+static uint32_t bflashhostSectorEnd;		//Chained sector erases
+static uint32_t bflashhostRandom = 1;
+
+//Background access and the reads preempting it
+static BFLASH_Access_td bflashhostRead;
+static uint8_t bflashhostReadPending;
+static uint32_t bflashhostReadStart;
+static uint32_t bflashhostReads;
+static uint32_t bflashhostReadTotal;
+static uint32_t bflashhostReadWorst;
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t BFLASHHOST_Erase(void);
+static uint8_t BFLASHHOST_Latency(void);
+static uint8_t BFLASHHOST_Suspend(void);
+static uint8_t BFLASHHOST_SFDP(void);
+static uint8_t BFLASHHOST_FourByte(void);
+static uint32_t BFLASHHOST_Run(BFLASH_ERR (*start)(BFLASH_Device_td *device, BFLASH_Access_td *user), BFLASH_Access_td *access);
+static void BFLASHHOST_RunPreempted(BFLASH_Access_td *access, uint8_t priority, uint32_t minGap, uint32_t maxGap);
+static uint8_t BFLASHHOST_IsErased(uint32_t address, uint32_t size);
+static void BFLASHHOST_Complete(BFLASH_Access_td *access, BFLASH_ERR result);
+static void BFLASHHOST_SectorComplete(BFLASH_Access_td *access, BFLASH_ERR result);
+static void BFLASHHOST_ReadComplete(BFLASH_Access_td *access, BFLASH_ERR result);
+static uint32_t BFLASHHOST_Random(uint32_t range);
+static uint8_t BFLASHHOST_Check(uint8_t condition, const char *text);
+static uint8_t BFLASHHOST_IsNear(uint32_t value, uint32_t expected, uint32_t unit);
+
+static const BFLASHHOST_Command_td bflashhostCommands[] =
+{
+	{"erase", BFLASHHOST_Erase},
+	{"latency", BFLASHHOST_Latency},
+	{"suspend", BFLASHHOST_Suspend},
+	{"sfdp", BFLASHHOST_SFDP},
+	{"fourbyte", BFLASHHOST_FourByte},
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief 	Run a command
+  * @param 	argc: argument count
+  * @param 	argv: arguments, the command first
+  * @retval 0 if the command passed
+  */
+int main(int argc, char **argv)
+{
+	for(uint8_t i = 0; (argc > 1) && (i < (sizeof(bflashhostCommands) / sizeof(bflashhostCommands[0]))); i++)
+	{
+		if(strcmp(argv[1], bflashhostCommands[i].name) != 0)
+			continue;
+		printf("%s driver\n", BFLASH_EVENTDRIVEN ? "event driven" : "polled");
+		uint8_t passed = bflashhostCommands[i].run();
+		printf("%s: %s\n", bflashhostCommands[i].name, passed ? "PASS" : "FAIL");
+		return passed ? 0 : 1;
+	}
+
+	printf("usage: bflashHost <command>\n");
+	for(uint8_t i = 0; i < (sizeof(bflashhostCommands) / sizeof(bflashhostCommands[0])); i++)
+		printf("\t%s\n", bflashhostCommands[i].name);
+	return 2;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Time range erases against chained sector erases
+  * @param 	None
+  * @retval 1 if passed
+  */
+static uint8_t BFLASHHOST_Erase(void)
+{
+	static const uint32_t ranges[][2] = {{0x100000, 0x100000}, {0x003000, 0x100000}, {0x007000, 0x9000}, {0, BFLASHSIM_SIZE}};
+	BFLASHSIM_Config_td config = {.spiRate = 1, .fastTick = 100, .pageProgram = 700, .eraseSector = 45000, .erase32K = 120000, .erase64K = 150000, .eraseChip = 20000000};
+	uint8_t passed = 1;
+
+	printf("%-18s %10s %10s %6s %6s %6s %6s\n", "range", "sectors", "range", "64K", "32K", "4K", "chip");
+	for(uint8_t i = 0; i < (sizeof(ranges) / sizeof(ranges[0])); i++)
+	{
+		BFLASH_Access_td access = {0};
+
+		//One sector at a time, each queued from the last complete
+		BFLASHSIM_Init(&bflashhostDevice, &config, &bflashhostStats);
+		memset(BFLASHSIM_GetMemory(), 0, BFLASHSIM_SIZE);
+		access.address = ranges[i][0];
+		bflashhostSectorEnd = ranges[i][0] + ranges[i][1];
+		uint32_t sectorTime = BFLASHHOST_Run(BFLASH_EraseSector, &access);
+		passed &= (bflashhostResult == BFLASH_ERROK) && (bflashhostStats.errors == 0) && BFLASHHOST_IsErased(ranges[i][0], ranges[i][1]);
+
+		BFLASHSIM_Init(&bflashhostDevice, &config, &bflashhostStats);
+		memset(BFLASHSIM_GetMemory(), 0, BFLASHSIM_SIZE);
+		access.address = ranges[i][0];
+		access.size = ranges[i][1];
+		uint32_t rangeTime = BFLASHHOST_Run(BFLASH_EraseRange, &access);
+		passed &= (bflashhostResult == BFLASH_ERROK) && (bflashhostStats.errors == 0) && BFLASHHOST_IsErased(ranges[i][0], ranges[i][1]);
+
+		char name[24];
+		snprintf(name, sizeof(name), "%06x+%06x", (unsigned)ranges[i][0], (unsigned)ranges[i][1]);
+		printf("%-18s %9.2fs %9.2fs %6u %6u %6u %6u\n", name, sectorTime / 1e6, rangeTime / 1e6,
+				(unsigned)bflashhostStats.commands[0xD8], (unsigned)bflashhostStats.commands[0x52],
+				(unsigned)bflashhostStats.commands[0x20], (unsigned)bflashhostStats.commands[0x60]);
+	}
+	return passed;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Time single accesses
+  * @param 	None
+  * @retval 1 if passed
+  */
+static uint8_t BFLASHHOST_Latency(void)
+{
+	BFLASHSIM_Config_td config = {.spiRate = 1, .fastTick = 100, .pageProgram = 700, .eraseSector = 45000, .erase32K = 120000, .erase64K = 150000, .eraseChip = 20000000};
+	static uint8_t writeData[4096];
+	static uint8_t readData[4096];
+	BFLASH_Access_td access = {0};
+	uint8_t passed = 1;
+
+	BFLASHSIM_Init(&bflashhostDevice, &config, &bflashhostStats);
+	memset(writeData, 0x5a, sizeof(writeData));
+	for(uint32_t i = 0; i < sizeof(writeData); i += 7)
+		writeData[i] = (uint8_t)i;
+
+	access.address = 0x1000;
+	access.size = 0x1000;
+	printf("erase sector    %6u us\n", (unsigned)BFLASHHOST_Run(BFLASH_EraseSector, &access));
+
+	access.data = writeData;
+	access.size = 256;
+	printf("write 1 page    %6u us\n", (unsigned)BFLASHHOST_Run(BFLASH_Write, &access));
+
+	access.address = 0x1100;
+	access.data = &writeData[256];
+	access.size = 3840;
+	printf("write 15 pages  %6u us\n", (unsigned)BFLASHHOST_Run(BFLASH_Write, &access));
+	passed &= (memcmp(&BFLASHSIM_GetMemory()[0x1000], writeData, sizeof(writeData)) == 0);
+
+	access.address = 0x1000;
+	access.data = readData;
+	access.size = 16;
+	printf("read 16B        %6u us\n", (unsigned)BFLASHHOST_Run(BFLASH_Read, &access));
+	access.size = 256;
+	printf("read 256B       %6u us\n", (unsigned)BFLASHHOST_Run(BFLASH_Read, &access));
+	access.size = 4096;
+	printf("read 4K         %6u us\n", (unsigned)BFLASHHOST_Run(BFLASH_Read, &access));
+	passed &= (memcmp(readData, writeData, sizeof(readData)) == 0);
+
+	printf("SPI interrupts  %6u\n", (unsigned)bflashhostStats.interrupts);
+	return passed && (bflashhostStats.errors == 0);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Time reads made while the flash is erasing and programming
+  * @param 	None
+  * @retval 1 if passed
+  */
+static uint8_t BFLASHHOST_Suspend(void)
+{
+	BFLASHSIM_Config_td config = {.spiRate = 1, .fastTick = 100, .pageProgram = 700, .eraseSector = 400000, .erase32K = 120000, .erase64K = 150000, .eraseChip = 20000000, .suspendLatency = 20};
+	static uint8_t writeData[4096];
+	static uint8_t readData[256];
+	uint8_t passed = 1;
+
+	memset(writeData, 0x01, sizeof(writeData));
+	printf("%-8s %-8s %10s %6s %10s %10s %9s\n", "access", "reads", "time (us)", "reads", "worst (us)", "avg (us)", "suspends");
+	for(uint8_t priority = BFLASH_PRIORITY_NORMAL; priority <= BFLASH_PRIORITY_HIGH; priority++)
+	{
+		const char *priorityName = (priority == BFLASH_PRIORITY_HIGH) ? "high" : "normal";
+		bflashhostRandom = 3;
+		BFLASHSIM_Init(&bflashhostDevice, &config, &bflashhostStats);
+		memset(BFLASHSIM_GetMemory(), 0x11, BFLASHSIM_SIZE);
+		memset(&bflashhostRead, 0, sizeof(bflashhostRead));
+		bflashhostRead.address = 0x10000;
+		bflashhostRead.data = readData;
+		bflashhostRead.size = sizeof(readData);
+
+		//Sector erase, a read every 5 to 35ms
+		BFLASH_Access_td access = {0};
+		access.address = 0x1000;
+		access.size = 0x1000;
+		BFLASH_ResetQueueStats(&bflashhostDevice);
+		uint32_t start = BFLASHSIM_GetTime();
+		BFLASHHOST_RunPreempted(&access, priority, 5000, 35000);
+		printf("%-8s %-8s %10u %6u %10u %10u %9u\n", "erase", priorityName, (unsigned)(BFLASHSIM_GetTime() - start), (unsigned)bflashhostReads,
+				(unsigned)bflashhostReadWorst, (unsigned)(bflashhostReads ? (bflashhostReadTotal / bflashhostReads) : 0), (unsigned)BFLASH_GetQueueStats(&bflashhostDevice)->suspends);
+		passed &= BFLASHHOST_IsErased(0x1000, 0x1000);
+
+		//16 pages, a read every 1 to 3ms
+		access.data = writeData;
+		access.size = sizeof(writeData);
+		BFLASH_ResetQueueStats(&bflashhostDevice);
+		start = BFLASHSIM_GetTime();
+		BFLASHHOST_RunPreempted(&access, priority, 1000, 3000);
+		printf("%-8s %-8s %10u %6u %10u %10u %9u\n", "write", priorityName, (unsigned)(BFLASHSIM_GetTime() - start), (unsigned)bflashhostReads,
+				(unsigned)bflashhostReadWorst, (unsigned)(bflashhostReads ? (bflashhostReadTotal / bflashhostReads) : 0), (unsigned)BFLASH_GetQueueStats(&bflashhostDevice)->suspends);
+		passed &= (memcmp(&BFLASHSIM_GetMemory()[0x1000], writeData, sizeof(writeData)) == 0);
+
+		passed &= (bflashhostStats.errors == 0) && (readData[0] == 0x11);
+	}
+	return passed;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Compare the configuration from SFDP with the JEDEC ID table
+  * @param 	None
+  * @retval 1 if passed
+  */
+static uint8_t BFLASHHOST_SFDP(void)
+{
+	BFLASHSIM_Config_td config = {.spiRate = 1, .fastTick = 100, .pageProgram = 700, .eraseSector = 45000, .erase32K = 120000, .erase64K = 150000, .eraseChip = 20000000};
+	BFLASH_Access_td access = {0};
+	uint8_t id[3];
+	uint8_t passed = 1;
+
+	BFLASHSIM_Init(&bflashhostDevice, &config, &bflashhostStats);
+	passed &= BFLASHHOST_Check(BFLASH_ConfigureFlash(&bflashhostDevice, BFLASHSIM_JEDECID) == BFLASH_ERROK, "JEDEC ID table");
+	BFLASH_Info_td jedec = bflashhostDevice.info;
+
+	//Nothing left over from the JEDEC ID table
+	memset(&bflashhostDevice.info, 0, sizeof(bflashhostDevice.info));
+	access.data = id;
+	uint32_t time = BFLASHHOST_Run(BFLASH_Discover, &access);
+	BFLASH_Info_td *sfdp = &bflashhostDevice.info;
+	printf("discover        %6u us\n", (unsigned)time);
+
+	passed &= BFLASHHOST_Check(bflashhostResult == BFLASH_ERROK, "discover result");
+	passed &= BFLASHHOST_Check((id[0] == 0xef) && (id[1] == 0x40) && (id[2] == 0x17), "JEDEC ID");
+	passed &= BFLASHHOST_Check(sfdp->fromSFDP && !jedec.fromSFDP, "configured from SFDP");
+	passed &= BFLASHHOST_Check(sfdp->isReady == jedec.isReady, "isReady");
+	passed &= BFLASHHOST_Check(sfdp->jedecID == jedec.jedecID, "jedecID");
+	passed &= BFLASHHOST_Check(sfdp->flashSize == jedec.flashSize, "flashSize");
+	passed &= BFLASHHOST_Check(sfdp->sectorSize == jedec.sectorSize, "sectorSize");
+	passed &= BFLASHHOST_Check(sfdp->pageSize == jedec.pageSize, "pageSize");
+	passed &= BFLASHHOST_Check(sfdp->readModes == jedec.readModes, "readModes");
+	passed &= BFLASHHOST_Check(sfdp->readMode == jedec.readMode, "readMode");
+	passed &= BFLASHHOST_Check(memcmp(sfdp->readInstructions, jedec.readInstructions, sizeof(jedec.readInstructions)) == 0, "readInstructions");
+	passed &= BFLASHHOST_Check(memcmp(sfdp->readDummyBytes, jedec.readDummyBytes, sizeof(jedec.readDummyBytes)) == 0, "readDummyBytes");
+	for(uint8_t i = 0; i < BFLASH_ERASETYPECOUNT; i++)
+	{
+		passed &= BFLASHHOST_Check(sfdp->eraseTypes[i].size == jedec.eraseTypes[i].size, "eraseTypes size");
+		passed &= BFLASHHOST_Check(sfdp->eraseTypes[i].instruction == jedec.eraseTypes[i].instruction, "eraseTypes instruction");
+		passed &= BFLASHHOST_Check(BFLASHHOST_IsNear(sfdp->eraseTypes[i].time, jedec.eraseTypes[i].time, 16), "eraseTypes time");
+	}
+	passed &= BFLASHHOST_Check(sfdp->sectorErase == jedec.sectorErase, "sectorErase");
+	passed &= BFLASHHOST_Check(sfdp->pageProgram == jedec.pageProgram, "pageProgram");
+	passed &= BFLASHHOST_Check(BFLASHHOST_IsNear(sfdp->pageProgramTime, jedec.pageProgramTime, 64), "pageProgramTime");
+	passed &= BFLASHHOST_Check(BFLASHHOST_IsNear(sfdp->chipEraseTime, jedec.chipEraseTime, 4000), "chipEraseTime");
+	passed &= BFLASHHOST_Check(sfdp->addressBytes == jedec.addressBytes, "addressBytes");
+
+	printf("%-8s %10s %10s\n", "time", "JEDEC ID", "SFDP");
+	for(uint8_t i = 0; i < BFLASH_ERASETYPECOUNT; i++)
+	{
+		char name[12];
+		snprintf(name, sizeof(name), "%uK", (unsigned)(sfdp->eraseTypes[i].size / 1024));
+		if(sfdp->eraseTypes[i].size != 0)
+			printf("%-8s %8ums %8ums\n", name, (unsigned)jedec.eraseTypes[i].time, (unsigned)sfdp->eraseTypes[i].time);
+	}
+	printf("%-8s %8uus %8uus\n", "page", (unsigned)jedec.pageProgramTime, (unsigned)sfdp->pageProgramTime);
+	printf("%-8s %8ums %8ums\n", "chip", (unsigned)jedec.chipEraseTime, (unsigned)sfdp->chipEraseTime);
+	return passed && BFLASHHOST_Check(bflashhostStats.errors == 0, "protocol errors");
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Discover a part above 16MB and access it across the 16MB boundary
+  * @param 	None
+  * @retval 1 if passed
+  */
+static uint8_t BFLASHHOST_FourByte(void)
+{
+	BFLASHSIM_Config_td config = {.part = BFLASHSIM_PART_W25Q512, .spiRate = 1, .fastTick = 100, .pageProgram = 700, .eraseSector = 45000, .erase32K = 120000, .erase64K = 150000, .eraseChip = 20000000};
+	static uint8_t writeData[0x300];
+	static uint8_t readData[0x300];
+	BFLASH_Access_td access = {0};
+	uint8_t passed = 1;
+
+	BFLASHSIM_Init(&bflashhostDevice, &config, &bflashhostStats);
+	memset(BFLASHSIM_GetMemory(), 0x11, BFLASHSIM_SIZE512);
+	BFLASHHOST_Run(BFLASH_Discover, &access);
+	BFLASH_Info_td *info = &bflashhostDevice.info;
+	passed &= BFLASHHOST_Check(bflashhostResult == BFLASH_ERROK, "discover result");
+	passed &= BFLASHHOST_Check(info->isReady && info->fromSFDP, "configured from SFDP");
+	passed &= BFLASHHOST_Check(info->jedecID == BFLASHSIM_JEDECID512, "jedecID");
+	passed &= BFLASHHOST_Check(info->flashSize == BFLASHSIM_SIZE512, "flashSize");
+	passed &= BFLASHHOST_Check(info->addressBytes == 4, "addressBytes");
+	passed &= BFLASHHOST_Check((info->readInstructions[BFLASH_READMODE_STANDARD] == 0x13) && (info->readInstructions[BFLASH_READMODE_FAST] == 0x0C) &&
+			(info->readInstructions[BFLASH_READMODE_DUAL] == 0x3C) && (info->readInstructions[BFLASH_READMODE_QUAD] == 0x6C), "readInstructions");
+	passed &= BFLASHHOST_Check(info->pageProgram == 0x12, "pageProgram");
+	passed &= BFLASHHOST_Check((info->eraseTypes[0].instruction == 0xDC) && (info->eraseTypes[1].instruction == 0x5C) &&
+			(info->eraseTypes[2].instruction == 0x21) && (info->eraseTypes[3].size == 0), "eraseTypes");
+	passed &= BFLASHHOST_Check((info->sectorSize == 0x1000) && (info->sectorErase == 0x21), "sectorErase");
+
+	//Two sectors below 16MB, a 64K block above, then a 32K block and a sector
+	access.address = 0xFFE000;
+	access.size = 0x1B000;
+	uint32_t eraseTime = BFLASHHOST_Run(BFLASH_EraseRange, &access);
+	passed &= BFLASHHOST_Check((bflashhostResult == BFLASH_ERROK) && BFLASHHOST_IsErased(0xFFE000, 0x1B000), "range erase");
+	passed &= BFLASHHOST_Check((bflashhostStats.commands[0xDC] == 1) && (bflashhostStats.commands[0x5C] == 1) && (bflashhostStats.commands[0x21] == 3), "4 byte erases");
+
+	//A part page either side of the boundary and two whole pages above it
+	for(uint32_t i = 0; i < sizeof(writeData); i++)
+		writeData[i] = (uint8_t)((i * 13) + 1);
+	access.address = 0xFFFF80;
+	access.data = writeData;
+	access.size = sizeof(writeData);
+	uint32_t writeTime = BFLASHHOST_Run(BFLASH_Write, &access);
+	passed &= BFLASHHOST_Check((bflashhostResult == BFLASH_ERROK) && (memcmp(&BFLASHSIM_GetMemory()[0xFFFF80], writeData, sizeof(writeData)) == 0), "write");
+	passed &= BFLASHHOST_Check(bflashhostStats.commands[0x12] == 4, "4 byte programs");
+
+	access.data = readData;
+	uint32_t readTime = BFLASHHOST_Run(BFLASH_Read, &access);
+	passed &= BFLASHHOST_Check((bflashhostResult == BFLASH_ERROK) && (memcmp(readData, writeData, sizeof(readData)) == 0), "read");
+	passed &= BFLASHHOST_Check((bflashhostStats.commands[0x0C] + bflashhostStats.commands[0x13]) == 1, "4 byte read");
+
+	//Nothing sent with a 3 byte address
+	static const uint8_t instructions3Byte[] = {0x03, 0x0B, 0x3B, 0x6B, 0x02, 0x20, 0x52, 0xD8};
+	for(uint8_t i = 0; i < sizeof(instructions3Byte); i++)
+		passed &= BFLASHHOST_Check(bflashhostStats.commands[instructions3Byte[i]] == 0, "3 byte instruction");
+
+	printf("erase 108K      %6u us\n", (unsigned)eraseTime);
+	printf("write 768B      %6u us\n", (unsigned)writeTime);
+	printf("read 768B       %6u us\n", (unsigned)readTime);
+	return passed && BFLASHHOST_Check(bflashhostStats.errors == 0, "protocol errors");
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Run an access to completion. Sector erases are chained up to
+  * 		bflashhostSectorEnd if set
+  * @param 	start: the API call starting the access
+  * @param 	access: pointer to the access
+  * @retval Microseconds taken
+  */
+static uint32_t BFLASHHOST_Run(BFLASH_ERR (*start)(BFLASH_Device_td *device, BFLASH_Access_td *user), BFLASH_Access_td *access)
+{
+	uint32_t startTime = BFLASHSIM_GetTime();
+	bflashhostDone = 0;
+	access->completeCallback = (bflashhostSectorEnd != 0) ? BFLASHHOST_SectorComplete : BFLASHHOST_Complete;
+	bflashhostResult = start(&bflashhostDevice, access);
+	if(bflashhostResult != BFLASH_ERROK)
+		return 0;
+
+	while(!bflashhostDone && ((BFLASHSIM_GetTime() - startTime) < BFLASHHOST_TIMELIMIT))
+		BFLASHSIM_Step();
+	if(!bflashhostDone)
+		bflashhostResult = BFLASH_ERRTIMEOUT;
+
+	bflashhostSectorEnd = 0;
+	return BFLASHSIM_GetTime() - startTime;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Run an erase or write while reading at random intervals
+  * @param 	access: pointer to the erase or write. Sector erase if no data
+  * @param 	priority: priority of the reads
+  * @param 	minGap: shortest time between reads (us)
+  * @param 	maxGap: longest time between reads (us)
+  * @retval None
+  */
+static void BFLASHHOST_RunPreempted(BFLASH_Access_td *access, uint8_t priority, uint32_t minGap, uint32_t maxGap)
+{
+	bflashhostReads = 0;
+	bflashhostReadTotal = 0;
+	bflashhostReadWorst = 0;
+	bflashhostReadPending = 0;
+	bflashhostRead.priority = priority;
+	bflashhostRead.completeCallback = BFLASHHOST_ReadComplete;
+
+	bflashhostDone = 0;
+	access->completeCallback = BFLASHHOST_Complete;
+	if(access->data == NULL)
+		BFLASH_EraseSector(&bflashhostDevice, access);
+	else
+		BFLASH_Write(&bflashhostDevice, access);
+
+	uint32_t nextRead = BFLASHSIM_GetTime() + minGap + BFLASHHOST_Random(maxGap - minGap);
+	while(!bflashhostDone || bflashhostReadPending)
+	{
+		BFLASHSIM_Step();
+		if(!bflashhostDone && !bflashhostReadPending && (BFLASHSIM_GetTime() >= nextRead))
+		{
+			bflashhostReadPending = 1;
+			bflashhostReadStart = BFLASHSIM_GetTime();
+			BFLASH_Read(&bflashhostDevice, &bflashhostRead);
+			nextRead = BFLASHSIM_GetTime() + minGap + BFLASHHOST_Random(maxGap - minGap);
+		}
+	}
+	access->completeCallback = NULL;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Check that only a range of the flash is erased
+  * @param 	address: start of the range
+  * @param 	size: size of the range
+  * @retval 1 if the range is erased and the rest is not
+  */
+static uint8_t BFLASHHOST_IsErased(uint32_t address, uint32_t size)
+{
+	uint8_t *memory = BFLASHSIM_GetMemory();
+	for(uint32_t i = 0; i < bflashhostDevice.info.flashSize; i++)
+	{
+		uint8_t inRange = (i >= address) && (i < (address + size));
+		if(inRange != (memory[i] == 0xff))
+			return 0;
+	}
+	return 1;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Access complete
+  * @param 	access: pointer to the access
+  * @param 	result: result of the access
+  * @retval None
+  */
+static void BFLASHHOST_Complete(BFLASH_Access_td *access, BFLASH_ERR result)
+{
+	bflashhostResult = result;
+	bflashhostDone = 1;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Sector erase complete. Queue the next sector from the callback
+  * @param 	access: pointer to the access
+  * @param 	result: result of the access
+  * @retval None
+  */
+static void BFLASHHOST_SectorComplete(BFLASH_Access_td *access, BFLASH_ERR result)
+{
+	access->address += 0x1000;
+	if((result == BFLASH_ERROK) && (access->address < bflashhostSectorEnd) && (BFLASH_EraseSector(access->device, access) == BFLASH_ERROK))
+		return;
+	BFLASHHOST_Complete(access, result);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Preempting read complete
+  * @param 	access: pointer to the access
+  * @param 	result: result of the access
+  * @retval None
+  */
+static void BFLASHHOST_ReadComplete(BFLASH_Access_td *access, BFLASH_ERR result)
+{
+	uint32_t latency = BFLASHSIM_GetTime() - bflashhostReadStart;
+	bflashhostReadPending = 0;
+	bflashhostReads++;
+	bflashhostReadTotal += latency;
+	if(latency > bflashhostReadWorst)
+		bflashhostReadWorst = latency;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Report a failed check
+  * @param 	condition: result of the check
+  * @param 	text: the check
+  * @retval condition
+  */
+static uint8_t BFLASHHOST_Check(uint8_t condition, const char *text)
+{
+	if(!condition)
+		printf("\tfailed: %s\n", text);
+	return condition;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Compare a typical time read from SFDP, which is rounded up to
+  * 		the unit it is held in
+  * @param 	value: time from SFDP
+  * @param 	expected: time from the JEDEC ID table
+  * @param 	unit: unit of the SFDP time
+  * @retval 1 if value is expected rounded up to the unit
+  */
+static uint8_t BFLASHHOST_IsNear(uint32_t value, uint32_t expected, uint32_t unit)
+{
+	return (value >= expected) && (value < (expected + unit));
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Repeatable random number
+  * @param 	range: numbers returned are below this
+  * @retval Random number
+  */
+static uint32_t BFLASHHOST_Random(uint32_t range)
+{
+	bflashhostRandom = (bflashhostRandom * 1103515245) + 12345;
+	return (range > 0) ? ((bflashhostRandom >> 8) % range) : 0;
+}
+
+#endif
@@ -0,0 +1,564 @@
+/*
+ * bSPIFlashSim.c
+ *
+ *  Created on: Aug 19, 2024
+ *      Author: ben-linux
+ */
+/*
+ * INFORMATION
+ *
+ * 	o Only built for the Linux host build. A simulated W25Q64 or W25Q512 on
+ * 	  a simulated SPI bus, as the transport of a BFLASH_Device_td, for
+ * 	  timing the driver off target
+ * 	o BFLASHSIM_Step advances virtual time by a microsecond. It raises the
+ * 	  SPI complete interrupt of a transfer once its data has been moved at
+ * 	  spiRate, runs BFLASH_tick every millisecond and BFLASH_fastTick every
+ * 	  fastTick microseconds
+ * 	o FLASH
+ * 		o Instructions are decoded from the first transfer after chip select
+ * 		  goes low, later transfers are the data
+ * 		o Read, fast read, read status, read ID, read SFDP, write enable,
+ * 		  page program, sector, 32K, 64K and chip erase, suspend and resume
+ * 		o The W25Q512 stays in 3 byte address mode and also decodes the 4
+ * 		  byte instructions, 0x13/0x0C read, 0x12 program, 0x21/0x5C/0xDC
+ * 		  erase. 3 byte instructions reach the first 16MB
+ * 		o The SFDP tables are a JESD216B header and basic flash parameter
+ * 		  table with the W25Q64JV instructions, erase types and typical
+ * 		  times, rounded up to the units SFDP can hold. The W25Q512 table
+ * 		  adds the size, 3 or 4 byte addressing and the 4 byte instruction
+ * 		  set in DWORD16. BFLASH_Discover configures the device from them
+ * 		o Programs and erases change the memory at once, and the flash then
+ * 		  reports busy for their time. WEL stays set until they finish
+ * 		o Suspend stops the time of a program or erase and reports busy for
+ * 		  suspendLatency. Resume restarts it
+ * 	o Protocol errors are counted rather than stopping the simulation
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "bSPIFlashSim.h"
+#if defined(__linux__)
+#include "string.h"
+#include "stddef.h"
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+	uint32_t jedecID;
+	uint32_t size;
+	const uint32_t *bfpt;					//Basic flash parameter table
+}BFLASHSIM_Part_td;
+
+/* Private define ------------------------------------------------------------*/
+#define BFLASHSIM_READ							0x03
+#define BFLASHSIM_FASTREAD						0x0B
+#define BFLASHSIM_READSTATUS					0x05
+#define BFLASHSIM_READJEDECID					0x9F
+#define BFLASHSIM_WRITEENABLE					0x06
+#define BFLASHSIM_PAGEPROGRAM					0x02
+#define BFLASHSIM_ERASESECTOR					0x20
+#define BFLASHSIM_ERASEBLOCK32					0x52
+#define BFLASHSIM_ERASEBLOCK64					0xD8
+#define BFLASHSIM_ERASECHIP						0x60
+#define BFLASHSIM_SUSPEND						0x75
+#define BFLASHSIM_RESUME						0x7A
+#define BFLASHSIM_READSFDP						0x5A
+#define BFLASHSIM_READ4B						0x13
+#define BFLASHSIM_FASTREAD4B					0x0C
+#define BFLASHSIM_PAGEPROGRAM4B					0x12
+#define BFLASHSIM_ERASESECTOR4B					0x21
+#define BFLASHSIM_ERASEBLOCK324B				0x5C
+#define BFLASHSIM_ERASEBLOCK644B				0xDC
+#define BFLASHSIM_PAGESIZE						256
+#define BFLASHSIM_TRANSFERSETUP					2			//Microseconds to start a DMA transfer
+#define BFLASHSIM_BFPTADDRESS					0x80		//SFDP address of the basic flash parameter table
+#define BFLASHSIM_BFPTDWORDS					16
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+//SFDP header and the basic flash parameter table header, JESD216B
+static const uint8_t bflashsimSFDPHeader[16] =
+{
+	0x53, 0x46, 0x44, 0x50, 0x06, 0x01, 0x00, 0xFF,
+	0x00, 0x06, 0x01, BFLASHSIM_BFPTDWORDS, BFLASHSIM_BFPTADDRESS, 0x00, 0x00, 0xFF,
+};
+
+//Basic flash parameter tables
+static const uint32_t bflashsimBFPT[BFLASHSIM_BFPTDWORDS] =
+{
+	0xFFF120E5,			//1: 4K erase 0x20, 3 byte addresses, 1-1-2, 1-2-2, 1-4-4 and 1-1-4 reads
+	0x03FFFFFF,			//2: 64Mb
+	0x6B08EB44,			//3: 1-4-4 0xEB 4 dummy 2 mode clocks, 1-1-4 0x6B 8 dummy clocks
+	0xBB423B08,			//4: 1-1-2 0x3B 8 dummy clocks, 1-2-2 0xBB 2 dummy 2 mode clocks
+	0xFFFFFFFE,			//5: No 2-2-2 or 4-4-4
+	0x0000FFFF,			//6
+	0x0000FFFF,			//7
+	0x520F200C,			//8: 4K 0x20, 32K 0x52
+	0x0000D810,			//9: 64K 0xD8
+	0x00A53A22,			//10: Typical erase 48ms, 128ms, 160ms
+	0x44002682,			//11: 256 byte pages, typical page program 448us, chip erase 20s
+	0x00000000,			//12: Suspend and resume supported
+	0x757A757A,			//13: Suspend 0x75, resume 0x7A
+	0x00000000,			//14
+	0x00000000,			//15
+	0x00001000,			//16: 3 byte addresses only, soft reset 0x66 0x99
+};
+static const uint32_t bflashsimBFPT512[BFLASHSIM_BFPTDWORDS] =
+{
+	0xFFF320E5,			//1: As the W25Q64, 3 or 4 byte addresses
+	0x1FFFFFFF,			//2: 512Mb
+	0x6B08EB44,			//3
+	0xBB423B08,			//4
+	0xFFFFFFFE,			//5
+	0x0000FFFF,			//6
+	0x0000FFFF,			//7
+	0x520F200C,			//8
+	0x0000D810,			//9
+	0x00A53A22,			//10
+	0x44002682,			//11
+	0x00000000,			//12
+	0x757A757A,			//13
+	0x00000000,			//14
+	0x00000000,			//15
+	0x21001000,			//16: Enter 4 byte mode with 0xB7, 4 byte instruction set, soft reset 0x66 0x99
+};
+
+static const BFLASHSIM_Part_td bflashsimParts[] =
+{
+	[BFLASHSIM_PART_W25Q64] = {BFLASHSIM_JEDECID, BFLASHSIM_SIZE, bflashsimBFPT},
+	[BFLASHSIM_PART_W25Q512] = {BFLASHSIM_JEDECID512, BFLASHSIM_SIZE512, bflashsimBFPT512},
+};
+
+static BFLASHSIM_Config_td bflashsimConfig;
+static BFLASHSIM_Stats_td *bflashsimStats;
+static BFLASHSIM_Stats_td bflashsimDiscard;
+static BFLASH_Device_td *bflashsimDevice;
+static const BFLASHSIM_Part_td *bflashsimPart;
+static uint8_t bflashsimMemory[BFLASHSIM_SIZE512];
+static uint32_t bflashsimTime;
+
+//SPI
+static int64_t bflashsimTransferEnd;		//-1 if idle
+static uint8_t bflashsimTransferReceive;
+
+//FLASH
+static uint8_t bflashsimSelected;			//First transfer after chip select carries the instruction
+static uint8_t bflashsimInstruction;
+static uint32_t bflashsimAddress;
+static uint8_t bflashsimWEL;
+static uint8_t bflashsimOperating;			//Program or erase started, WEL clears when it ends
+static uint8_t bflashsimSuspended;
+static uint32_t bflashsimBusyUntil;
+static uint32_t bflashsimRemaining;			//Of the suspended program or erase
+static uint32_t bflashsimSuspendUntil;
+
+/* Private function prototypes -----------------------------------------------*/
+static void BFLASHSIM_ChipSelect(BFLASH_Device_td *device, uint8_t pinState);
+static BFLASH_ERR BFLASHSIM_Transmit(BFLASH_Device_td *device, uint8_t *data, uint32_t length);
+static BFLASH_ERR BFLASHSIM_TransmitReceive(BFLASH_Device_td *device, uint8_t *txData, uint8_t *rxData, uint32_t length);
+static BFLASH_ERR BFLASHSIM_GetSPIStatus(BFLASH_Device_td *device);
+static void BFLASHSIM_StartTransfer(uint32_t length, uint8_t receive);
+static void BFLASHSIM_Instruction(uint8_t *data, uint8_t *rxData, uint32_t length);
+static void BFLASHSIM_Erase(uint32_t size, uint32_t time);
+static uint8_t BFLASHSIM_IsBusy(void);
+static uint8_t BFLASHSIM_GetSFDP(uint32_t address);
+static uint8_t BFLASHSIM_Is4Byte(uint8_t instruction);
+
+static const BFLASH_Transport_td bflashsimTransport =
+{
+	.chipSelect = BFLASHSIM_ChipSelect,
+	.transmit = BFLASHSIM_Transmit,
+	.transmitReceive = BFLASHSIM_TransmitReceive,
+	.getStatus = BFLASHSIM_GetSPIStatus,
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief 	Reset the simulated flash and bus, and configure the device on them
+  * 		from the JEDEC ID table. Parts not in the table are configured
+  * 		with BFLASH_Discover
+  * @param 	device: pointer to the flash device. Initialised on the first call
+  * @param 	config: pointer to the bus and flash timing
+  * @param 	stats: pointer to the statistics to update. May be NULL
+  * @retval None
+  */
+void BFLASHSIM_Init(BFLASH_Device_td *device, const BFLASHSIM_Config_td *config, BFLASHSIM_Stats_td *stats)
+{
+	bflashsimConfig = *config;
+	if(bflashsimConfig.part >= (sizeof(bflashsimParts) / sizeof(bflashsimParts[0])))
+		bflashsimConfig.part = BFLASHSIM_PART_W25Q64;
+	bflashsimPart = &bflashsimParts[bflashsimConfig.part];
+	if(bflashsimConfig.spiRate == 0)
+		bflashsimConfig.spiRate = 1;
+	if(bflashsimConfig.fastTick == 0)
+		bflashsimConfig.fastTick = 100;
+	bflashsimStats = (stats != NULL) ? stats : &bflashsimDiscard;
+	memset(bflashsimStats, 0, sizeof(BFLASHSIM_Stats_td));
+
+	memset(bflashsimMemory, 0xff, bflashsimPart->size);
+	bflashsimTransferEnd = -1;
+	bflashsimSelected = 0;
+	bflashsimWEL = 0;
+	bflashsimOperating = 0;
+	bflashsimSuspended = 0;
+	bflashsimBusyUntil = bflashsimTime;
+	bflashsimSuspendUntil = bflashsimTime;
+
+	//Already initialised devices are refused, and keep their state
+	bflashsimDevice = device;
+	BFLASH_Init(device, &bflashsimTransport, NULL);
+	BFLASH_ConfigureFlash(device, bflashsimPart->jedecID);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Advance virtual time by a microsecond
+  * @param 	None
+  * @retval None
+  */
+void BFLASHSIM_Step(void)
+{
+	bflashsimTime++;
+
+	//SPI complete interrupt
+	if((bflashsimTransferEnd >= 0) && (bflashsimTime >= bflashsimTransferEnd))
+	{
+		bflashsimTransferEnd = -1;
+		bflashsimStats->interrupts++;
+		if(bflashsimTransferReceive)
+			BFLASH_TransmitReceiveCompleteHandler(bflashsimDevice);
+		else
+			BFLASH_TransmitCompleteHandler(bflashsimDevice);
+	}
+
+	if((bflashsimTime % 1000) == 0)
+		BFLASH_tick();
+	if((bflashsimTime % bflashsimConfig.fastTick) == 0)
+		BFLASH_fastTick();
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Get the virtual time
+  * @param 	None
+  * @retval Microseconds
+  */
+uint32_t BFLASHSIM_GetTime(void)
+{
+	return bflashsimTime;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Get the simulated flash memory, to check what was programmed
+  * @param 	None
+  * @retval Pointer to the BFLASHSIM_SIZE or BFLASHSIM_SIZE512 bytes of the flash
+  */
+uint8_t *BFLASHSIM_GetMemory(void)
+{
+	return bflashsimMemory;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Chip select. Low starts an instruction
+  * @param 	device: pointer to the flash device
+  * @param 	pinState: the state of the chip select pin
+  * @retval None
+  */
+static void BFLASHSIM_ChipSelect(BFLASH_Device_td *device, uint8_t pinState)
+{
+	bflashsimSelected = (pinState == 0);
+	if(!bflashsimSelected)
+		bflashsimInstruction = 0;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	SPI transmit by DMA
+  * @param 	device: pointer to the flash device
+  * @param 	data: pointer to the data to transmit
+  * @param 	length: amount of data to transmit
+  * @retval BFLASH_ERR
+  */
+static BFLASH_ERR BFLASHSIM_Transmit(BFLASH_Device_td *device, uint8_t *data, uint32_t length)
+{
+	if(bflashsimSelected)
+		BFLASHSIM_Instruction(data, NULL, length);
+	BFLASHSIM_StartTransfer(length, 0);
+	return BFLASH_ERROK;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	SPI transmit and receive by DMA
+  * @param 	device: pointer to the flash device
+  * @param 	txData: pointer to the data to transmit
+  * @param 	rxData: pointer to the buffer into which to read
+  * @param 	length: amount of data to transfer
+  * @retval BFLASH_ERR
+  */
+static BFLASH_ERR BFLASHSIM_TransmitReceive(BFLASH_Device_td *device, uint8_t *txData, uint8_t *rxData, uint32_t length)
+{
+	if(bflashsimSelected)
+		BFLASHSIM_Instruction(txData, rxData, length);
+	BFLASHSIM_StartTransfer(length, 1);
+	return BFLASH_ERROK;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	SPI status
+  * @param 	device: pointer to the flash device
+  * @retval BFLASH_ERROK once the transfer has finished
+  */
+static BFLASH_ERR BFLASHSIM_GetSPIStatus(BFLASH_Device_td *device)
+{
+	return (bflashsimTransferEnd >= 0) ? BFLASH_ERRBUSY : BFLASH_ERROK;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Time a transfer on the bus
+  * @param 	length: amount of data to transfer
+  * @param 	receive: 1 if transmit and receive
+  * @retval None
+  */
+static void BFLASHSIM_StartTransfer(uint32_t length, uint8_t receive)
+{
+	if(bflashsimTransferEnd >= 0)
+		bflashsimStats->errors++;
+	bflashsimTransferEnd = bflashsimTime + BFLASHSIM_TRANSFERSETUP + ((length + bflashsimConfig.spiRate - 1) / bflashsimConfig.spiRate);
+	bflashsimTransferReceive = receive;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Act on a transfer to the flash
+  * @param 	data: pointer to the data sent
+  * @param 	rxData: pointer to the buffer for the data received. NULL if none
+  * @param 	length: amount of data
+  * @retval None
+  */
+static void BFLASHSIM_Instruction(uint8_t *data, uint8_t *rxData, uint32_t length)
+{
+	//Data phase of the instruction
+	if(bflashsimInstruction != 0)
+	{
+		switch(bflashsimInstruction)
+		{
+		case BFLASHSIM_READ:
+		case BFLASHSIM_FASTREAD:
+		case BFLASHSIM_READ4B:
+		case BFLASHSIM_FASTREAD4B:
+			if(rxData != NULL)
+			{
+				for(uint32_t i = 0; i < length; i++)
+					rxData[i] = bflashsimMemory[(bflashsimAddress + i) % bflashsimPart->size];
+			}
+			bflashsimAddress += length;
+			break;
+
+		case BFLASHSIM_READSFDP:
+			if(rxData != NULL)
+			{
+				for(uint32_t i = 0; i < length; i++)
+					rxData[i] = BFLASHSIM_GetSFDP(bflashsimAddress + i);
+			}
+			bflashsimAddress += length;
+			break;
+
+		case BFLASHSIM_PAGEPROGRAM:
+		case BFLASHSIM_PAGEPROGRAM4B:
+			//Wraps within the page
+			for(uint32_t i = 0; i < length; i++)
+			{
+				uint32_t address = (bflashsimAddress & ~(BFLASHSIM_PAGESIZE - 1)) | ((bflashsimAddress + i) & (BFLASHSIM_PAGESIZE - 1));
+				bflashsimMemory[address % bflashsimPart->size] &= data[i];
+			}
+			bflashsimOperating = 1;
+			bflashsimBusyUntil = bflashsimTime + bflashsimConfig.pageProgram;
+			break;
+		}
+		return;
+	}
+
+	bflashsimInstruction = data[0];
+	bflashsimStats->commands[bflashsimInstruction]++;
+	bflashsimAddress = 0;
+	if(BFLASHSIM_Is4Byte(bflashsimInstruction))
+	{
+		if(length >= 5)
+			bflashsimAddress = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 8) | data[4];
+	}
+	else if(length >= 4)
+		bflashsimAddress = ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+
+	//Only status, suspend and resume while busy. Reads while suspended
+	uint8_t busy = BFLASHSIM_IsBusy();
+	if((bflashsimInstruction != BFLASHSIM_READSTATUS) && (bflashsimInstruction != BFLASHSIM_SUSPEND) && (bflashsimInstruction != BFLASHSIM_RESUME))
+	{
+		uint8_t read = (bflashsimInstruction == BFLASHSIM_READ) || (bflashsimInstruction == BFLASHSIM_FASTREAD) ||
+				(bflashsimInstruction == BFLASHSIM_READ4B) || (bflashsimInstruction == BFLASHSIM_FASTREAD4B);
+		if(busy || (bflashsimSuspended && !read))
+			bflashsimStats->errors++;
+	}
+
+	switch(bflashsimInstruction)
+	{
+	case BFLASHSIM_READSTATUS:
+		if((rxData != NULL) && (length >= 2))
+			rxData[1] = (busy ? 0x01 : 0) | ((bflashsimWEL && !bflashsimSuspended) ? 0x02 : 0);
+		break;
+
+	case BFLASHSIM_READJEDECID:
+		if((rxData != NULL) && (length >= 4))
+		{
+			rxData[1] = (uint8_t)(bflashsimPart->jedecID >> 16);
+			rxData[2] = (uint8_t)(bflashsimPart->jedecID >> 8);
+			rxData[3] = (uint8_t)bflashsimPart->jedecID;
+		}
+		break;
+
+	case BFLASHSIM_WRITEENABLE:
+		bflashsimWEL = 1;
+		break;
+
+	case BFLASHSIM_PAGEPROGRAM:
+	case BFLASHSIM_PAGEPROGRAM4B:
+		if(!bflashsimWEL)
+			bflashsimStats->errors++;
+		break;
+
+	case BFLASHSIM_ERASESECTOR:
+	case BFLASHSIM_ERASESECTOR4B:
+		BFLASHSIM_Erase(0x1000, bflashsimConfig.eraseSector);
+		break;
+
+	case BFLASHSIM_ERASEBLOCK32:
+	case BFLASHSIM_ERASEBLOCK324B:
+		BFLASHSIM_Erase(0x8000, bflashsimConfig.erase32K);
+		break;
+
+	case BFLASHSIM_ERASEBLOCK64:
+	case BFLASHSIM_ERASEBLOCK644B:
+		BFLASHSIM_Erase(0x10000, bflashsimConfig.erase64K);
+		break;
+
+	case BFLASHSIM_ERASECHIP:
+		bflashsimAddress = 0;
+		BFLASHSIM_Erase(bflashsimPart->size, bflashsimConfig.eraseChip);
+		break;
+
+	case BFLASHSIM_SUSPEND:
+		if(bflashsimOperating && !bflashsimSuspended && (bflashsimTime < bflashsimBusyUntil))
+		{
+			bflashsimSuspended = 1;
+			bflashsimRemaining = bflashsimBusyUntil - bflashsimTime;
+			bflashsimSuspendUntil = bflashsimTime + bflashsimConfig.suspendLatency;
+			bflashsimStats->suspends++;
+		}
+		break;
+
+	case BFLASHSIM_RESUME:
+		if(bflashsimSuspended)
+		{
+			bflashsimSuspended = 0;
+			bflashsimBusyUntil = bflashsimTime + bflashsimRemaining;
+		}
+		break;
+
+	case BFLASHSIM_READSFDP:
+		break;
+
+	default:
+		//Other reads see erased memory
+		if(rxData != NULL)
+			memset(rxData, 0xff, length);
+		break;
+	}
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Start an erase at the instruction address
+  * @param 	size: size of the erase
+  * @param 	time: time of the erase (us)
+  * @retval None
+  */
+static void BFLASHSIM_Erase(uint32_t size, uint32_t time)
+{
+	if(!bflashsimWEL || (bflashsimAddress & (size - 1)) || (bflashsimAddress >= bflashsimPart->size))
+	{
+		bflashsimStats->errors++;
+		return;
+	}
+	memset(&bflashsimMemory[bflashsimAddress], 0xff, size);
+	bflashsimOperating = 1;
+	bflashsimBusyUntil = bflashsimTime + time;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Flash busy status. Ends a finished program or erase
+  * @param 	None
+  * @retval 1 if busy
+  */
+static uint8_t BFLASHSIM_IsBusy(void)
+{
+	if(bflashsimTime < bflashsimSuspendUntil)
+		return 1;
+	if(bflashsimSuspended)
+		return 0;
+	if(bflashsimTime < bflashsimBusyUntil)
+		return 1;
+
+	if(bflashsimOperating)
+	{
+		bflashsimOperating = 0;
+		bflashsimWEL = 0;
+	}
+	return 0;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Get a byte of the SFDP tables
+  * @param 	address: SFDP address
+  * @retval Byte at the address, 0xFF outside the tables
+  */
+static uint8_t BFLASHSIM_GetSFDP(uint32_t address)
+{
+	if(address < sizeof(bflashsimSFDPHeader))
+		return bflashsimSFDPHeader[address];
+	if((address >= BFLASHSIM_BFPTADDRESS) && (address < (BFLASHSIM_BFPTADDRESS + (BFLASHSIM_BFPTDWORDS * 4))))
+	{
+		address -= BFLASHSIM_BFPTADDRESS;
+		return (uint8_t)(bflashsimPart->bfpt[address / 4] >> ((address % 4) * 8));
+	}
+	return 0xFF;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief 	Check for an instruction of the 4 byte instruction set
+  * @param 	instruction: the instruction
+  * @retval 1 if the instruction takes a 4 byte address
+  */
+static uint8_t BFLASHSIM_Is4Byte(uint8_t instruction)
+{
+	switch(instruction)
+	{
+	case BFLASHSIM_READ4B:
+	case BFLASHSIM_FASTREAD4B:
+	case BFLASHSIM_PAGEPROGRAM4B:
+	case BFLASHSIM_ERASESECTOR4B:
+	case BFLASHSIM_ERASEBLOCK324B:
+	case BFLASHSIM_ERASEBLOCK644B:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+#endif
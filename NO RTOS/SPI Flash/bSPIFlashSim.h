@@ -0,0 +1,56 @@
+/*
+ * bSPIFlashSim.h
+ *
+ *  Created on: Aug 19, 2024
+ *      Author: ben-linux
+ */
+
+#ifndef BSPIFLASH_BSPIFLASHSIM_H_
+#define BSPIFLASH_BSPIFLASHSIM_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "bSPIFlash.h"
+
+/* Public typedef ------------------------------------------------------------*/
+typedef enum
+{
+	BFLASHSIM_PART_W25Q64 = 0,				//8MB, 3 byte addresses
+	BFLASHSIM_PART_W25Q512,					//64MB, 3 byte address mode with the 4 byte instruction set
+}BFLASHSIM_Part_Enum;
+typedef struct
+{
+	uint8_t part;							//@ref BFLASHSIM_Part_Enum
+	uint32_t spiRate;						//Bytes per microsecond moved by the SPI DMA
+	uint32_t fastTick;						//Microseconds between fast ticks
+	uint32_t pageProgram;					//Page program time (us)
+	uint32_t eraseSector;					//Erase times (us)
+	uint32_t erase32K;
+	uint32_t erase64K;
+	uint32_t eraseChip;
+	uint32_t suspendLatency;				//tSUS, busy after a suspend (us)
+}BFLASHSIM_Config_td;
+typedef struct
+{
+	uint32_t commands[256];					//Instructions received
+	uint32_t interrupts;					//SPI complete interrupts raised
+	uint32_t suspends;						//Programs and erases suspended
+	uint32_t errors;						//Protocol errors. Write without WEL, read while busy, misaligned erase, overlapping transfers
+}BFLASHSIM_Stats_td;
+
+/* Public define -------------------------------------------------------------*/
+#define BFLASHSIM_JEDECID						0xef4017	//W25Q64
+#define BFLASHSIM_SIZE							0x800000
+#define BFLASHSIM_JEDECID512					0xef4020	//W25Q512
+#define BFLASHSIM_SIZE512						0x4000000
+
+/* Public macro --------------------------------------------------------------*/
+/* Public variables ----------------------------------------------------------*/
+/* Public function prototypes ------------------------------------------------*/
+#if defined(__linux__)
+void BFLASHSIM_Init(BFLASH_Device_td *device, const BFLASHSIM_Config_td *config, BFLASHSIM_Stats_td *stats);
+void BFLASHSIM_Step(void);
+uint32_t BFLASHSIM_GetTime(void);
+uint8_t *BFLASHSIM_GetMemory(void);
+#endif
+
+#endif /* BSPIFLASH_BSPIFLASHSIM_H_ */
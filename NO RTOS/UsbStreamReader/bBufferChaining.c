@@ -190,7 +190,7 @@ void BCHAIN_GetLoadedChainBuffers(BCHAIN_Chain_td *chain, BCHAIN_Chain_td *remov
 			return;
 
 		offset += buffer->length;
-		if((buffer->length != sizeof(buffer->data)) && (flags & BCHAIN_FLAG_ACCEPTPARTIALBUFFERS))
+		if((buffer->length != sizeof(buffer->data)) && !(flags & BCHAIN_FLAG_ACCEPTPARTIALBUFFERS))
 			return;
 
 		BCHAIN_ChainRemoveHead(chain);
@@ -23,6 +23,7 @@ typedef enum
 	BSTREAM_NOTENOUGHDATA = 2,
 	BSTREAM_BUSY = 3,
 	BSTREAM_CLOSED = 4,
+	BSTREAM_CRCERROR = 5,
 }BSTREAM_Enum;
 
 typedef struct BSTREAM_Reader_td
@@ -0,0 +1,303 @@
+/**
+  ******************************************************************************
+  * @file     	bStreamCRC.c
+  * @author		beede
+  * @version	1V0
+  * @date		Jul 29, 2024
+  * @brief		Incremental whole stream CRC verification
+  */
+/*
+ * INFORMATION
+ *
+ * 	o The verifier holds the CRC32 of the stream from 0 up to offset, and is
+ * 	  fed data as it is delivered. Data is never read twice
+ * 	o Data at offset, or at the end of a pending segment, extends that CRC32
+ * 	  directly. Only data arriving ahead of everything held starts its own
+ * 	  CRC32 as a new pending segment
+ * 	o crc32_combine is only used to close a gap, merging segments with the
+ * 	  running CRC or each other once the data between them arrives. In
+ * 	  order delivery costs one plain CRC32 pass
+ * 	o Data already accounted for (below offset or within a pending segment)
+ * 	  is ignored, so duplicated and retransmitted chunks are harmless
+ * 	o If more than BSCRC_PENDINGCOUNT separate gaps exist the segment is
+ * 	  dropped. The verified offset cannot pass the dropped data until it is
+ * 	  delivered again, so the result stays BSTREAM_NOTENOUGHDATA rather than
+ * 	  a CRC error. A client that seeks forward many times only loses the
+ * 	  verification, which close reports. A mismatch is only reported once
+ * 	  the whole stream has been hashed
+ * 	o BSCRC_Reader_td applies the verifier to the data read from any stream
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "bStreamCRC.h"
+#include "utils.h"
+#include "string.h"
+
+/* Private define ------------------------------------------------------------*/
+/* Private typedef -----------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+static void BSCRC_AddSegment(BSCRC_Verifier_td *verifier, uint32_t offset, uint8_t *data, uint32_t length);
+static void BSCRC_RemovePending(BSCRC_Verifier_td *verifier, uint8_t idx);
+
+static BSTREAM_Enum BSCRC_StreamOpen(struct BSTREAM_Reader_td *stream);
+static BSTREAM_Enum BSCRC_StreamCount(struct BSTREAM_Reader_td *stream, uint32_t offset, uint32_t *count);
+static BSTREAM_Enum BSCRC_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t offset, uint8_t *data, uint32_t length, uint32_t *actualLength);
+static BSTREAM_Enum BSCRC_StreamClose(struct BSTREAM_Reader_td *stream);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief	Initialize a verifier
+  * @param	verifier: pointer to the verifier
+  * @param	length: length of the stream
+  * @param	crc: expected CRC32 of the stream
+  * @retval	None
+  */
+void BSCRC_Init(BSCRC_Verifier_td *verifier, uint32_t length, uint32_t crc)
+{
+	verifier->length = length;
+	verifier->expected = crc;
+	verifier->crc = 0;
+	verifier->offset = 0;
+	verifier->pendingCount = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Feed delivered stream data to the verifier. Data may arrive in any
+  * 		order and may be repeated
+  * @param	verifier: pointer to the verifier
+  * @param	offset: stream offset of the data
+  * @param	data: pointer to the data
+  * @param	length: amount of data
+  * @retval	None
+  */
+void BSCRC_Update(BSCRC_Verifier_td *verifier, uint32_t offset, uint8_t *data, uint32_t length)
+{
+	uint32_t end = offset + length;
+	if(end > verifier->length)
+		end = verifier->length;
+	uint32_t start = offset;
+
+	while(1)
+	{
+		//Skip data already verified. Folding pending segments moves the verified offset on
+		if(start < verifier->offset)
+			start = verifier->offset;
+		if(start >= end)
+			break;
+
+		//Find the first pending segment not entirely below start
+		uint8_t i = 0;
+		while((i < verifier->pendingCount) && ((verifier->pending[i].offset + verifier->pending[i].length) <= start))
+			i++;
+
+		//Skip data already held
+		uint32_t pieceEnd = end;
+		if(i < verifier->pendingCount)
+		{
+			if(verifier->pending[i].offset <= start)
+			{
+				start = verifier->pending[i].offset + verifier->pending[i].length;
+				continue;
+			}
+			if(verifier->pending[i].offset < pieceEnd)
+				pieceEnd = verifier->pending[i].offset;
+		}
+
+		BSCRC_AddSegment(verifier, start, &data[start - offset], pieceEnd - start);
+		start = pieceEnd;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Get the verification result
+  * @param	verifier: pointer to the verifier
+  * @retval	BSTREAM_OK when verified, BSTREAM_CRCERROR on mismatch, or
+  * 		BSTREAM_NOTENOUGHDATA if the stream has not been fully hashed
+  */
+BSTREAM_Enum BSCRC_GetResult(BSCRC_Verifier_td *verifier)
+{
+	if(verifier->offset < verifier->length)
+		return BSTREAM_NOTENOUGHDATA;
+	if(verifier->crc != verifier->expected)
+		return BSTREAM_CRCERROR;
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Add data that does not overlap any held data
+  * @param	verifier: pointer to the verifier
+  * @param	offset: stream offset of the data
+  * @param	data: pointer to the data
+  * @param	length: amount of data
+  * @retval	None
+  */
+static void BSCRC_AddSegment(BSCRC_Verifier_td *verifier, uint32_t offset, uint8_t *data, uint32_t length)
+{
+	//Contiguous with the verified data
+	if(offset == verifier->offset)
+	{
+		verifier->crc = crc32_calculateData(verifier->crc, data, 0, length);
+		verifier->offset += length;
+
+		//Fold in pending segments that are now contiguous
+		while((verifier->pendingCount > 0) && (verifier->pending[0].offset == verifier->offset))
+		{
+			verifier->crc = crc32_combine(verifier->crc, verifier->pending[0].crc, verifier->pending[0].length);
+			verifier->offset += verifier->pending[0].length;
+			BSCRC_RemovePending(verifier, 0);
+		}
+		return;
+	}
+
+	//Find insertion point
+	uint8_t idx = 0;
+	while((idx < verifier->pendingCount) && (verifier->pending[idx].offset < offset))
+		idx++;
+
+	BSCRC_Segment_td *prev = (idx > 0) ? &verifier->pending[idx - 1] : NULL;
+	BSCRC_Segment_td *next = (idx < verifier->pendingCount) ? &verifier->pending[idx] : NULL;
+
+	//Extend the previous segment
+	if((prev != NULL) && ((prev->offset + prev->length) == offset))
+	{
+		prev->crc = crc32_calculateData(prev->crc, data, 0, length);
+		prev->length += length;
+		if((next != NULL) && ((prev->offset + prev->length) == next->offset))
+		{
+			prev->crc = crc32_combine(prev->crc, next->crc, next->length);
+			prev->length += next->length;
+			BSCRC_RemovePending(verifier, idx);
+		}
+		return;
+	}
+
+	//Prepend to the next segment
+	uint32_t crc = crc32_calculateData(0, data, 0, length);
+	if((next != NULL) && ((offset + length) == next->offset))
+	{
+		next->crc = crc32_combine(crc, next->crc, next->length);
+		next->offset = offset;
+		next->length += length;
+		return;
+	}
+
+	//New segment
+	if(verifier->pendingCount >= BSCRC_PENDINGCOUNT)
+		return;
+	memmove(&verifier->pending[idx + 1], &verifier->pending[idx], (verifier->pendingCount - idx) * sizeof(BSCRC_Segment_td));
+	verifier->pending[idx].offset = offset;
+	verifier->pending[idx].length = length;
+	verifier->pending[idx].crc = crc;
+	verifier->pendingCount++;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Remove a pending segment
+  * @param	verifier: pointer to the verifier
+  * @param	idx: index of the segment to remove
+  * @retval	None
+  */
+static void BSCRC_RemovePending(BSCRC_Verifier_td *verifier, uint8_t idx)
+{
+	verifier->pendingCount--;
+	memmove(&verifier->pending[idx], &verifier->pending[idx + 1], (verifier->pendingCount - idx) * sizeof(BSCRC_Segment_td));
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Start verifying the data read from a stream
+  * @param	reader: pointer to the verifying reader
+  * @param	source: pointer to the stream to verify
+  * @retval	BSTREAM_Enum
+  */
+BSTREAM_Enum BSCRC_Start(BSCRC_Reader_td *reader, BSTREAM_Reader_td *source)
+{
+	//Initialize stream interface
+	reader->stream.length = source->length;
+	reader->stream.crc = source->crc;
+	reader->stream.open = BSCRC_StreamOpen;
+	reader->stream.count = BSCRC_StreamCount;
+	reader->stream.readData = BSCRC_StreamRead;
+	reader->stream.close = BSCRC_StreamClose;
+
+	reader->source = source;
+	BSCRC_Init(&reader->verifier, source->length, source->crc);
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Open stream
+  * @param	stream: pointer to the stream
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSCRC_StreamOpen(struct BSTREAM_Reader_td *stream)
+{
+	BSCRC_Reader_td *reader = (BSCRC_Reader_td*)stream;
+	return reader->source->open(reader->source);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Count of data available from offset
+  * @param	stream: pointer to the stream
+  * @param	offset: offset from which to count the available data
+  * @param[out]	count: amount of available data
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSCRC_StreamCount(struct BSTREAM_Reader_td *stream, uint32_t offset, uint32_t *count)
+{
+	BSCRC_Reader_td *reader = (BSCRC_Reader_td*)stream;
+	if(BSCRC_GetResult(&reader->verifier) == BSTREAM_CRCERROR)
+		return BSTREAM_CRCERROR;
+
+	return reader->source->count(reader->source, offset, count);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Read data from stream
+  * @param	stream: pointer to the stream
+  * @param	offset: offset from which to read data
+  * @param	data: pointer to the array into which to read the data
+  * @param	length: amount of data to read from the array
+  * @param	actualLength: actual amount of data read. If null data will only
+  * 		be read if "length" bytes are available
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSCRC_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t offset, uint8_t *data, uint32_t length, uint32_t *actualLength)
+{
+	BSCRC_Reader_td *reader = (BSCRC_Reader_td*)stream;
+	if(BSCRC_GetResult(&reader->verifier) == BSTREAM_CRCERROR)
+		return BSTREAM_CRCERROR;
+
+	BSTREAM_Enum result = reader->source->readData(reader->source, offset, data, length, actualLength);
+	if(result != BSTREAM_OK)
+		return result;
+
+	BSCRC_Update(&reader->verifier, offset, data, (actualLength != NULL) ? *actualLength : length);
+	if(BSCRC_GetResult(&reader->verifier) == BSTREAM_CRCERROR)
+		return BSTREAM_CRCERROR;
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	close the stream
+  * @param	stream: pointer to the stream
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSCRC_StreamClose(struct BSTREAM_Reader_td *stream)
+{
+	BSCRC_Reader_td *reader = (BSCRC_Reader_td*)stream;
+	BSTREAM_Enum result = reader->source->close(reader->source);
+	if(BSCRC_GetResult(&reader->verifier) != BSTREAM_OK)
+		return BSTREAM_CRCERROR;
+	return result;
+}
@@ -0,0 +1,55 @@
+/**
+  ******************************************************************************
+  * @file     	bStreamCRC.h
+  * @author		beede
+  * @version	1V0
+  * @date		Jul 29, 2024
+  * @brief		Incremental whole stream CRC verification
+  */
+
+
+#ifndef INC_BSTREAMCRC_H_
+#define INC_BSTREAMCRC_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "bStream.h"
+
+/* Exported defines ----------------------------------------------------------*/
+#define BSCRC_PENDINGCOUNT					20			//Out of order segments that can be held awaiting the gap before them. At least USR_REQUESTCOUNT * (USR_REQUESTRANGES + 1). Further segments are dropped and must be delivered again to verify
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	uint32_t offset;
+	uint32_t length;
+	uint32_t crc;						//CRC32 of this segment alone
+}BSCRC_Segment_td;
+
+typedef struct
+{
+	uint32_t length;					//Length of the stream
+	uint32_t expected;					//Expected CRC32 of the stream
+
+	uint32_t crc;						//CRC32 of the data from 0 to offset
+	uint32_t offset;					//End of the contiguous verified data
+
+	BSCRC_Segment_td pending[BSCRC_PENDINGCOUNT];	//Data received ahead of offset. Sorted and disjoint
+	uint8_t pendingCount;
+}BSCRC_Verifier_td;
+
+typedef struct
+{
+	BSTREAM_Reader_td stream;			//Stream interface
+	BSTREAM_Reader_td *source;			//Stream being verified
+	BSCRC_Verifier_td verifier;
+}BSCRC_Reader_td;
+
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+void BSCRC_Init(BSCRC_Verifier_td *verifier, uint32_t length, uint32_t crc);
+void BSCRC_Update(BSCRC_Verifier_td *verifier, uint32_t offset, uint8_t *data, uint32_t length);
+BSTREAM_Enum BSCRC_GetResult(BSCRC_Verifier_td *verifier);
+
+BSTREAM_Enum BSCRC_Start(BSCRC_Reader_td *reader, BSTREAM_Reader_td *source);
+
+#endif /* INC_BSTREAMCRC_H_ */
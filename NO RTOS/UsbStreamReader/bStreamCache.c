@@ -0,0 +1,414 @@
+/**
+  ******************************************************************************
+  * @file     	bStreamCache.c
+  * @author		beede
+  * @version	1V0
+  * @date		Jul 28, 2024
+  * @brief		Block cache wrapper for seekable BSTREAM_Reader_td sources
+  */
+/*
+ * INFORMATION
+ *
+ * 	o The stream is split into BSCACHE_BLOCKSIZE blocks aligned to the block
+ * 	  size. Blocks are only cached once the source can supply the whole block
+ * 	o Replacement uses the CLOCK algorithm. A block is marked referenced on
+ * 	  every hit and the hand skips (and clears) referenced blocks once
+ * 	o When the source cannot yet fill a missed block the available data is
+ * 	  read straight through from the source without caching it (bypass)
+ * 	o Blocks are found through a hash of the block number, bucket count equal
+ * 	  to the block count. Bucket heads are held in the blocks themselves so
+ * 	  BSCACHE_BLOCKSFORBUDGET still covers the whole cache memory. A lookup
+ * 	  costs the same whatever the memory budget
+ * 	o The source is only accessed from the client offset onwards. A missed
+ * 	  block entered part way through is bypassed rather than loaded from its
+ * 	  start, as a forward only source (USR) would rewind to supply it
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "bStreamCache.h"
+#include "string.h"
+#include "stddef.h"
+
+/* Private define ------------------------------------------------------------*/
+#define BSCACHE_BLOCKOFFSET(OFFSET)			((OFFSET) & ~(BSCACHE_BLOCKSIZE - 1))
+#define BSCACHE_NOBLOCK						0xffff		//End of a hash bucket
+
+/* Private typedef -----------------------------------------------------------*/
+//FLAGS
+enum BSCACHE_FLAGs
+{
+	BSCACHE_FLAG_STARTED = 0x01,
+	BSCACHE_FLAG_CLOSED = 0x02,
+};
+
+//BLOCK FLAGS
+enum BSCACHE_BLOCKFLAGs
+{
+	BSCACHE_BLOCKFLAG_VALID = 0x01,
+	BSCACHE_BLOCKFLAG_REFERENCED = 0x02,
+};
+
+/* Private variables ---------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+static uint16_t* BSCACHE_GetBucket(BSCACHE_Reader_td *reader, uint32_t blockOffset);
+static BSCACHE_Block_td* BSCACHE_FindBlock(BSCACHE_Reader_td *reader, uint32_t blockOffset);
+static void BSCACHE_UnlinkBlock(BSCACHE_Reader_td *reader, BSCACHE_Block_td *block);
+static BSCACHE_Block_td* BSCACHE_GetVictim(BSCACHE_Reader_td *reader);
+static BSCACHE_Block_td* BSCACHE_LoadBlock(BSCACHE_Reader_td *reader, uint32_t blockOffset, uint32_t offset, BSTREAM_Enum *result);
+static BSTREAM_Enum BSCACHE_CountAvailable(BSCACHE_Reader_td *reader, uint32_t offset, uint32_t limit, uint32_t *count);
+
+static BSTREAM_Enum BSCACHE_StreamOpen(struct BSTREAM_Reader_td *stream);
+static BSTREAM_Enum BSCACHE_StreamCount(struct BSTREAM_Reader_td *stream, uint32_t offset, uint32_t *count);
+static BSTREAM_Enum BSCACHE_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t offset, uint8_t *data, uint32_t length, uint32_t *actualLength);
+static BSTREAM_Enum BSCACHE_StreamClose(struct BSTREAM_Reader_td *stream);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief	Start caching a stream
+  * @param	reader: pointer to the caching reader
+  * @param	source: pointer to the stream to cache
+  * @param	blocks: pointer to the cache memory
+  * @param	blockCount: number of blocks in the cache memory, less than 0xffff.
+  * 		See BSCACHE_BLOCKSFORBUDGET
+  * @retval	BSTREAM_Enum
+  */
+BSTREAM_Enum BSCACHE_Start(BSCACHE_Reader_td *reader, BSTREAM_Reader_td *source, BSCACHE_Block_td *blocks, uint16_t blockCount)
+{
+	if((reader->flags & BSCACHE_FLAG_STARTED) && !(reader->flags & BSCACHE_FLAG_CLOSED))
+		return BSTREAM_BUSY;
+	if((blocks == NULL) || (blockCount == 0) || (blockCount == BSCACHE_NOBLOCK))
+		return BSTREAM_NOTENOUGHSPACE;
+
+	//Initialize stream interface
+	reader->stream.length = source->length;
+	reader->stream.crc = source->crc;
+	reader->stream.open = BSCACHE_StreamOpen;
+	reader->stream.count = BSCACHE_StreamCount;
+	reader->stream.readData = BSCACHE_StreamRead;
+	reader->stream.close = BSCACHE_StreamClose;
+
+	reader->source = source;
+	reader->blocks = blocks;
+	reader->blockCount = blockCount;
+	reader->flags = BSCACHE_FLAG_STARTED;
+
+	BSCACHE_Invalidate(reader);
+	BSCACHE_ResetStats(reader);
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Drop all cached blocks
+  * @param	reader: pointer to the caching reader
+  * @retval	None
+  */
+void BSCACHE_Invalidate(BSCACHE_Reader_td *reader)
+{
+	for(uint16_t i = 0; i < reader->blockCount; i++)
+	{
+		reader->blocks[i].flags = 0;
+		reader->blocks[i].hashHead = BSCACHE_NOBLOCK;
+	}
+	reader->clockHand = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Get the cache statistics
+  * @param	reader: pointer to the caching reader
+  * @param[out]	stats: pointer to the returned statistics
+  * @retval	None
+  */
+void BSCACHE_GetStats(BSCACHE_Reader_td *reader, BSCACHE_Stats_td *stats)
+{
+	*stats = reader->stats;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Reset the cache statistics
+  * @param	reader: pointer to the caching reader
+  * @retval	None
+  */
+void BSCACHE_ResetStats(BSCACHE_Reader_td *reader)
+{
+	memset(&reader->stats, 0, sizeof(reader->stats));
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Get the hash bucket of a block offset
+  * @param	reader: pointer to the caching reader
+  * @param	blockOffset: block aligned stream offset
+  * @retval	Pointer to the index of the first block in the bucket
+  */
+static uint16_t* BSCACHE_GetBucket(BSCACHE_Reader_td *reader, uint32_t blockOffset)
+{
+	return &reader->blocks[(blockOffset / BSCACHE_BLOCKSIZE) % reader->blockCount].hashHead;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Find a cached block
+  * @param	reader: pointer to the caching reader
+  * @param	blockOffset: block aligned stream offset
+  * @retval	Pointer to the block or NULL if not cached
+  */
+static BSCACHE_Block_td* BSCACHE_FindBlock(BSCACHE_Reader_td *reader, uint32_t blockOffset)
+{
+	uint16_t index = *BSCACHE_GetBucket(reader, blockOffset);
+	while(index != BSCACHE_NOBLOCK)
+	{
+		BSCACHE_Block_td *block = &reader->blocks[index];
+		if(block->offset == blockOffset)
+			return block;
+		index = block->hashNext;
+	}
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Remove a valid block from its hash bucket
+  * @param	reader: pointer to the caching reader
+  * @param	block: pointer to the block
+  * @retval	None
+  */
+static void BSCACHE_UnlinkBlock(BSCACHE_Reader_td *reader, BSCACHE_Block_td *block)
+{
+	uint16_t *link = BSCACHE_GetBucket(reader, block->offset);
+	while(*link != BSCACHE_NOBLOCK)
+	{
+		if(&reader->blocks[*link] == block)
+		{
+			*link = block->hashNext;
+			return;
+		}
+		link = &reader->blocks[*link].hashNext;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Select the block to replace using the CLOCK algorithm
+  * @param	reader: pointer to the caching reader
+  * @retval	Pointer to the block to replace
+  */
+static BSCACHE_Block_td* BSCACHE_GetVictim(BSCACHE_Reader_td *reader)
+{
+	while(1)
+	{
+		BSCACHE_Block_td *block = &reader->blocks[reader->clockHand];
+		reader->clockHand++;
+		if(reader->clockHand >= reader->blockCount)
+			reader->clockHand = 0;
+
+		if(block->flags & BSCACHE_BLOCKFLAG_REFERENCED)
+		{
+			block->flags &= ~BSCACHE_BLOCKFLAG_REFERENCED;
+			continue;
+		}
+		if(block->flags & BSCACHE_BLOCKFLAG_VALID)
+		{
+			reader->stats.evictions++;
+			BSCACHE_UnlinkBlock(reader, block);
+		}
+		return block;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Load a block from the source
+  * @param	reader: pointer to the caching reader
+  * @param	blockOffset: block aligned stream offset
+  * @param	offset: stream offset the client is reading from
+  * @param[out]	result: result of the source access
+  * @retval	Pointer to the loaded block or NULL if the source cannot fill it yet
+  */
+static BSCACHE_Block_td* BSCACHE_LoadBlock(BSCACHE_Reader_td *reader, uint32_t blockOffset, uint32_t offset, BSTREAM_Enum *result)
+{
+	//Never access the source behind the client, a forward only source would rewind for it
+	*result = BSTREAM_OK;
+	if(blockOffset < offset)
+		return NULL;
+
+	uint32_t length = reader->stream.length - blockOffset;
+	if(length > BSCACHE_BLOCKSIZE)
+		length = BSCACHE_BLOCKSIZE;
+
+	uint32_t available = 0;
+	*result = reader->source->count(reader->source, blockOffset, &available);
+	if((*result != BSTREAM_OK) || (available < length))
+		return NULL;
+
+	BSCACHE_Block_td *block = BSCACHE_GetVictim(reader);
+	block->flags = 0;
+	*result = reader->source->readData(reader->source, blockOffset, block->data, length, NULL);
+	if(*result != BSTREAM_OK)
+		return NULL;
+
+	uint16_t *bucket = BSCACHE_GetBucket(reader, blockOffset);
+	block->offset = blockOffset;
+	block->length = length;
+	block->hashNext = *bucket;
+	block->flags = BSCACHE_BLOCKFLAG_VALID;
+	*bucket = (uint16_t)(block - reader->blocks);
+	return block;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Count of data available from offset, cached or from the source
+  * @param	reader: pointer to the caching reader
+  * @param	offset: offset from which to count the available data
+  * @param	limit: amount of data after which to stop counting cached blocks
+  * @param[out]	count: amount of available data
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSCACHE_CountAvailable(BSCACHE_Reader_td *reader, uint32_t offset, uint32_t limit, uint32_t *count)
+{
+	//Count cached blocks
+	uint32_t available = 0;
+	BSCACHE_Block_td *block;
+	while(((offset + available) < reader->stream.length) && (available < limit))
+	{
+		block = BSCACHE_FindBlock(reader, BSCACHE_BLOCKOFFSET(offset + available));
+		if(block == NULL)
+			break;
+		available += block->length - ((offset + available) - block->offset);
+	}
+
+	//Add what the source has from the first uncached offset
+	uint32_t sourceAvailable = 0;
+	if(((offset + available) < reader->stream.length) && (available < limit))
+	{
+		BSTREAM_Enum result = reader->source->count(reader->source, offset + available, &sourceAvailable);
+		if(result != BSTREAM_OK)
+			return result;
+	}
+
+	*count = available + sourceAvailable;
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Open stream
+  * @param	stream: pointer to the stream
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSCACHE_StreamOpen(struct BSTREAM_Reader_td *stream)
+{
+	BSCACHE_Reader_td *reader = (BSCACHE_Reader_td*)stream;
+	if(reader->flags & BSCACHE_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	return reader->source->open(reader->source);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Count of data available from offset
+  * @param	stream: pointer to the stream
+  * @param	offset: offset from which to count the available data
+  * @param[out]	count: amount of available data
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSCACHE_StreamCount(struct BSTREAM_Reader_td *stream, uint32_t offset, uint32_t *count)
+{
+	BSCACHE_Reader_td *reader = (BSCACHE_Reader_td*)stream;
+	if(reader->flags & BSCACHE_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	return BSCACHE_CountAvailable(reader, offset, reader->stream.length, count);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Read data from stream
+  * @param	stream: pointer to the stream
+  * @param	offset: offset from which to read data
+  * @param	data: pointer to the array into which to read the data
+  * @param	length: amount of data to read from the array
+  * @param	actualLength: actual amount of data read. If null data will only
+  * 		be read if "length" bytes are available
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSCACHE_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t offset, uint8_t *data, uint32_t length, uint32_t *actualLength)
+{
+	BSCACHE_Reader_td *reader = (BSCACHE_Reader_td*)stream;
+	if(reader->flags & BSCACHE_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	if(actualLength == NULL)
+	{
+		uint32_t available;
+		BSTREAM_Enum result = BSCACHE_CountAvailable(reader, offset, length, &available);
+		if(result != BSTREAM_OK)
+			return result;
+		if(available < length)
+			return BSTREAM_NOTENOUGHDATA;
+	}
+
+	uint32_t localOffset = 0;
+	while((localOffset < length) && ((offset + localOffset) < reader->stream.length))
+	{
+		uint32_t blockOffset = BSCACHE_BLOCKOFFSET(offset + localOffset);
+		BSCACHE_Block_td *block = BSCACHE_FindBlock(reader, blockOffset);
+		if(block != NULL)
+		{
+			reader->stats.hits++;
+			block->flags |= BSCACHE_BLOCKFLAG_REFERENCED;
+		}
+		else
+		{
+			reader->stats.misses++;
+			BSTREAM_Enum result;
+			block = BSCACHE_LoadBlock(reader, blockOffset, offset + localOffset, &result);
+			if(result != BSTREAM_OK)
+				return result;
+		}
+
+		//Read straight from the source if the block cannot be cached yet
+		if(block == NULL)
+		{
+			reader->stats.bypasses++;
+			uint32_t actual = 0;
+			BSTREAM_Enum result = reader->source->readData(reader->source, offset + localOffset, &data[localOffset], length - localOffset, &actual);
+			if(result != BSTREAM_OK)
+				return result;
+			localOffset += actual;
+			break;
+		}
+
+		uint32_t chunkOffset = (offset + localOffset) - block->offset;
+		uint32_t chunkLength = block->length - chunkOffset;
+		if(chunkLength > (length - localOffset))
+			chunkLength = (length - localOffset);
+		memcpy(&data[localOffset], &block->data[chunkOffset], chunkLength);
+		localOffset += chunkLength;
+	}
+
+	if(actualLength != NULL)
+		*actualLength = localOffset;
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	close the stream
+  * @param	stream: pointer to the stream
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSCACHE_StreamClose(struct BSTREAM_Reader_td *stream)
+{
+	BSCACHE_Reader_td *reader = (BSCACHE_Reader_td*)stream;
+	if(reader->flags & BSCACHE_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	reader->flags |= BSCACHE_FLAG_CLOSED;
+	return reader->source->close(reader->source);
+}
@@ -0,0 +1,63 @@
+/**
+  ******************************************************************************
+  * @file     	bStreamCache.h
+  * @author		beede
+  * @version	1V0
+  * @date		Jul 28, 2024
+  * @brief		Block cache wrapper for seekable BSTREAM_Reader_td sources
+  */
+
+
+#ifndef INC_BSTREAMCACHE_H_
+#define INC_BSTREAMCACHE_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "bStream.h"
+
+/* Exported defines ----------------------------------------------------------*/
+#define BSCACHE_BLOCKSIZE					256			//Must be a power of 2
+
+//Number of blocks that fit within a memory budget
+#define BSCACHE_BLOCKSFORBUDGET(BYTES)		((BYTES) / sizeof(BSCACHE_Block_td))
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	uint32_t offset;					//Stream offset of the block
+	uint8_t data[BSCACHE_BLOCKSIZE];
+	uint16_t length;					//Amount of valid data. Less than the block size at the stream end
+	uint16_t hashHead;					//First block of the hash bucket with this block's index
+	uint16_t hashNext;					//Next block in this block's hash bucket
+	uint8_t flags;						//@ref BSCACHE_BLOCKFLAGs
+}BSCACHE_Block_td;
+
+typedef struct
+{
+	uint32_t hits;						//Block accesses served from the cache
+	uint32_t misses;					//Block accesses requiring the source
+	uint32_t evictions;					//Valid blocks replaced
+	uint32_t bypasses;					//Misses served directly as the source could not fill a block
+}BSCACHE_Stats_td;
+
+typedef struct BSCACHE_Reader_td
+{
+	BSTREAM_Reader_td stream;			//Stream interface
+	BSTREAM_Reader_td *source;			//Stream being cached
+
+	BSCACHE_Block_td *blocks;			//Cache memory
+	uint16_t blockCount;				//Number of blocks in the cache memory
+	uint16_t clockHand;					//Next replacement candidate
+
+	BSCACHE_Stats_td stats;
+
+	uint8_t flags;						//@ref BSCACHE_FLAGs
+}BSCACHE_Reader_td;
+
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+BSTREAM_Enum BSCACHE_Start(BSCACHE_Reader_td *reader, BSTREAM_Reader_td *source, BSCACHE_Block_td *blocks, uint16_t blockCount);
+void BSCACHE_Invalidate(BSCACHE_Reader_td *reader);
+void BSCACHE_GetStats(BSCACHE_Reader_td *reader, BSCACHE_Stats_td *stats);
+void BSCACHE_ResetStats(BSCACHE_Reader_td *reader);
+
+#endif /* INC_BSTREAMCACHE_H_ */
@@ -0,0 +1,339 @@
+/**
+  ******************************************************************************
+  * @file     	bStreamMem.c
+  * @author		beede
+  * @version	1V0
+  * @date		Jul 30, 2024
+  * @brief		RAM and memory mapped file BSTREAM sources
+  */
+/*
+ * INFORMATION
+ *
+ * 	o Serves a stream straight from memory. readData copies from the RAM
+ * 	  buffer or file mapping directly into the client buffer, nothing is
+ * 	  staged in between
+ * 	o The file source is only built for the Linux host build and maps the
+ * 	  whole file read only. The stream CRC is calculated on start
+ * 	o Throttling mimics the USB stream reader so clients can be profiled off
+ * 	  target:
+ * 		o A count/read outside the available data is a new request. Data
+ * 		  starts arriving "latency" milliseconds later
+ * 		o Data then arrives at "rate" bytes per millisecond
+ * 		o No more than "window" bytes are held ahead of the client offset,
+ * 		  like the USB reader buffers. Data behind the client is released
+ * 	o BSMEM_millisecondTick provides the time base, so it can be driven
+ * 	  from virtual time
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "bStreamMem.h"
+#include "utils.h"
+#include "string.h"
+#if defined(__linux__)
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#endif
+
+/* Private define ------------------------------------------------------------*/
+/* Private typedef -----------------------------------------------------------*/
+//FLAGS
+enum BSMEM_FLAGs
+{
+	BSMEM_FLAG_STARTED = 0x01,
+	BSMEM_FLAG_OPENED = 0x02,
+	BSMEM_FLAG_CLOSED = 0x04,
+	BSMEM_FLAG_REQUESTED = 0x08,
+};
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t bsmemTick;
+
+/* Private function prototypes -----------------------------------------------*/
+static void BSMEM_Start(BSMEM_Reader_td *reader, uint32_t length, uint32_t crc);
+static void BSMEM_UpdateAvailable(BSMEM_Reader_td *reader, uint32_t offset);
+
+static BSTREAM_Enum BSMEM_StreamOpen(struct BSTREAM_Reader_td *stream);
+static BSTREAM_Enum BSMEM_StreamCount(struct BSTREAM_Reader_td *stream, uint32_t offset, uint32_t *count);
+static BSTREAM_Enum BSMEM_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t offset, uint8_t *data, uint32_t length, uint32_t *actualLength);
+static BSTREAM_Enum BSMEM_StreamClose(struct BSTREAM_Reader_td *stream);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief	Time base for throttled streams
+  * @param	None
+  * @retval	None
+  */
+void BSMEM_millisecondTick(void)
+{
+	bsmemTick++;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Start a stream from a RAM buffer
+  * @param	reader: pointer to the reader
+  * @param	data: pointer to the stream data. Must remain valid until released
+  * @param	length: length of the stream data
+  * @param	crc: CRC32 of the stream data
+  * @retval	BSTREAM_Enum
+  */
+BSTREAM_Enum BSMEM_StartRAM(BSMEM_Reader_td *reader, uint8_t *data, uint32_t length, uint32_t crc)
+{
+	if((reader->flags & BSMEM_FLAG_STARTED) && !(reader->flags & BSMEM_FLAG_CLOSED))
+		return BSTREAM_BUSY;
+
+	reader->data = data;
+	reader->fd = -1;
+	reader->mapLength = 0;
+	BSMEM_Start(reader, length, crc);
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Start a stream from a memory mapped file
+  * @param	reader: pointer to the reader
+  * @param	path: path of the file
+  * @retval	BSTREAM_Enum
+  */
+BSTREAM_Enum BSMEM_StartFile(BSMEM_Reader_td *reader, const char *path)
+{
+#if defined(__linux__)
+	if((reader->flags & BSMEM_FLAG_STARTED) && !(reader->flags & BSMEM_FLAG_CLOSED))
+		return BSTREAM_BUSY;
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return BSTREAM_CLOSED;
+
+	struct stat st;
+	if((fstat(fd, &st) != 0) || (st.st_size > 0xffffffff))
+	{
+		close(fd);
+		return BSTREAM_CLOSED;
+	}
+
+	uint8_t *data = NULL;
+	if(st.st_size > 0)
+	{
+		data = (uint8_t*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED)
+		{
+			close(fd);
+			return BSTREAM_CLOSED;
+		}
+		madvise(data, st.st_size, MADV_SEQUENTIAL);
+	}
+
+	reader->data = data;
+	reader->fd = fd;
+	reader->mapLength = st.st_size;
+	BSMEM_Start(reader, st.st_size, crc32_calculateData(0, data, 0, st.st_size));
+	return BSTREAM_OK;
+#else
+	return BSTREAM_CLOSED;
+#endif
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Configure throttling of the stream data. Call after starting
+  * @param	reader: pointer to the reader
+  * @param	latency: milliseconds from a request at a new offset until data arrives
+  * @param	rate: bytes made available per millisecond. 0 for unlimited
+  * @param	window: maximum data available ahead of the client offset. 0 for unlimited
+  * @retval	None
+  */
+void BSMEM_SetThrottle(BSMEM_Reader_td *reader, uint32_t latency, uint32_t rate, uint32_t window)
+{
+	reader->latency = latency;
+	reader->rate = rate;
+	reader->window = window;
+	reader->flags &= ~BSMEM_FLAG_REQUESTED;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Release the stream memory. Unmaps file streams
+  * @param	reader: pointer to the reader
+  * @retval	None
+  */
+void BSMEM_Release(BSMEM_Reader_td *reader)
+{
+#if defined(__linux__)
+	if(reader->mapLength > 0)
+		munmap(reader->data, reader->mapLength);
+	if(reader->fd >= 0)
+		close(reader->fd);
+#endif
+	reader->data = NULL;
+	reader->fd = -1;
+	reader->mapLength = 0;
+	reader->flags |= BSMEM_FLAG_CLOSED;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Initialize the stream interface and runtime variables
+  * @param	reader: pointer to the reader
+  * @param	length: length of the stream data
+  * @param	crc: CRC32 of the stream data
+  * @retval	None
+  */
+static void BSMEM_Start(BSMEM_Reader_td *reader, uint32_t length, uint32_t crc)
+{
+	//Initialize stream interface
+	reader->stream.length = length;
+	reader->stream.crc = crc;
+	reader->stream.open = BSMEM_StreamOpen;
+	reader->stream.count = BSMEM_StreamCount;
+	reader->stream.readData = BSMEM_StreamRead;
+	reader->stream.close = BSMEM_StreamClose;
+
+	//No throttling until configured
+	reader->latency = 0;
+	reader->rate = 0;
+	reader->window = 0;
+
+	//Runtime Variables
+	reader->availableOffset = 0;
+	reader->availableEnd = 0;
+	reader->lastTick = bsmemTick;
+	reader->flags = BSMEM_FLAG_STARTED;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Update the available data for a client access
+  * @param	reader: pointer to the reader
+  * @param	offset: offset of the client access
+  * @retval	None
+  */
+static void BSMEM_UpdateAvailable(BSMEM_Reader_td *reader, uint32_t offset)
+{
+	uint32_t length = reader->stream.length;
+	if((reader->latency == 0) && (reader->rate == 0) && (reader->window == 0))
+	{
+		reader->availableOffset = 0;
+		reader->availableEnd = length;
+		return;
+	}
+
+	//New request when the client moves outside the available data
+	if(!(reader->flags & BSMEM_FLAG_REQUESTED) || (offset < reader->availableOffset) || (offset > reader->availableEnd))
+	{
+		reader->availableOffset = offset;
+		reader->availableEnd = offset;
+		reader->lastTick = bsmemTick + reader->latency;
+		reader->flags |= BSMEM_FLAG_REQUESTED;
+	}
+
+	//Release data behind the client
+	reader->availableOffset = offset;
+
+	//Data arriving since the last update
+	int32_t elapsed = (int32_t)(bsmemTick - reader->lastTick);
+	if(elapsed >= 0)
+	{
+		if(reader->rate == 0)
+			reader->availableEnd = length;
+		else if(((uint64_t)reader->rate * (uint32_t)elapsed) < (length - reader->availableEnd))
+			reader->availableEnd += reader->rate * (uint32_t)elapsed;
+		else
+			reader->availableEnd = length;
+		reader->lastTick = bsmemTick;
+	}
+
+	//Hold no more than the window
+	if((reader->window != 0) && (reader->availableEnd > offset) && ((reader->availableEnd - offset) > reader->window))
+		reader->availableEnd = offset + reader->window;
+	if(reader->availableEnd > length)
+		reader->availableEnd = length;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Open stream
+  * @param	stream: pointer to the stream
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSMEM_StreamOpen(struct BSTREAM_Reader_td *stream)
+{
+	BSMEM_Reader_td *reader = (BSMEM_Reader_td*)stream;
+	if(reader->flags & BSMEM_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	reader->flags |= BSMEM_FLAG_OPENED;
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Count of data available from offset
+  * @param	stream: pointer to the stream
+  * @param	offset: offset from which to count the available data
+  * @param[out]	count: amount of available data
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSMEM_StreamCount(struct BSTREAM_Reader_td *stream, uint32_t offset, uint32_t *count)
+{
+	BSMEM_Reader_td *reader = (BSMEM_Reader_td*)stream;
+	if(reader->flags & BSMEM_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	BSMEM_UpdateAvailable(reader, offset);
+	*count = (reader->availableEnd > offset) ? (reader->availableEnd - offset) : 0;
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Read data from stream
+  * @param	stream: pointer to the stream
+  * @param	offset: offset from which to read data
+  * @param	data: pointer to the array into which to read the data
+  * @param	length: amount of data to read from the array
+  * @param	actualLength: actual amount of data read. If null data will only
+  * 		be read if "length" bytes are available
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSMEM_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t offset, uint8_t *data, uint32_t length, uint32_t *actualLength)
+{
+	BSMEM_Reader_td *reader = (BSMEM_Reader_td*)stream;
+	if(reader->flags & BSMEM_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	BSMEM_UpdateAvailable(reader, offset);
+
+	//Check for enough data
+	uint32_t available = (reader->availableEnd > offset) ? (reader->availableEnd - offset) : 0;
+	if((available < length) && (actualLength == NULL))
+		return BSTREAM_NOTENOUGHDATA;
+
+	//Read data
+	if(available > length)
+		available = length;
+	memcpy(data, &reader->data[offset], available);
+	if(actualLength != NULL)
+		*actualLength = available;
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	close the stream
+  * @param	stream: pointer to the stream
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSMEM_StreamClose(struct BSTREAM_Reader_td *stream)
+{
+	BSMEM_Reader_td *reader = (BSMEM_Reader_td*)stream;
+	if(reader->flags & BSMEM_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	reader->flags |= BSMEM_FLAG_CLOSED;
+	return BSTREAM_OK;
+}
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file     	bStreamMem.h
+  * @author		beede
+  * @version	1V0
+  * @date		Jul 30, 2024
+  * @brief		RAM and memory mapped file BSTREAM sources
+  */
+
+
+#ifndef INC_BSTREAMMEM_H_
+#define INC_BSTREAMMEM_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "bStream.h"
+#include "stddef.h"
+
+/* Exported defines ----------------------------------------------------------*/
+/* Exported types ------------------------------------------------------------*/
+typedef struct BSMEM_Reader_td
+{
+	BSTREAM_Reader_td stream;			//Stream interface
+	uint8_t *data;						//Stream data
+
+	//THROTTLING (all 0 for the whole stream to be available immediately)
+	uint32_t latency;					//Milliseconds from a request at a new offset until data arrives
+	uint32_t rate;						//Bytes made available per millisecond. 0 for unlimited
+	uint32_t window;					//Maximum data available ahead of the client offset. 0 for unlimited
+
+	//RUNTIME VARIABLES
+	uint32_t availableOffset;			//Start of the available data
+	uint32_t availableEnd;				//End of the available data
+	uint32_t lastTick;					//Tick to which data has been made available
+
+	uint8_t flags;						//@ref BSMEM_FLAGs
+
+	//FILE
+	int fd;
+	size_t mapLength;
+}BSMEM_Reader_td;
+
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+void BSMEM_millisecondTick(void);
+BSTREAM_Enum BSMEM_StartRAM(BSMEM_Reader_td *reader, uint8_t *data, uint32_t length, uint32_t crc);
+BSTREAM_Enum BSMEM_StartFile(BSMEM_Reader_td *reader, const char *path);
+void BSMEM_SetThrottle(BSMEM_Reader_td *reader, uint32_t latency, uint32_t rate, uint32_t window);
+void BSMEM_Release(BSMEM_Reader_td *reader);
+
+#endif /* INC_BSTREAMMEM_H_ */
@@ -0,0 +1,354 @@
+/**
+  ******************************************************************************
+  * @file     	bStreamPrefetch.c
+  * @author		beede
+  * @version	1V0
+  * @date		Jul 27, 2024
+  * @brief		Read-ahead wrapper for any BSTREAM_Reader_td
+  */
+/*
+ * INFORMATION
+ *
+ * 	o The prefetcher sits between a stream client and any stream source (USB,
+ * 	  flash, file) and presents the same BSTREAM_Reader_td interface
+ * 	o Data ahead of the client is copied from the source into a ring window as
+ * 	  soon as the source has it, so the source can release its buffers and
+ * 	  start fetching the next data before the client asks for it
+ * 	o Reads at the offset following the previous read are sequential. Once
+ * 	  BSPF_SEQUENTIALTHRESHOLD sequential reads are seen the full read-ahead is
+ * 	  used, otherwise only BSPF_RANDOMREADAHEAD is fetched
+ * 	o Data behind the client is kept until the window space is required, so
+ * 	  short backwards seeks are served from the window
+ * 	o A read always fetches at least up to its own end, so a read larger than
+ * 	  the read-ahead still completes. An all-or-nothing read larger than the
+ * 	  window can never complete and returns BSTREAM_NOTENOUGHSPACE
+ * 	o BSPF_tick keeps the window topped up between client accesses
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "bStreamPrefetch.h"
+#include "string.h"
+#include "stddef.h"
+
+/* Private define ------------------------------------------------------------*/
+/* Private typedef -----------------------------------------------------------*/
+//FLAGS
+enum BSPF_FLAGs
+{
+	BSPF_FLAG_STARTED = 0x01,
+	BSPF_FLAG_OPENED = 0x02,
+	BSPF_FLAG_CLOSED = 0x04,
+};
+
+/* Private variables ---------------------------------------------------------*/
+static BSPF_Reader_td *bspfBaseReader;
+
+/* Private function prototypes -----------------------------------------------*/
+static void BSPF_StackReader(BSPF_Reader_td *reader);
+static void BSPF_DeStackReader(BSPF_Reader_td *reader);
+static void BSPF_Seek(BSPF_Reader_td *reader, uint32_t offset);
+static BSTREAM_Enum BSPF_Fill(BSPF_Reader_td *reader, uint32_t length);
+
+static BSTREAM_Enum BSPF_StreamOpen(struct BSTREAM_Reader_td *stream);
+static BSTREAM_Enum BSPF_StreamCount(struct BSTREAM_Reader_td *stream, uint32_t offset, uint32_t *count);
+static BSTREAM_Enum BSPF_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t offset, uint8_t *data, uint32_t length, uint32_t *actualLength);
+static BSTREAM_Enum BSPF_StreamClose(struct BSTREAM_Reader_td *stream);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief	Tick the prefetchers, topping up the read-ahead windows
+  * @param	None
+  * @retval	None
+  */
+void BSPF_tick(void)
+{
+	BSPF_Reader_td *reader = bspfBaseReader;
+	while(reader != NULL)
+	{
+		BSPF_Reader_td *next = reader->next;
+		if(reader->flags & BSPF_FLAG_OPENED)
+			BSPF_Fill(reader, 0);
+		reader = next;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Start prefetching a stream
+  * @param	reader: pointer to the prefetching reader
+  * @param	source: pointer to the stream from which to prefetch
+  * @param	window: pointer to the memory to hold the read-ahead data
+  * @param	windowSize: size of the window memory
+  * @param	readAhead: maximum amount of data to fetch ahead of the client
+  * @retval	BSTREAM_Enum
+  */
+BSTREAM_Enum BSPF_Start(BSPF_Reader_td *reader, BSTREAM_Reader_td *source, uint8_t *window, uint32_t windowSize, uint32_t readAhead)
+{
+	if((reader->flags & BSPF_FLAG_STARTED) && !(reader->flags & BSPF_FLAG_CLOSED))
+		return BSTREAM_BUSY;
+	if((window == NULL) || (windowSize == 0))
+		return BSTREAM_NOTENOUGHSPACE;
+
+	//Initialize stream interface
+	reader->stream.length = source->length;
+	reader->stream.crc = source->crc;
+	reader->stream.open = BSPF_StreamOpen;
+	reader->stream.count = BSPF_StreamCount;
+	reader->stream.readData = BSPF_StreamRead;
+	reader->stream.close = BSPF_StreamClose;
+
+	//Configuration
+	reader->source = source;
+	reader->window = window;
+	reader->windowSize = windowSize;
+	reader->readAhead = (readAhead > windowSize) ? windowSize : readAhead;
+
+	//Runtime Variables
+	reader->windowOffset = 0;
+	reader->windowStart = 0;
+	reader->windowCount = 0;
+	reader->clientOffset = 0;
+	reader->expectedOffset = 0;
+	reader->sequentialCount = BSPF_SEQUENTIALTHRESHOLD;	//Streams are usually read from the start
+	reader->flags = BSPF_FLAG_STARTED;
+
+	BSPF_StackReader(reader);
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Stack a reader
+  * @param	reader: pointer to the reader
+  * @retval	None
+  */
+static void BSPF_StackReader(BSPF_Reader_td *reader)
+{
+	BSPF_Reader_td *srch = bspfBaseReader;
+	while((srch != NULL) && (srch != reader))
+		srch = srch->next;
+	if(srch != NULL)	//Already on stack
+		return;
+
+	reader->next = bspfBaseReader;
+	bspfBaseReader = reader;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Remove a reader from the stack
+  * @param	reader: pointer to the reader
+  * @retval	None
+  */
+static void BSPF_DeStackReader(BSPF_Reader_td *reader)
+{
+	BSPF_Reader_td *srch = bspfBaseReader;
+	BSPF_Reader_td *prev = NULL;
+	while((srch != NULL) && (srch != reader))
+	{
+		prev = srch;
+		srch = srch->next;
+	}
+	if(srch == NULL)	//Not on stack
+		return;
+
+	if(prev == NULL)
+		bspfBaseReader = srch->next;
+	else
+		prev->next = srch->next;
+	srch->next = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Move the client to an offset, dropping the window if the offset is
+  * 		not reachable from it
+  * @param	reader: pointer to the reader
+  * @param	offset: offset of the client access
+  * @retval	None
+  */
+static void BSPF_Seek(BSPF_Reader_td *reader, uint32_t offset)
+{
+	reader->clientOffset = offset;
+
+	uint32_t windowEnd = reader->windowOffset + reader->windowCount;
+	if((offset >= reader->windowOffset) && (offset <= windowEnd))
+		return;
+
+	reader->windowOffset = offset;
+	reader->windowStart = 0;
+	reader->windowCount = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Fetch data from the source into the window ahead of the client
+  * @param	reader: pointer to the reader
+  * @param	length: length of the client access, fetched even if beyond the
+  * 		read-ahead. 0 if there is no access
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSPF_Fill(BSPF_Reader_td *reader, uint32_t length)
+{
+	//Get the amount of data to have ahead of the client
+	uint32_t readAhead = reader->readAhead;
+	if((reader->sequentialCount < BSPF_SEQUENTIALTHRESHOLD) && (readAhead > BSPF_RANDOMREADAHEAD))
+		readAhead = BSPF_RANDOMREADAHEAD;
+	if(readAhead < length)
+		readAhead = (length > reader->windowSize) ? reader->windowSize : length;
+	uint32_t target = reader->clientOffset + readAhead;
+	if(target > reader->stream.length)
+		target = reader->stream.length;
+
+	uint32_t windowEnd = reader->windowOffset + reader->windowCount;
+	if(target <= windowEnd)
+		return BSTREAM_OK;
+
+	//Release data behind the client if the space is required
+	if((target - reader->windowOffset) > reader->windowSize)
+	{
+		uint32_t release = (target - reader->windowOffset) - reader->windowSize;
+		if(release > (reader->clientOffset - reader->windowOffset))
+			release = (reader->clientOffset - reader->windowOffset);
+		reader->windowOffset += release;
+		reader->windowStart = (reader->windowStart + release) % reader->windowSize;
+		reader->windowCount -= release;
+	}
+
+	//Fetch into the free ring space
+	while((windowEnd < target) && (reader->windowCount < reader->windowSize))
+	{
+		uint32_t idx = (reader->windowStart + reader->windowCount) % reader->windowSize;
+		uint32_t length = target - windowEnd;
+		if(length > (reader->windowSize - reader->windowCount))
+			length = (reader->windowSize - reader->windowCount);
+		if(length > (reader->windowSize - idx))
+			length = (reader->windowSize - idx);
+
+		uint32_t actual = 0;
+		BSTREAM_Enum result = reader->source->readData(reader->source, windowEnd, &reader->window[idx], length, &actual);
+		if(result != BSTREAM_OK)
+			return result;
+		if(actual == 0)
+			break;
+
+		reader->windowCount += actual;
+		windowEnd += actual;
+	}
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Open stream
+  * @param	stream: pointer to the stream
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSPF_StreamOpen(struct BSTREAM_Reader_td *stream)
+{
+	BSPF_Reader_td *reader = (BSPF_Reader_td*)stream;
+	if(reader->flags & BSPF_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	BSTREAM_Enum result = reader->source->open(reader->source);
+	if(result != BSTREAM_OK)
+		return result;
+
+	reader->flags |= BSPF_FLAG_OPENED;
+	return BSPF_Fill(reader, 0);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Count of data available from offset
+  * @param	stream: pointer to the stream
+  * @param	offset: offset from which to count the available data
+  * @param[out]	count: amount of available data
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSPF_StreamCount(struct BSTREAM_Reader_td *stream, uint32_t offset, uint32_t *count)
+{
+	BSPF_Reader_td *reader = (BSPF_Reader_td*)stream;
+	if(reader->flags & BSPF_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	BSPF_Seek(reader, offset);
+	BSTREAM_Enum result = BSPF_Fill(reader, 0);
+	if(result != BSTREAM_OK)
+		return result;
+
+	*count = (reader->windowOffset + reader->windowCount) - offset;
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Read data from stream
+  * @param	stream: pointer to the stream
+  * @param	offset: offset from which to read data
+  * @param	data: pointer to the array into which to read the data
+  * @param	length: amount of data to read from the array
+  * @param	actualLength: actual amount of data read. If null data will only
+  * 		be read if "length" bytes are available
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSPF_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t offset, uint8_t *data, uint32_t length, uint32_t *actualLength)
+{
+	BSPF_Reader_td *reader = (BSPF_Reader_td*)stream;
+	if(reader->flags & BSPF_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+	if((actualLength == NULL) && (length > reader->windowSize))
+		return BSTREAM_NOTENOUGHSPACE;
+
+	//Track the access pattern
+	if(offset == reader->expectedOffset)
+	{
+		if(reader->sequentialCount < 0xff)
+			reader->sequentialCount++;
+	}
+	else
+		reader->sequentialCount = 0;
+
+	BSPF_Seek(reader, offset);
+	BSTREAM_Enum result = BSPF_Fill(reader, length);
+	if(result != BSTREAM_OK)
+		return result;
+
+	//Check for enough data
+	uint32_t available = (reader->windowOffset + reader->windowCount) - offset;
+	if((available < length) && (actualLength == NULL))
+		return BSTREAM_NOTENOUGHDATA;
+
+	//Read data out of the ring
+	if(available > length)
+		available = length;
+	uint32_t idx = (reader->windowStart + (offset - reader->windowOffset)) % reader->windowSize;
+	uint32_t chunk = reader->windowSize - idx;
+	if(chunk > available)
+		chunk = available;
+	memcpy(data, &reader->window[idx], chunk);
+	memcpy(&data[chunk], reader->window, available - chunk);
+
+	reader->expectedOffset = offset + available;
+	if(actualLength != NULL)
+		*actualLength = available;
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	close the stream
+  * @param	stream: pointer to the stream
+  * @retval	BSTREAM_Enum
+  */
+static BSTREAM_Enum BSPF_StreamClose(struct BSTREAM_Reader_td *stream)
+{
+	BSPF_Reader_td *reader = (BSPF_Reader_td*)stream;
+	if(reader->flags & BSPF_FLAG_CLOSED)
+		return BSTREAM_CLOSED;
+
+	reader->flags |= BSPF_FLAG_CLOSED;
+	BSPF_DeStackReader(reader);
+	return reader->source->close(reader->source);
+}
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file     	bStreamPrefetch.h
+  * @author		beede
+  * @version	1V0
+  * @date		Jul 27, 2024
+  * @brief		Read-ahead wrapper for any BSTREAM_Reader_td
+  */
+
+
+#ifndef INC_BSTREAMPREFETCH_H_
+#define INC_BSTREAMPREFETCH_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "bStream.h"
+
+/* Exported defines ----------------------------------------------------------*/
+#define BSPF_SEQUENTIALTHRESHOLD			2			//Sequential reads before the full read-ahead window is used
+#define BSPF_RANDOMREADAHEAD				64			//Read-ahead used while the access pattern is random
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct BSPF_Reader_td
+{
+	BSTREAM_Reader_td stream;			//Stream interface
+	BSTREAM_Reader_td *source;			//Stream being read ahead of
+
+	//CONFIGURATION
+	uint8_t *window;					//Read-ahead memory
+	uint32_t windowSize;				//Size of the read-ahead memory
+	uint32_t readAhead;					//Maximum amount of data to fetch ahead of the client
+
+	//RUNTIME VARIABLES
+	uint32_t windowOffset;				//Stream offset of the oldest byte in the window
+	uint32_t windowStart;				//Index of the oldest byte in the window
+	uint32_t windowCount;				//Amount of data held in the window
+	uint32_t clientOffset;				//Offset of the last client access
+	uint32_t expectedOffset;			//Offset at which the next sequential access will occur
+	uint8_t sequentialCount;			//Number of back to back sequential accesses
+
+	uint8_t flags;						//@ref BSPF_FLAGs
+
+	struct BSPF_Reader_td *next;
+}BSPF_Reader_td;
+
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+void BSPF_tick(void);
+BSTREAM_Enum BSPF_Start(BSPF_Reader_td *reader, BSTREAM_Reader_td *source, uint8_t *window, uint32_t windowSize, uint32_t readAhead);
+
+#endif /* INC_BSTREAMPREFETCH_H_ */
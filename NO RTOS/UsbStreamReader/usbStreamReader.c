@@ -20,27 +20,156 @@
  * 		4-5					Length of this data
  *
  * BUFFER
- * 	Assumption 1: chunks will be in order within the buffer
- *	Assumption 2: chunks will be contiguous
+ * 	o Chunks may arrive in any order within a request. Each request tracks
+ * 	  the data received in order (received) and up to USR_REQUESTRANGES
+ * 	  ranges received beyond the first hole. Each byte is written to the
+ * 	  buffers once, duplicates are ignored
+ * 	o A chunk that would need more ranges is dropped and re-requested
  *
  *	RECEIVER
  *		o Slave to the stream
- *		o While the stream is open, send packet every 1000ms
+ *		o While the stream is open keep it alive, see NOTIFICATIONS
  *		o On stream read/count request, adjust the streamOffset and load data buffers
- *		o On close send EOT to the server
+ *		o streamBuffers are always contiguous. streamEnd is kept as buffers are
+ *		  handed over, so count is a compare and subtract, and a read within
+ *		  one buffer is a single copy. Nothing is released or requested while
+ *		  the client stays within the head buffer or waits at the same offset
+ *		o USR_PeekData gives the client a pointer to the data in the head
+ *		  buffer instead of copying it out. The buffer is recycled once the
+ *		  client moves past it. Buffers start on BCHAIN_SIZE multiples unless
+ *		  the client seeks, so a sequential client is handed whole aligned
+ *		  buffers, e.g. for flash page programming (usrFlashSink.c)
+ *		o On close send EOT to the server. Close returns BSTREAM_CRCERROR unless
+ *		  the whole stream was received and matched its CRC
+ *		o count/readData only return BSTREAM_CRCERROR on a mismatch. A client
+ *		  that seeks forward more than BSCRC_PENDINGCOUNT times leaves the
+ *		  stream unverified, which only close reports
+ *
+ *	REQUESTS
+ *		o availableBuffers are contiguous from the first offset not yet passed to
+ *		  the stream client, and form the receive window
+ *		o Up to flow.depth (max USR_REQUESTCOUNT) requests over disjoint ranges
+ *		  of the window are outstanding at once. Each covers flow.requestBuffers
+ *		  (max USR_REQUESTBUFFERS) buffers and ends on a buffer boundary
+ *		o A new request is sent as soon as a request slot and window space are
+ *		  free, so the host always has requests to serve
+ *		o A request that receives nothing for flow.rto re-requests only its
+ *		  holes, the data not yet received
+ *		o The timeout, depth and length adapt to the measured round trip time
+ *		  and throughput, see usrFlowControl.c
+ *		o Moving the client outside the window realigns the buffers and drops
+ *		  all outstanding requests. Data for dropped requests is ignored
+ *
+ *	TIMERS
+ *		o Keep alive, USB timeout and request timeouts are held as timestamps
+ *		  against a shared millisecond time
+ *		o The stream stack is ordered by the earliest deadline of each stream,
+ *		  so a tick only services the streams that are due. Deadlines moving
+ *		  later (e.g. data received) are left lazily, the stream is serviced
+ *		  early, finds nothing due and is re-ordered
+ *		o USR_GetTimeToDeadline gives the time an idle system may sleep for
+ *
+ *	NOTIFICATIONS
+ *		o Alive and close carry one or more stream IDs:
+ *			BYTES				DESCRIPTION
+ *			0					pktUSRAlive / pktUSRClose
+ *			1-n					Stream IDs (up to USR_NOTIFYMAX)
+ *		o Packets go through the outbound scheduler (bOutbound.c). Data
+ *		  requests are its highest priority, alive and close are control
+ *		o Any data request sent for a stream also keeps it alive, so an
+ *		  active stream sends no alive packets
+ *		o Keep alives fall due USR_KEEPALIVETIME after the last packet for the
+ *		  stream, rounded up to a multiple of USR_KEEPALIVEALIGN, so idle
+ *		  streams come due together. Alive and close notifications due in a
+ *		  tick are sent as one packet of each at the end of the tick
+ *		o A closing stream keeps its ID until its close has been sent
+ *
+ *	RESUME
+ *		o A stream that timed out or was cancelled (not closed by the client)
+ *		  can be resumed with USR_Resume, e.g. on USB reconnect
+ *		o The client offset, the data already handed to the client and the
+ *		  CRC verification state are kept. Data is re-requested from the
+ *		  first byte the client has not been given
+ *		o The stream reclaims its ID if still free, so the host sees the same
+ *		  stream. Its first data request re-opens it on the host
+ *		o Flow control restarts, the link may have changed
+ *
+ *	SCHEDULING
+ *		o Streams with data to request are queued on a ready list and served
+ *		  deficit round robin. Each visit adds USR_QUANTUM * weight to the
+ *		  stream's deficit, and requests are issued while they fit in it
+ *		o Data requested and not yet received across all streams is limited
+ *		  to USR_INFLIGHTLIMIT. As the host serves requests in order this
+ *		  splits the bandwidth by weight
+ *		o A cap limits a stream's request rate with a token bucket. A capped
+ *		  stream leaves the ready list until it has the tokens for its next
+ *		  request
+ *		o USR_GetBandwidth reports the delivered data rate
+ *		o Retransmissions of holes are not scheduled, their data has already
+ *		  been accounted for
+ *
+ *	STATISTICS
+ *		o Each stream counts the data delivered, requests sent, re-sent and
+ *		  timed out, a log2 histogram of round trip times, client stalls and
+ *		  the time spent with each number of buffers held for the client.
+ *		  All are counters updated where the event happens, nothing is
+ *		  ticked, so they are always on
+ *		o A stall starts when a read finds no data and ends at the next read
+ *		  that returns data
+ *		o USR_GetStats gives a snapshot including a stall in progress
+ *		o USR_SetTelemetry sends a bPacket frame per stream every period
+ *		  into a queue (e.g. the debug UART). Little endian:
+ *			BYTES				DESCRIPTION
+ *			0					USR_TELEMETRYFRAME
+ *			1					Stream ID
+ *			2-5					Time (ms)
+ *			6-9					Bytes delivered
+ *			10-13				Requests sent
+ *			14-17				Requests retried
+ *			18-21				Requests timed out
+ *			22-25				Stalls
+ *			26-29				Stall time (ms)
+ *			30-33				Bandwidth (bytes/s)
+ *			34-35				Retry timeout (ms)
+ *			36					Request depth
+ *			37					Buffers per request
+ *			38-					USR_RTTBINS round trip time bins, 4 bytes each
+ *			..					USR_BUFFERCOUNT + 1 occupancy bins (ms), 4 bytes each
+ *
+ *	STREAM IDs
+ *		o A table indexed by ID routes received packets to their stream
+ *		o A bitmap of used IDs is searched a word at a time from the ID after
+ *		  the last allocated, so recently closed IDs are not reused at once
+ *		o An ID is held until the close has been sent to the host
  */
 
 /* Includes ------------------------------------------------------------------*/
 #include <usbStreamReader.h>
 #include "string.h"
 #include "usbPacketIDs.h"
-#include "usbHandler.h"
+#include "bOutbound.h"
 #include "stdbool.h"
+#include "bPacket.h"
 
 /* Private define ------------------------------------------------------------*/
 #define USR_KEEPALIVETIME					500			//500ms
-#define USR_DATARECTIMEOUT					100			//100ms
+#define USR_KEEPALIVEALIGN					100			//Keep alives fall due on multiples of this
+#define USR_KEEPALIVEDUE(STREAM)			((((STREAM)->keepAliveTime + USR_KEEPALIVETIME + USR_KEEPALIVEALIGN - 1) / USR_KEEPALIVEALIGN) * USR_KEEPALIVEALIGN)
+#define USR_NOTIFYMAX						31			//Stream IDs per alive/close packet
 #define USR_USBTIMEOUT						1100		//1100ms
+#define USR_IDCOUNT							256			//Stream IDs are a byte
+#define USR_QUANTUM							BCHAIN_SIZE	//Deficit added per round for a weight of 1
+#define USR_CAPBURST						100			//Cap tokens held at most (ms of the cap rate)
+#define USR_TELEMETRYFRAME					0x54		//First byte of a telemetry frame
+#define USR_TELEMETRYLENGTH					(38 + (USR_RTTBINS * 4) + ((USR_BUFFERCOUNT + 1) * 4))
+
+#define USR_ISDUE(TIME)						((int32_t)(usrTime - (TIME)) >= 0)
+#define USR_ISBEFORE(A, B)					((int32_t)((A) - (B)) < 0)
+
+//Every hole the requests can leave must fit in the verifier, so an in order client is always verified
+#if (BSCRC_PENDINGCOUNT < (USR_REQUESTCOUNT * (USR_REQUESTRANGES + 1)))
+#error "BSCRC_PENDINGCOUNT too small for the stream requests"
+#endif
 
 //STATES
 enum USR_STATEs
@@ -62,49 +191,111 @@ enum USR_FLAGs
 	USR_FLAG_STRMCLOSED = 0x08,
 	USR_FLAG_CANCELLED = 0x10,
 	USR_FLAG_REMOVED = 0x20,
+	USR_FLAG_CRCFAILED = 0x40,
+	USR_FLAG_READY = 0x80,				//On the ready list with data to request
+	USR_FLAG_SCHEDULED = 0x100,			//On the stream stack, ordered by deadline
+	USR_FLAG_CAPPED = 0x200,			//Waiting for cap tokens
+	USR_FLAG_VISITED = 0x400,			//Quantum added for the current visit
+	USR_FLAG_CLOSEPENDING = 0x800,		//Close queued, removed once sent
+	USR_FLAG_STALLED = 0x1000,			//Stream client waiting for data
 	USR_FLAG_STREAMACCESSDENIED = (USR_FLAG_USBTIMEDOUT | USR_FLAG_STRMCLOSED | USR_FLAG_CANCELLED | USR_FLAG_REMOVED)
 };
 
 /* Private variables ---------------------------------------------------------*/
-static USR_StreamReader_td *usrBaseStream;
-static uint8_t usrID;
+static USR_StreamReader_td *usrBaseStream;		//Ordered by deadline
+static USR_StreamReader_td *usrStreamTable[USR_IDCOUNT];	//Indexed by stream ID
+static uint32_t usrIDUsed[USR_IDCOUNT / 32];				//Bitmap of IDs in use
+static uint8_t usrID;										//Next ID to allocate from
+static uint32_t usrTime;
+static USR_StreamReader_td *usrReadyHead;		//Streams with data to request, in round robin order
+static USR_StreamReader_td *usrReadyTail;
+static uint32_t usrInFlight;
+static uint8_t usrAliveIDs[USR_NOTIFYMAX];			//Alive notifications to send this tick
+static uint8_t usrAliveCount;
+static USR_StreamReader_td *usrClosing[USR_NOTIFYMAX];	//Close notifications to send this tick
+static uint8_t usrClosingCount;
+static QUEUE_Typedef *usrTelemetryQueue;
+static uint16_t usrTelemetryPeriod;
+static uint32_t usrTelemetryTime;
 
 /* Private function prototypes -----------------------------------------------*/
 static void USR_tickStreams(USR_StreamReader_td *stream);
+static void USR_SendNotifications(void);
 static void USR_RequestUSBData(USR_StreamReader_td *stream);
-static void USR_StackStream(USR_StreamReader_td *stream);
+static void USR_RunScheduler(void);
+static bool USR_NextRequest(USR_StreamReader_td *stream, USR_Request_td **slot, uint16_t *length);
+static bool USR_TakeCapTokens(USR_StreamReader_td *stream, uint16_t length);
+static void USR_UpdateInFlight(USR_StreamReader_td *stream);
+static void USR_ReadyStream(USR_StreamReader_td *stream);
+static void USR_UnreadyStream(USR_StreamReader_td *stream);
+static void USR_AlignBuffers(USR_StreamReader_td *stream, uint32_t offset);
+static bool USR_SendRequest(USR_StreamReader_td *stream, uint32_t offset, uint16_t length);
+static bool USR_ResendHoles(USR_StreamReader_td *stream, USR_Request_td *request);
+static uint16_t USR_AcceptData(USR_StreamReader_td *stream, USR_Request_td *request, uint32_t offset, uint8_t *data, uint16_t length);
+static bool USR_AddRange(USR_Request_td *request, uint16_t start, uint16_t end);
+static void USR_AdvanceRequest(USR_Request_td *request, uint16_t received);
+static void USR_ReleaseStreamBuffers(USR_StreamReader_td *stream, uint32_t offset);
+static uint32_t USR_GetAvailable(USR_StreamReader_td *stream, uint32_t offset);
+static void USR_ScheduleStream(USR_StreamReader_td *stream);
 static void USR_DeStackStream(USR_StreamReader_td *stream);
-static uint8_t USR_GetStreamID();
+static bool USR_AllocateStreamID(USR_StreamReader_td *stream);
+static bool USR_ClaimStreamID(USR_StreamReader_td *stream);
+static void USR_FreeStreamID(USR_StreamReader_td *stream);
+static void USR_RecordStall(USR_StreamReader_td *stream, bool stalled);
+static void USR_RecordOccupancy(USR_StreamReader_td *stream);
+static void USR_SendTelemetry(void);
+static void USR_PutUint32(uint8_t *data, uint32_t value);
 
 static BSTREAM_Enum USR_ReceiverStreamOpen(struct BSTREAM_Reader_td *stream);
 static BSTREAM_Enum USR_StreamCount(BSTREAM_Reader_td *stream, uint32_t offset, uint32_t *count);
 static BSTREAM_Enum USR_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t offset, uint8_t *data, uint32_t length, uint32_t *actualLength);
 static BSTREAM_Enum USR_ReceiverStreamClose(struct BSTREAM_Reader_td *stream);
-static void USR_GetLowAndHiContiguousOffset(uint32_t *offsetsLo, uint32_t *offsetsHi, uint8_t offsetPairCount, uint32_t *offsetLo, uint32_t *offsetHi);
 
 /* Private functions ---------------------------------------------------------*/
 
 /**
-  * @brief	Tick controller
+  * @brief	Tick controller. Services only the streams that are due
   * @param	None
   * @retval	None
   */
-static uint32_t tickTimer;
 void USR_millisecondTick(void)
 {
-	tickTimer++;
-	if(usrBaseStream == NULL)
-		return;
-
-	USR_StreamReader_td *stream = usrBaseStream;
-	while(stream != NULL)
+	usrTime++;
+	while((usrBaseStream != NULL) && USR_ISDUE(usrBaseStream->deadline))
 	{
-		USR_StreamReader_td *next = stream->next;
+		USR_StreamReader_td *stream = usrBaseStream;
+		USR_DeStackStream(stream);
 		USR_tickStreams(stream);
-		stream = next;
+	}
+
+	//Retry requests that could not be sent
+	if(usrReadyHead != NULL)
+		USR_RunScheduler();
+
+	USR_SendNotifications();
+
+	if((usrTelemetryQueue != NULL) && USR_ISDUE(usrTelemetryTime))
+	{
+		usrTelemetryTime = usrTime + usrTelemetryPeriod;
+		USR_SendTelemetry();
 	}
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Time until a stream next needs servicing
+  * @param	None
+  * @retval	Milliseconds until the next deadline, 0xffffffff if no streams
+  */
+uint32_t USR_GetTimeToDeadline(void)
+{
+	if(usrBaseStream == NULL)
+		return 0xffffffff;
+	if(USR_ISDUE(usrBaseStream->deadline) || (usrReadyHead != NULL))
+		return 0;
+	return usrBaseStream->deadline - usrTime;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
   * @brief	Start a data transfer
@@ -113,16 +304,15 @@ void USR_millisecondTick(void)
   * @param	crc: CRC checksum of the data
   * @retval	BSTREAM_Enum
   */
-static uint32_t testCRC;
-static uint32_t testCRCOffset;
 BSTREAM_Enum USR_Start(USR_StreamReader_td *stream, uint32_t length, uint32_t crc)
 {
 	if((stream->flags & USR_FLAG_STARTED) && !(stream->flags & USR_FLAG_REMOVED))
 		return BSTREAM_BUSY;
 
-	//Stack stream for processing
-	stream->streamID = USR_GetStreamID();
-	USR_StackStream(stream);
+	//Get unique ID. Stacked for processing once initialized
+	USR_DeStackStream(stream);
+	if(!USR_AllocateStreamID(stream))
+		return BSTREAM_BUSY;
 
 	//Initialize stream interface
 	stream->stream.length = length;
@@ -141,17 +331,79 @@ BSTREAM_Enum USR_Start(USR_StreamReader_td *stream, uint32_t length, uint32_t cr
 		BCHAIN_ChainAddTail(&stream->availableBuffers, &stream->buffers[i]);
 	}
 	BCHAIN_CHAIN_CLEAR(&stream->streamBuffers);
+	for(uint8_t i = 0; i < USR_REQUESTCOUNT; i++)
+		stream->requests[i].active = 0;
+	stream->requestOffset = 0;
 
 	//Runtime Variables
 	stream->streamOffset = 0;
-	stream->keepAliveTmr = 0xffff;
-	stream->usbTimeoutTmr = 0;
+	stream->streamEnd = 0;
+	stream->keepAliveTime = usrTime - USR_KEEPALIVETIME;		//Keep alive with the next batch
+	stream->usbTime = usrTime;
 	stream->flags = USR_FLAG_STARTED;
-	testCRC = 0;
-	testCRCOffset = 0;
+	stream->weight = 1;
+	stream->cap = 0;
+	stream->deficit = 0;
+	stream->inFlight = 0;
+	stream->occupancy = 0;
+	BSCRC_Init(&stream->verifier, length, crc);
+	USRFC_Init(&stream->flow, USR_REQUESTCOUNT, USR_REQUESTBUFFERS, usrTime);
+	USR_ResetStats(stream);
+
+	USR_RequestUSBData(stream);
+	USR_ScheduleStream(stream);
+	return BSTREAM_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Resume a data transfer that timed out or was cancelled, from the
+  * 		first byte not yet given to the stream client
+  * @param	stream: pointer to the stream interface for received data
+  * @retval	BSTREAM_Enum
+  */
+BSTREAM_Enum USR_Resume(USR_StreamReader_td *stream)
+{
+	if(!(stream->flags & USR_FLAG_STARTED) || (stream->flags & USR_FLAG_STRMCLOSED))
+		return BSTREAM_CLOSED;
+	if(stream->flags & USR_FLAG_CRCFAILED)
+		return BSTREAM_CRCERROR;
+	if(!(stream->flags & (USR_FLAG_USBTIMEDOUT | USR_FLAG_CANCELLED)))
+		return BSTREAM_BUSY;
+
+	//Withdraw a close not yet sent
+	for(uint8_t i = 0; i < usrClosingCount; i++)
+	{
+		if(usrClosing[i] != stream)
+			continue;
+		usrClosingCount--;
+		memmove(&usrClosing[i], &usrClosing[i + 1], (usrClosingCount - i) * sizeof(usrClosing[0]));
+		break;
+	}
+
+	//Closed with the host, get the ID back
+	if((stream->flags & USR_FLAG_REMOVED) && !USR_ClaimStreamID(stream))
+		return BSTREAM_BUSY;
+
+	//Drop outstanding requests and partially received buffers
+	USR_UnreadyStream(stream);
+	for(uint8_t i = 0; i < USR_REQUESTCOUNT; i++)
+		stream->requests[i].active = 0;
+	USR_UpdateInFlight(stream);
+	BCHAIN_Buffer_td *head = BCHAIN_CHAIN_HEAD(&stream->availableBuffers);
+	if(head != NULL)
+		BCHAIN_ResetChain(&stream->availableBuffers, head->offset);
+	stream->requestOffset = 0;
+
+	//Runtime Variables. Client offset, client buffers and verifier are kept
+	stream->keepAliveTime = usrTime - USR_KEEPALIVETIME;
+	stream->usbTime = usrTime;
+	stream->flags &= (USR_FLAG_STARTED | USR_FLAG_STRMOPENED | USR_FLAG_SCHEDULED);
+	stream->deficit = 0;
+	USRFC_Init(&stream->flow, USR_REQUESTCOUNT, USR_REQUESTBUFFERS, usrTime);
 
-	stream->reqTimeoutTmr = 0xffff;
 	USR_RequestUSBData(stream);
+	USR_ScheduleStream(stream);
 	return BSTREAM_OK;
 }
 
@@ -164,91 +416,468 @@ BSTREAM_Enum USR_Start(USR_StreamReader_td *stream, uint32_t length, uint32_t cr
 void USR_Cancel(USR_StreamReader_td *stream)
 {
 	stream->flags |= USR_FLAG_CANCELLED;
+	USR_ScheduleStream(stream);
 }
 
 /*----------------------------------------------------------------------------*/
 /**
-  * @brief	Tick controller for streams
+  * @brief	Set the share of the USB bandwidth used by a stream
+  * @param	stream: pointer to the stream
+  * @param	weight: share relative to other streams. Default 1
+  * @param	cap: maximum data rate requested (bytes/s). 0 for unlimited
+  * @retval	None
+  */
+void USR_SetShare(USR_StreamReader_td *stream, uint8_t weight, uint32_t cap)
+{
+	stream->weight = (weight > 0) ? weight : 1;
+	stream->cap = cap;
+	stream->capTokens = 0;
+	stream->capTime = usrTime;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Get the data rate delivered to a stream
+  * @param	stream: pointer to the stream
+  * @retval	Bytes per second
+  */
+uint32_t USR_GetBandwidth(USR_StreamReader_td *stream)
+{
+	return stream->flow.throughput;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Get a snapshot of the statistics of a stream
+  * @param	stream: pointer to the stream
+  * @param[out]	stats: pointer to the statistics
+  * @retval	None
+  */
+void USR_GetStats(USR_StreamReader_td *stream, USR_Stats_td *stats)
+{
+	*stats = stream->stats;
+
+	//Include the stall and occupancy in progress
+	if(stream->flags & USR_FLAG_STALLED)
+		stats->stallTime += usrTime - stream->stallStart;
+	stats->occupancy[stream->occupancy] += usrTime - stream->occupancyTime;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Clear the statistics of a stream
+  * @param	stream: pointer to the stream
+  * @retval	None
+  */
+void USR_ResetStats(USR_StreamReader_td *stream)
+{
+	memset(&stream->stats, 0, sizeof(stream->stats));
+	stream->stallStart = usrTime;
+	stream->occupancyTime = usrTime;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Send a telemetry frame for each stream periodically
+  * @param	queue: pointer to the queue to encode the frames into. NULL to stop
+  * @param	period: milliseconds between frames
+  * @retval	None
+  */
+void USR_SetTelemetry(QUEUE_Typedef *queue, uint16_t period)
+{
+	usrTelemetryQueue = queue;
+	usrTelemetryPeriod = period;
+	usrTelemetryTime = usrTime + period;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Service a stream that is due. Must be removed from the stack, it is
+  * 		re-stacked for its next deadline unless closed
   * @param	stream: pointer to the stream to tick
   * @retval	None
   */
 static void USR_tickStreams(USR_StreamReader_td *stream)
 {
-	uint8_t data[8];
+	//Monitor for request timeout. Re-request the holes
+	for(uint8_t i = 0; i < USR_REQUESTCOUNT; i++)
+	{
+		USR_Request_td *request = &stream->requests[i];
+		if(!request->active || !USR_ISDUE(request->sentTime + stream->flow.rto))
+			continue;
+		if(USR_ResendHoles(stream, request))
+		{
+			stream->stats.requestsTimedOut++;
+			request->sentTime = usrTime;
+			if(request->retries < 0xff)
+				request->retries++;
+			USRFC_RequestTimeout(&stream->flow);
+		}
+	}
 
-	//Monitor for request timeout
-	if(stream->reqTimeoutTmr < 0xffff)
-		stream->reqTimeoutTmr++;
-	if(stream->reqTimeoutTmr >= USR_DATARECTIMEOUT)
+	//Retry a capped stream. Re-capped if its tokens are still short
+	if(stream->flags & USR_FLAG_CAPPED)
+	{
+		stream->flags &= ~USR_FLAG_CAPPED;
 		USR_RequestUSBData(stream);
+	}
 
 	//Monitor for USB timeout
-	if(stream->usbTimeoutTmr < 0xffff)
-		stream->usbTimeoutTmr++;
-	if(stream->usbTimeoutTmr >= USR_USBTIMEOUT)
+	if(USR_ISDUE(stream->usbTime + USR_USBTIMEOUT))
 		stream->flags |= USR_FLAG_USBTIMEDOUT;
 
-	//Monitor for stream end
+	//Monitor for stream end. Queue the close, removed once sent
 	if(stream->flags & (USR_FLAG_STRMCLOSED | USR_FLAG_CANCELLED | USR_FLAG_USBTIMEDOUT))
 	{
-		//Request data
-		data[0] = pktUSRClose;
-		data[1] = stream->streamID;
-		if(USBHND_sendPacket(data, 2) == true)
+		if(usrClosingCount < USR_NOTIFYMAX)
 		{
-			USR_DeStackStream(stream);
-			stream->flags |= USR_FLAG_REMOVED;
+			usrClosing[usrClosingCount++] = stream;
+			stream->flags |= USR_FLAG_CLOSEPENDING;
 			return;
 		}
 	}
 
 	//Keep Comms Alive
-	if(stream->keepAliveTmr < 0xffff)
-		stream->keepAliveTmr++;
-	if(stream->keepAliveTmr >= USR_KEEPALIVETIME)
+	if(USR_ISDUE(USR_KEEPALIVEDUE(stream)) && (usrAliveCount < USR_NOTIFYMAX))
+	{
+		usrAliveIDs[usrAliveCount++] = stream->streamID;
+		stream->keepAliveTime = usrTime;
+	}
+
+	USR_ScheduleStream(stream);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Send the alive and close notifications queued this tick, one
+  * 		packet of each. Retried next tick if they could not be sent
+  * @param	None
+  * @retval	None
+  */
+static void USR_SendNotifications(void)
+{
+	uint8_t data[1 + USR_NOTIFYMAX];
+
+	if(usrAliveCount > 0)
 	{
 		data[0] = pktUSRAlive;
-		data[1] = stream->streamID;
-		if(USBHND_sendPacket(data, 2) == true)
-			stream->keepAliveTmr = 0;
+		memcpy(&data[1], usrAliveIDs, usrAliveCount);
+		if(BOUT_Send(data, 1 + usrAliveCount, BOUT_PRIORITY_CONTROL, 0) == true)
+			usrAliveCount = 0;
+	}
+
+	if(usrClosingCount > 0)
+	{
+		data[0] = pktUSRClose;
+		for(uint8_t i = 0; i < usrClosingCount; i++)
+			data[1 + i] = usrClosing[i]->streamID;
+		if(BOUT_Send(data, 1 + usrClosingCount, BOUT_PRIORITY_CONTROL, 0) == false)
+			return;
+
+		//Remove the closed streams
+		for(uint8_t i = 0; i < usrClosingCount; i++)
+		{
+			USR_StreamReader_td *stream = usrClosing[i];
+			USR_UnreadyStream(stream);
+			for(uint8_t r = 0; r < USR_REQUESTCOUNT; r++)
+				stream->requests[r].active = 0;
+			USR_UpdateInFlight(stream);
+			USR_FreeStreamID(stream);
+			stream->flags &= ~USR_FLAG_CLOSEPENDING;
+			stream->flags |= USR_FLAG_REMOVED;
+		}
+		usrClosingCount = 0;
 	}
 }
 
 /*----------------------------------------------------------------------------*/
 /**
-  * @brief	Find stream by unique ID
-  * @param	streamID: id unique to the desired stream
-  * @retval	Pointer to the stream or NULL if not found
+  * @brief	Queue a stream to request the free space in its receive window
+  * @param	stream: pointer to the stream
+  * @retval	None
   */
-static uint32_t events[4096];
-static uint16_t eventsIdx = 0;
 static void USR_RequestUSBData(USR_StreamReader_td *stream)
 {
 	//Get offset of next data required for stream
-	uint32_t offset = stream->streamOffset + BCHAIN_GetChainDataCount(&stream->streamBuffers, stream->streamOffset);
-
-	//Restructure available buffers for streamOffset
-	BCHAIN_Chain_td outofRangeBuffers;
-	BCHAIN_GetChainBuffersApplicableToOffset(&stream->availableBuffers, offset, &outofRangeBuffers);	//Remove buffers in available not required for stream
-	offset += BCHAIN_GetChainDataCount(&stream->availableBuffers, offset);	//Update the available offset
-	if(BCHAIN_CHAIN_HEAD(&stream->availableBuffers) != NULL)
-		BCHAIN_ResetChain(&outofRangeBuffers, 0);									//Tag buffers on the end
+	uint32_t offset = stream->streamOffset + USR_GetAvailable(stream, stream->streamOffset);
+	if(offset < stream->stream.length)
+		USR_AlignBuffers(stream, offset);
+	USR_UpdateInFlight(stream);
+	if((offset >= stream->stream.length) || BCHAIN_ISCHAINEMPTY(&stream->availableBuffers))
+		return;
+
+	//Request from the window start so every buffer fills
+	uint32_t windowStart = BCHAIN_CHAIN_HEAD(&stream->availableBuffers)->offset;
+	if(stream->requestOffset < windowStart)
+		stream->requestOffset = windowStart;
+
+	if(!(stream->flags & (USR_FLAG_READY | USR_FLAG_CAPPED)) && USR_NextRequest(stream, NULL, NULL))
+		USR_ReadyStream(stream);
+	USR_RunScheduler();
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Issue data requests from the ready streams, deficit round robin
+  * @param	None
+  * @retval	None
+  */
+static void USR_RunScheduler(void)
+{
+	while(usrReadyHead != NULL)
+	{
+		USR_StreamReader_td *stream = usrReadyHead;
+		if(!(stream->flags & USR_FLAG_VISITED))
+		{
+			stream->deficit += USR_QUANTUM * stream->weight;
+			stream->flags |= USR_FLAG_VISITED;
+		}
+
+		USR_Request_td *request;
+		uint16_t length;
+		while(USR_NextRequest(stream, &request, &length))
+		{
+			//Turn over, next round
+			if(length > stream->deficit)
+				break;
+
+			//Capped, wait for tokens
+			if(!USR_TakeCapTokens(stream, length))
+			{
+				stream->flags |= USR_FLAG_CAPPED;
+				break;
+			}
+
+			//All streams wait for data in flight or the USB
+			if(((usrInFlight + length) > USR_INFLIGHTLIMIT) || !USR_SendRequest(stream, stream->requestOffset, length))
+			{
+				stream->capTokens += (stream->cap > 0) ? length : 0;
+				return;
+			}
+
+			request->offset = stream->requestOffset;
+			request->length = length;
+			request->received = 0;
+			request->rangeCount = 0;
+			request->sentTime = usrTime;
+			request->retries = 0;
+			request->active = 1;
+			stream->requestOffset += length;
+			stream->deficit -= length;
+			stream->inFlight += length;
+			usrInFlight += length;
+		}
+
+		//Remove, or move to the back of the round
+		USR_UnreadyStream(stream);
+		if(stream->flags & USR_FLAG_CAPPED)
+			USR_ScheduleStream(stream);
+		else if(USR_NextRequest(stream, NULL, NULL))
+			USR_ReadyStream(stream);
+		else
+			stream->deficit = 0;		//Idle streams do not bank a deficit
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Get the next data request a stream may make
+  * @param	stream: pointer to the stream
+  * @param[out]	slot: free request slot. May be NULL
+  * @param[out]	length: length of the request. May be NULL
+  * @retval	false if the stream has nothing to request
+  */
+static bool USR_NextRequest(USR_StreamReader_td *stream, USR_Request_td **slot, uint16_t *length)
+{
+	if((stream->flags & USR_FLAG_STREAMACCESSDENIED) || BCHAIN_ISCHAINEMPTY(&stream->availableBuffers))
+		return false;
+
+	//Space in the receive window
+	uint32_t windowStart = BCHAIN_CHAIN_HEAD(&stream->availableBuffers)->offset;
+	uint32_t windowEnd = windowStart + BCHAIN_GetChainSize(&stream->availableBuffers);
+	if(windowEnd > stream->stream.length)
+		windowEnd = stream->stream.length;
+	if(stream->requestOffset >= windowEnd)
+		return false;
+
+	//Free request slot, up to the allowed depth
+	uint8_t active = 0;
+	USR_Request_td *free = NULL;
+	for(uint8_t i = 0; i < USR_REQUESTCOUNT; i++)
+	{
+		if(stream->requests[i].active)
+			active++;
+		else if(free == NULL)
+			free = &stream->requests[i];
+	}
+	if((free == NULL) || (active >= stream->flow.depth))
+		return false;
+
+	//Request up to a buffer boundary
+	uint32_t end = windowStart + ((((stream->requestOffset - windowStart) / BCHAIN_SIZE) + stream->flow.requestBuffers) * BCHAIN_SIZE);
+	if(end > windowEnd)
+		end = windowEnd;
+
+	if(slot != NULL)
+		*slot = free;
+	if(length != NULL)
+		*length = (uint16_t)(end - stream->requestOffset);
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Take tokens for a request under the stream cap
+  * @param	stream: pointer to the stream
+  * @param	length: length of the request
+  * @retval	false if the stream must wait
+  */
+static bool USR_TakeCapTokens(USR_StreamReader_td *stream, uint16_t length)
+{
+	if(stream->cap == 0)
+		return true;
+
+	//Refill
+	uint32_t burst = (stream->cap * USR_CAPBURST) / 1000;
+	if(burst < (USR_REQUESTBUFFERS * BCHAIN_SIZE))
+		burst = USR_REQUESTBUFFERS * BCHAIN_SIZE;
+	uint32_t elapsed = usrTime - stream->capTime;
+	uint32_t tokens = stream->capTokens + (uint32_t)(((uint64_t)stream->cap * elapsed) / 1000);
+	stream->capTokens = (tokens < burst) ? tokens : burst;
+	stream->capTime = usrTime;
+
+	if(stream->capTokens < length)
+		return false;
+	stream->capTokens -= length;
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Recount the data a stream has requested and not yet received
+  * @param	stream: pointer to the stream
+  * @retval	None
+  */
+static void USR_UpdateInFlight(USR_StreamReader_td *stream)
+{
+	uint32_t inFlight = 0;
+	for(uint8_t i = 0; i < USR_REQUESTCOUNT; i++)
+	{
+		USR_Request_td *request = &stream->requests[i];
+		if(!request->active)
+			continue;
+		inFlight += request->length - request->received;
+		for(uint8_t r = 0; r < request->rangeCount; r++)
+			inFlight -= request->ranges[r].end - request->ranges[r].start;
+	}
+	usrInFlight = usrInFlight - stream->inFlight + inFlight;
+	stream->inFlight = inFlight;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Add a stream to the back of the ready list
+  * @param	stream: pointer to the stream
+  * @retval	None
+  */
+static void USR_ReadyStream(USR_StreamReader_td *stream)
+{
+	stream->nextReady = NULL;
+	if(usrReadyTail == NULL)
+		usrReadyHead = stream;
 	else
-		BCHAIN_ResetChain(&outofRangeBuffers, offset);							//Align to offset
-	BCHAIN_ChainAddChainTail(&stream->availableBuffers, &outofRangeBuffers);
+		usrReadyTail->nextReady = stream;
+	usrReadyTail = stream;
+	stream->flags |= USR_FLAG_READY;
+}
 
-	//Get amount of data to request
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Remove a stream from the ready list
+  * @param	stream: pointer to the stream
+  * @retval	None
+  */
+static void USR_UnreadyStream(USR_StreamReader_td *stream)
+{
+	stream->flags &= ~(USR_FLAG_READY | USR_FLAG_VISITED);
+
+	USR_StreamReader_td *srch = usrReadyHead;
+	USR_StreamReader_td *prev = NULL;
+	while((srch != NULL) && (srch != stream))
+	{
+		prev = srch;
+		srch = srch->nextReady;
+	}
+	if(srch == NULL)	//Not ready
+		return;
+
+	if(prev == NULL)
+		usrReadyHead = srch->nextReady;
+	else
+		prev->nextReady = srch->nextReady;
+	if(usrReadyTail == srch)
+		usrReadyTail = prev;
+	srch->nextReady = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Align the receive window to the next data required by the stream
+  * 		client, dropping requests that no longer land in the buffers
+  * @param	stream: pointer to the stream
+  * @param	offset: offset of the next data required by the stream client
+  * @retval	None
+  */
+static void USR_AlignBuffers(USR_StreamReader_td *stream, uint32_t offset)
+{
+	BCHAIN_Buffer_td *head = BCHAIN_CHAIN_HEAD(&stream->availableBuffers);
 	uint32_t chainSize = BCHAIN_GetChainSize(&stream->availableBuffers);
-	uint32_t usedSpace = 0;
-	if(BCHAIN_CHAIN_HEAD(&stream->availableBuffers) != NULL)
-		usedSpace = BCHAIN_GetChainDataCount(&stream->availableBuffers, BCHAIN_CHAIN_HEAD(&stream->availableBuffers)->offset);
-	uint32_t availableSpace = (chainSize - usedSpace);
-	if(availableSpace > (stream->stream.length - offset))
-		availableSpace = (stream->stream.length - offset);
-	if(availableSpace == 0)
+
+	if(head == NULL)		//All buffers held by the stream client
 		return;
 
-	//Request data
+	//Realign all buffers if the offset is outside of the window
+	if((offset < head->offset) || (offset >= (head->offset + chainSize)))
+	{
+		BCHAIN_ResetChain(&stream->availableBuffers, offset);
+		for(uint8_t i = 0; i < USR_REQUESTCOUNT; i++)
+			stream->requests[i].active = 0;
+		stream->requestOffset = offset;
+		return;
+	}
+
+	//Recycle buffers wholly below the offset to the end of the window
+	while(offset >= (head->offset + sizeof(head->data)))
+	{
+		BCHAIN_ChainRemoveHead(&stream->availableBuffers);
+		BCHAIN_BUFFER_CLEAR(head);
+		BCHAIN_ChainAddTail(&stream->availableBuffers, head);
+		head = BCHAIN_CHAIN_HEAD(&stream->availableBuffers);
+	}
+
+	//Drop requests for the recycled buffers. Requests spanning the head continue from it
+	for(uint8_t i = 0; i < USR_REQUESTCOUNT; i++)
+	{
+		USR_Request_td *request = &stream->requests[i];
+		if(!request->active)
+			continue;
+		if((request->offset + request->length) <= head->offset)
+			request->active = 0;
+		else if((request->offset + request->received) < head->offset)
+			USR_AdvanceRequest(request, head->offset - request->offset);
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Send a data request to the host
+  * @param	stream: pointer to the stream
+  * @param	offset: offset of the data to request
+  * @param	length: amount of data to request
+  * @retval	true if sent
+  */
+static bool USR_SendRequest(USR_StreamReader_td *stream, uint32_t offset, uint16_t length)
+{
 	uint8_t data[8];
 	data[0] = pktUSRDataRequest;
 	data[1] = stream->streamID;
@@ -256,32 +885,218 @@ static void USR_RequestUSBData(USR_StreamReader_td *stream)
 	data[3] = (uint8_t)(offset >> 8);
 	data[4] = (uint8_t)(offset >> 16);
 	data[5] = (uint8_t)(offset >> 24);
-	data[6] = (uint8_t)(availableSpace);
-	data[7] = (uint8_t)(availableSpace >> 8);
-	if(USBHND_sendPacket(data, 8) == true)
+	data[6] = (uint8_t)(length);
+	data[7] = (uint8_t)(length >> 8);
+	if(BOUT_Send(data, 8, BOUT_PRIORITY_REQUEST, 0) == false)
+		return false;
+
+	stream->stats.requestsSent++;
+	stream->keepAliveTime = usrTime;		//Request keeps the stream alive
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Re-request the data of a request not yet received
+  * @param	stream: pointer to the stream
+  * @param	request: pointer to the request
+  * @retval	true if all holes were requested
+  */
+static bool USR_ResendHoles(USR_StreamReader_td *stream, USR_Request_td *request)
+{
+	uint16_t start = request->received;
+	for(uint8_t i = 0; i <= request->rangeCount; i++)
 	{
-		stream->requestedOffset = offset;
-		stream->requestedLength = availableSpace;
-		stream->reqTimeoutTmr = 0;
+		uint16_t end = (i < request->rangeCount) ? request->ranges[i].start : request->length;
+		if(end > start)
+		{
+			if(!USR_SendRequest(stream, request->offset + start, end - start))
+				return false;
+			stream->stats.requestsRetried++;
+		}
+		if(i < request->rangeCount)
+			start = request->ranges[i].end;
 	}
+	return true;
 }
 
 /*----------------------------------------------------------------------------*/
 /**
-  * @brief	Stack a stream
-  * @param	stream: pointer to the stream to tick
+  * @brief	Write the data of a chunk not yet received by a request
+  * @param	stream: pointer to the stream
+  * @param	request: pointer to the request
+  * @param	offset: stream offset of the chunk
+  * @param	data: pointer to the chunk data
+  * @param	length: length of the chunk
+  * @retval	Amount of data accepted
+  */
+static uint16_t USR_AcceptData(USR_StreamReader_td *stream, USR_Request_td *request, uint32_t offset, uint8_t *data, uint16_t length)
+{
+	//Clip to the data outstanding, relative to the request
+	uint32_t chunkStart = (offset > request->offset) ? (offset - request->offset) : 0;
+	uint32_t chunkEnd = (offset + length) - request->offset;
+	if(chunkEnd > request->length)
+		chunkEnd = request->length;
+
+	uint16_t accepted = 0;
+	uint16_t start = (chunkStart > request->received) ? chunkStart : request->received;
+	while(start < chunkEnd)
+	{
+		//Skip ranges already received
+		uint8_t i = 0;
+		while((i < request->rangeCount) && (request->ranges[i].end <= start))
+			i++;
+
+		uint16_t end = chunkEnd;
+		if(i < request->rangeCount)
+		{
+			if(request->ranges[i].start <= start)
+			{
+				start = request->ranges[i].end;
+				continue;
+			}
+			if(request->ranges[i].start < end)
+				end = request->ranges[i].start;
+		}
+
+		//Out of ranges, leave for the hole to be re-requested
+		if(!USR_AddRange(request, start, end))
+			break;
+		BCHAIN_WriteChainData(&stream->availableBuffers, request->offset + start, &data[(request->offset + start) - offset], end - start);
+		accepted += end - start;
+		start = end;
+	}
+	return accepted;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Mark a range of a request as received
+  * @param	request: pointer to the request
+  * @param	start: start of the range, relative to the request offset
+  * @param	end: end of the range. Must not overlap received data
+  * @retval	false if there is no space to track the range
+  */
+static bool USR_AddRange(USR_Request_td *request, uint16_t start, uint16_t end)
+{
+	//In order
+	if(start == request->received)
+	{
+		USR_AdvanceRequest(request, end);
+		return true;
+	}
+
+	//Find insertion point
+	uint8_t idx = 0;
+	while((idx < request->rangeCount) && (request->ranges[idx].start < start))
+		idx++;
+
+	USR_Range_td *prev = (idx > 0) ? &request->ranges[idx - 1] : NULL;
+	USR_Range_td *next = (idx < request->rangeCount) ? &request->ranges[idx] : NULL;
+
+	//Extend the previous range, joining the next if the hole closes
+	if((prev != NULL) && (prev->end == start))
+	{
+		prev->end = end;
+		if((next != NULL) && (next->start == end))
+		{
+			prev->end = next->end;
+			request->rangeCount--;
+			memmove(next, next + 1, (request->rangeCount - idx) * sizeof(USR_Range_td));
+		}
+		return true;
+	}
+
+	//Extend the next range
+	if((next != NULL) && (next->start == end))
+	{
+		next->start = start;
+		return true;
+	}
+
+	//New range
+	if(request->rangeCount >= USR_REQUESTRANGES)
+		return false;
+	memmove(&request->ranges[idx + 1], &request->ranges[idx], (request->rangeCount - idx) * sizeof(USR_Range_td));
+	request->ranges[idx].start = start;
+	request->ranges[idx].end = end;
+	request->rangeCount++;
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Move the in order data received by a request forward, absorbing
+  * 		the ranges it reaches
+  * @param	request: pointer to the request
+  * @param	received: new amount of data received in order
   * @retval	None
   */
-static void USR_StackStream(USR_StreamReader_td *stream)
+static void USR_AdvanceRequest(USR_Request_td *request, uint16_t received)
 {
+	request->received = received;
+	while((request->rangeCount > 0) && (request->ranges[0].start <= request->received))
+	{
+		if(request->ranges[0].end > request->received)
+			request->received = request->ranges[0].end;
+		request->rangeCount--;
+		memmove(&request->ranges[0], &request->ranges[1], request->rangeCount * sizeof(USR_Range_td));
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Stack a stream in order of its next deadline. A stream already
+  * 		stacked is only moved if its deadline is brought forward
+  * @param	stream: pointer to the stream to schedule
+  * @retval	None
+  */
+static void USR_ScheduleStream(USR_StreamReader_td *stream)
+{
+	if(stream->flags & (USR_FLAG_REMOVED | USR_FLAG_CLOSEPENDING))
+		return;
+
+	//Earliest deadline
+	uint32_t deadline = USR_KEEPALIVEDUE(stream);
+	if(USR_ISBEFORE(stream->usbTime + USR_USBTIMEOUT, deadline))
+		deadline = stream->usbTime + USR_USBTIMEOUT;
+	for(uint8_t i = 0; i < USR_REQUESTCOUNT; i++)
+	{
+		USR_Request_td *request = &stream->requests[i];
+		if(request->active && USR_ISBEFORE(request->sentTime + stream->flow.rto, deadline))
+			deadline = request->sentTime + stream->flow.rto;
+	}
+	uint16_t length;
+	if((stream->flags & USR_FLAG_CAPPED) && USR_NextRequest(stream, NULL, &length) && (length > stream->capTokens))
+	{
+		uint32_t capDeadline = stream->capTime + ((((uint32_t)length - stream->capTokens) * 1000) + stream->cap - 1) / stream->cap;
+		if(USR_ISBEFORE(capDeadline, deadline))
+			deadline = capDeadline;
+	}
+	if((stream->flags & (USR_FLAG_STRMCLOSED | USR_FLAG_CANCELLED | USR_FLAG_USBTIMEDOUT)) || USR_ISDUE(deadline))
+		deadline = usrTime + 1;		//Next tick
+
+	//Already due no later
+	if((stream->flags & USR_FLAG_SCHEDULED) && !USR_ISBEFORE(deadline, stream->deadline))
+		return;
+
+	USR_DeStackStream(stream);
+	stream->deadline = deadline;
+
 	USR_StreamReader_td *srch = usrBaseStream;
-	while((srch != NULL) && (srch != stream))
+	USR_StreamReader_td *prev = NULL;
+	while((srch != NULL) && !USR_ISBEFORE(deadline, srch->deadline))
+	{
+		prev = srch;
 		srch = srch->next;
-	if(srch != NULL)	//Already on stack
-		return;
+	}
 
-	stream->next = usrBaseStream;
-	usrBaseStream = stream;
+	stream->next = srch;
+	if(prev == NULL)
+		usrBaseStream = stream;
+	else
+		prev->next = stream;
+	stream->flags |= USR_FLAG_SCHEDULED;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -307,28 +1122,71 @@ static void USR_DeStackStream(USR_StreamReader_td *stream)
 	else
 		prev->next = srch->next;
 	srch->next = NULL;
+	srch->flags &= ~USR_FLAG_SCHEDULED;
 }
 
 /*----------------------------------------------------------------------------*/
 /**
-  * @brief	Find unique stream ID
-  * @param	None
-  * @retval	None
+  * @brief	Allocate a unique stream ID
+  * @param	stream: pointer to the stream to allocate the ID to
+  * @retval	false if all IDs are in use
   */
-static uint8_t USR_GetStreamID()
+static bool USR_AllocateStreamID(USR_StreamReader_td *stream)
 {
-	while(1)
+	//Search from usrID a word at a time, wrapping back to the start word
+	uint8_t startWord = usrID >> 5;
+	uint32_t startMask = 0xffffffff << (usrID & 31);
+	for(uint8_t i = 0; i <= (USR_IDCOUNT / 32); i++)
 	{
-		//Is in use
-		USR_StreamReader_td *srch = usrBaseStream;
-		while((srch != NULL) && (srch->streamID != usrID))
-			srch = srch->next;
-		if(srch == NULL)	//ID unique
-			return usrID++;
-
-		usrID++;
+		uint8_t word = (startWord + i) % (USR_IDCOUNT / 32);
+		uint32_t free = ~usrIDUsed[word];
+		if(i == 0)
+			free &= startMask;
+		else if(i == (USR_IDCOUNT / 32))
+			free &= ~startMask;
+		if(free == 0)
+			continue;
+
+		uint8_t id = (word << 5) + __builtin_ctz(free);
+		usrIDUsed[word] |= (1UL << (id & 31));
+		usrStreamTable[id] = stream;
+		stream->streamID = id;
+		usrID = id + 1;
+		return true;
 	}
-	return 0xff;
+	return false;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Reclaim the stream's previous ID, or allocate another if it has
+  * 		been reused
+  * @param	stream: pointer to the stream
+  * @retval	false if all IDs are in use
+  */
+static bool USR_ClaimStreamID(USR_StreamReader_td *stream)
+{
+	uint8_t id = stream->streamID;
+	if(usrIDUsed[id >> 5] & (1UL << (id & 31)))
+		return USR_AllocateStreamID(stream);
+
+	usrIDUsed[id >> 5] |= (1UL << (id & 31));
+	usrStreamTable[id] = stream;
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Release a stream ID for reuse
+  * @param	stream: pointer to the stream
+  * @retval	None
+  */
+static void USR_FreeStreamID(USR_StreamReader_td *stream)
+{
+	if(usrStreamTable[stream->streamID] != stream)
+		return;
+	usrStreamTable[stream->streamID] = NULL;
+	usrIDUsed[stream->streamID >> 5] &= ~(1UL << (stream->streamID & 31));
 }
 
 /*----------------------------------------------------------------------------*/
@@ -339,10 +1197,7 @@ static uint8_t USR_GetStreamID()
   */
 USR_StreamReader_td* USR_GetStreamByID(uint8_t id)
 {
-	USR_StreamReader_td *srch = usrBaseStream;
-	while((srch != NULL) && (srch->streamID != id))
-		srch = srch->next;
-	return srch;
+	return usrStreamTable[id];
 }
 
 /*----------------------------------------------------------------------------*/
@@ -358,40 +1213,62 @@ void USR_DataReceivedHandler(USR_StreamReader_td *stream, uint32_t offset, uint8
 	if(BCHAIN_ISCHAINEMPTY(&stream->availableBuffers))
 		return;
 
-#warning BEN: Debugging information
-	if((testCRCOffset >= offset) && (testCRCOffset < (offset + length)))
-	{
-		uint32_t lclOS = (testCRCOffset - offset);
-		uint32_t lclen = length - lclOS;
-		testCRC = crc32_calculateData(testCRC, data, lclOS, lclen);
-		testCRCOffset += lclen;
-	}
-
-	//Populate specified chunks
-	BCHAIN_WriteChainData(&stream->availableBuffers, offset, data, length);
+	//Verify
+	BSCRC_Update(&stream->verifier, offset, data, length);
+	if(BSCRC_GetResult(&stream->verifier) == BSTREAM_CRCERROR)
+		stream->flags |= USR_FLAG_CRCFAILED;
+	stream->usbTime = usrTime;
 
-	//Get filled buffers
-	BCHAIN_Chain_td filledBuffers;
-	if((stream->receivedOffset + stream->receivedLength) == (stream->requestedOffset + stream->requestedLength))
-		BCHAIN_GetLoadedChainBuffers(&stream->availableBuffers, &filledBuffers, BCHAIN_FLAG_ACCEPTPARTIALBUFFERS);
-	else
-		BCHAIN_GetLoadedChainBuffers(&stream->availableBuffers, &filledBuffers, 0);
+	//Populate the requests the data falls within. Stale and duplicated data is ignored
+	for(uint8_t i = 0; i < USR_REQUESTCOUNT; i++)
+	{
+		USR_Request_td *request = &stream->requests[i];
+		if(!request->active || ((offset + length) <= (request->offset + request->received)) || (offset >= (request->offset + request->length)))
+			continue;
 
-	//Move to stream buffer
-	if(BCHAIN_CHAIN_HEAD(&filledBuffers) != NULL)
-		BCHAIN_ChainAddChainTail(&stream->streamBuffers, &filledBuffers);
+		//Round trip sample from the first data. Not for re-sent requests as the data may be for either send
+		if((request->received == 0) && (request->rangeCount == 0) && (request->retries == 0))
+		{
+			uint32_t rtt = usrTime - request->sentTime;
+			uint8_t bin = (rtt < 2) ? 0 : (31 - __builtin_clz(rtt));
+			stream->stats.rtt[(bin < USR_RTTBINS) ? bin : (USR_RTTBINS - 1)]++;
+			USRFC_RTTSample(&stream->flow, rtt);
+		}
 
-	//Update
-	stream->receivedOffset = offset;
-	stream->receivedLength = length;
-	stream->usbTimeoutTmr = 0;
+		uint16_t accepted = USR_AcceptData(stream, request, offset, data, length);
+		if(accepted == 0)
+			continue;
+		stream->stats.bytesDelivered += accepted;
+		USRFC_Delivered(&stream->flow, accepted, usrTime);
+		request->sentTime = usrTime;
+		if(request->received >= request->length)
+		{
+			request->active = 0;
+			if(request->retries == 0)
+				USRFC_RequestComplete(&stream->flow);
+		}
+	}
 
-	//Check if new data request required
-	if((stream->receivedOffset + stream->receivedLength) == (stream->requestedOffset + stream->requestedLength))
+	//Move filled buffers to the stream client
+	BCHAIN_Chain_td filledBuffers;
+	BCHAIN_GetLoadedChainBuffers(&stream->availableBuffers, &filledBuffers, 0);
+	BCHAIN_Buffer_td *head = BCHAIN_CHAIN_HEAD(&stream->availableBuffers);
+	if((head != NULL) && (head->length > 0) && ((head->offset + head->length) == stream->stream.length))
 	{
-		stream->reqTimeoutTmr = USR_DATARECTIMEOUT;	//Prepare for retry if the call below fails
-		USR_RequestUSBData(stream);
+		BCHAIN_ChainRemoveHead(&stream->availableBuffers);
+		BCHAIN_ChainAddTail(&filledBuffers, head);
 	}
+	BCHAIN_Buffer_td *tail = BCHAIN_GetChainTail(&filledBuffers);
+	if(tail != NULL)
+	{
+		stream->streamEnd = tail->offset + tail->length;
+		BCHAIN_ChainAddChainTail(&stream->streamBuffers, &filledBuffers);
+		USR_RecordOccupancy(stream);
+	}
+
+	//Keep the pipe full
+	USR_RequestUSBData(stream);
+	USR_ScheduleStream(stream);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -402,7 +1279,7 @@ void USR_DataReceivedHandler(USR_StreamReader_td *stream, uint32_t offset, uint8
   */
 void USR_AliveHandler(USR_StreamReader_td *stream)
 {
-	stream->usbTimeoutTmr = 0;
+	stream->usbTime = usrTime;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -433,38 +1310,13 @@ static BSTREAM_Enum USR_StreamCount(BSTREAM_Reader_td *stream, uint32_t offset,
 	USR_StreamReader_td *usrStream = (USR_StreamReader_td*)stream;
 	if(usrStream->flags & USR_FLAG_STREAMACCESSDENIED)
 		return BSTREAM_CLOSED;
+	if(usrStream->flags & USR_FLAG_CRCFAILED)
+		return BSTREAM_CRCERROR;
 
-	usrStream->streamOffset = offset;			//Used to know what to request next
-
-	//Release unrequired buffers
-	BCHAIN_Chain_td usedBuffers;
-	BCHAIN_GetChainBuffersApplicableToOffset(&usrStream->streamBuffers, usrStream->streamOffset, &usedBuffers);
-	BCHAIN_ResetChain(&usedBuffers, 0);
-	BCHAIN_ChainAddChainTail(&usrStream->availableBuffers, &usedBuffers);
-
-	//Check if new USB request required
-	uint32_t offsetsLo[3];
-	uint32_t offsetsHi[3];
-	offsetsLo[0] = BCHAIN_CHAIN_HEAD(&usrStream->streamBuffers) != NULL ? BCHAIN_CHAIN_HEAD(&usrStream->streamBuffers)->offset : 0xffffffff;
-	offsetsHi[0] = offsetsLo[0] + BCHAIN_GetChainDataCount(&usrStream->streamBuffers, offsetsLo[0]);
-	offsetsLo[1] = BCHAIN_CHAIN_HEAD(&usrStream->availableBuffers) != NULL ? BCHAIN_CHAIN_HEAD(&usrStream->availableBuffers)->offset : 0xffffffff;
-	offsetsHi[1] = offsetsLo[1] + BCHAIN_GetChainDataCount(&usrStream->availableBuffers, offsetsLo[1]);
-	offsetsLo[2] = usrStream->requestedOffset;
-	offsetsHi[2] = usrStream->requestedOffset + usrStream->requestedLength;
-	uint32_t offsetLo;
-	uint32_t offsetHi;
-	USR_GetLowAndHiContiguousOffset(offsetsLo, offsetsHi, 3, &offsetLo, &offsetHi);
-
-
-	if((usrStream->streamOffset < offsetLo) || (usrStream->streamOffset >= offsetHi))
-	{
-		usrStream->reqTimeoutTmr = USR_DATARECTIMEOUT;	//Force request again soon if request below fails
-		USR_RequestUSBData(usrStream);
-	}
+	USR_ReleaseStreamBuffers(usrStream, offset);
 
 	//Get available data
-	uint32_t available = BCHAIN_GetChainDataCount(&usrStream->streamBuffers, offset);
-	*count = available;
+	*count = USR_GetAvailable(usrStream, offset);
 
 	return BSTREAM_OK;
 }
@@ -485,49 +1337,63 @@ static BSTREAM_Enum USR_StreamRead(struct BSTREAM_Reader_td *stream, uint32_t of
 	USR_StreamReader_td *usrStream = (USR_StreamReader_td*)stream;
 	if(usrStream->flags & USR_FLAG_STREAMACCESSDENIED)
 		return BSTREAM_CLOSED;
+	if(usrStream->flags & USR_FLAG_CRCFAILED)
+		return BSTREAM_CRCERROR;
 
-	usrStream->streamOffset = offset;			//Used to know what to request next
-
-	//Release unrequired buffers
-	BCHAIN_Chain_td usedBuffers;
-	BCHAIN_GetChainBuffersApplicableToOffset(&usrStream->streamBuffers, usrStream->streamOffset, &usedBuffers);
-	BCHAIN_ResetChain(&usedBuffers, 0);
-	BCHAIN_ChainAddChainTail(&usrStream->availableBuffers, &usedBuffers);
-
-	//Check if new USB request required
-	uint32_t offsetsLo[3];
-	uint32_t offsetsHi[3];
-	offsetsLo[0] = BCHAIN_CHAIN_HEAD(&usrStream->streamBuffers) != NULL ? BCHAIN_CHAIN_HEAD(&usrStream->streamBuffers)->offset : 0xffffffff;
-	offsetsHi[0] = offsetsLo[0] + BCHAIN_GetChainDataCount(&usrStream->streamBuffers, offsetsLo[0]);
-	offsetsLo[1] = BCHAIN_CHAIN_HEAD(&usrStream->availableBuffers) != NULL ? BCHAIN_CHAIN_HEAD(&usrStream->availableBuffers)->offset : 0xffffffff;
-	offsetsHi[1] = offsetsLo[1] + BCHAIN_GetChainDataCount(&usrStream->availableBuffers, offsetsLo[1]);
-	offsetsLo[2] = usrStream->requestedOffset;
-	offsetsHi[2] = usrStream->requestedOffset + usrStream->requestedLength;
-	uint32_t offsetLo;
-	uint32_t offsetHi;
-	USR_GetLowAndHiContiguousOffset(offsetsLo, offsetsHi, 3, &offsetLo, &offsetHi);
-
-
-	if((usrStream->streamOffset < offsetLo) || (usrStream->streamOffset >= offsetHi))
-	{
-		usrStream->reqTimeoutTmr = USR_DATARECTIMEOUT;	//Force request again soon if request below fails
-		USR_RequestUSBData(usrStream);
-	}
+	USR_ReleaseStreamBuffers(usrStream, offset);
 
 	//Check for enough data
-	uint32_t available = BCHAIN_GetChainDataCount(&usrStream->streamBuffers, offset);
+	uint32_t available = USR_GetAvailable(usrStream, offset);
+	USR_RecordStall(usrStream, (available == 0) || ((available < length) && (actualLength == NULL)));
 	if((available < length) && (actualLength == NULL))
 		return BSTREAM_NOTENOUGHDATA;
 
-	//Read data
+	//Read data. Single copy when within the head buffer
 	if(available > length)
 		available = length;
-	BCHAIN_ReadChainData(&usrStream->streamBuffers, offset, data, available);
+	BCHAIN_Buffer_td *head = BCHAIN_CHAIN_HEAD(&usrStream->streamBuffers);
+	if((head != NULL) && ((offset + available) <= (head->offset + head->length)))
+		memcpy(data, &head->data[offset - head->offset], available);
+	else
+		BCHAIN_ReadChainData(&usrStream->streamBuffers, offset, data, available);
 	if(actualLength != NULL)
 		*actualLength = available;
 	return BSTREAM_OK;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Get the data held from offset without copying it. The data remains
+  * 		valid until the client moves to an offset beyond its buffer
+  * @param	stream: pointer to the stream
+  * @param	offset: offset of the data required
+  * @param[out]	data: pointer to the data at offset
+  * @param[out]	length: amount of data at data, up to the end of its buffer. 0
+  * 		if the data has not yet been received
+  * @retval	BSTREAM_Enum
+  */
+BSTREAM_Enum USR_PeekData(USR_StreamReader_td *stream, uint32_t offset, uint8_t **data, uint32_t *length)
+{
+	if(stream->flags & USR_FLAG_STREAMACCESSDENIED)
+		return BSTREAM_CLOSED;
+	if(stream->flags & USR_FLAG_CRCFAILED)
+		return BSTREAM_CRCERROR;
+
+	USR_ReleaseStreamBuffers(stream, offset);
+
+	*length = 0;
+	bool stalled = (USR_GetAvailable(stream, offset) == 0);
+	USR_RecordStall(stream, stalled);
+	if(stalled)
+		return BSTREAM_OK;
+
+	//Buffers below the offset have been released, so the head holds it
+	BCHAIN_Buffer_td *head = BCHAIN_CHAIN_HEAD(&stream->streamBuffers);
+	*data = &head->data[offset - head->offset];
+	*length = (head->offset + head->length) - offset;
+	return BSTREAM_OK;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
   * @brief	close the stream
@@ -541,48 +1407,156 @@ static BSTREAM_Enum USR_ReceiverStreamClose(struct BSTREAM_Reader_td *stream)
 		return BSTREAM_CLOSED;
 
 	usrStream->flags |= USR_FLAG_STRMCLOSED;
+	USR_ScheduleStream(usrStream);
+
+	//Closed before the whole stream was verified
+	if((usrStream->flags & USR_FLAG_CRCFAILED) || (BSCRC_GetResult(&usrStream->verifier) != BSTREAM_OK))
+		return BSTREAM_CRCERROR;
 	return BSTREAM_OK;
 }
 
 /*----------------------------------------------------------------------------*/
 /**
-  * @brief	Get the high and low offsets of continuous data from multiple data sources
-  * @param	offsetsLo: pointer to the low offsets
-  * @param	offsetsHi: pointer to the high offsets
-  * @param	offsetPairCount: number of hi/lo data pairs are available
-  * @param[out]	offsetLo: pointer to the returned low offset
-  * @param[out]	offsetHi: pointer to the returned high offset
+  * @brief	Move the stream client to an offset, returning the buffers it no
+  * 		longer requires to the receive window and requesting new data
+  * @param	stream: pointer to the stream
+  * @param	offset: offset required by the stream client
   * @retval	None
   */
-static void USR_GetLowAndHiContiguousOffset(uint32_t *offsetsLo, uint32_t *offsetsHi, uint8_t offsetPairCount, uint32_t *offsetLo, uint32_t *offsetHi)
+static void USR_ReleaseStreamBuffers(USR_StreamReader_td *stream, uint32_t offset)
 {
-	//Bubble sort by offsetsLo
-	for(uint8_t pass = 0; pass < (offsetPairCount - 1); pass++)
+	//Nothing to release within the head buffer, or when waiting at the same offset
+	BCHAIN_Buffer_td *head = BCHAIN_CHAIN_HEAD(&stream->streamBuffers);
+	if((head != NULL) ? ((offset >= head->offset) && (offset < (head->offset + head->length))) : (offset == stream->streamOffset))
 	{
-		for(uint8_t i = 0; i < (offsetPairCount - 1 - pass); i++)
-		{
-			if(offsetsLo[i] > offsetsLo[i + 1])
-			{
-				uint32_t val = offsetsLo[i];
-				offsetsLo[i] = offsetsLo[i + 1];
-				offsetsLo[i + 1] = val;
+		stream->streamOffset = offset;
+		return;
+	}
 
-				val = offsetsHi[i];
-				offsetsHi[i] = offsetsHi[i + 1];
-				offsetsHi[i + 1] = val;
-			}
-		}
+	stream->streamOffset = offset;			//Used to know what to request next
+
+	//Release unrequired buffers
+	BCHAIN_Chain_td usedBuffers;
+	BCHAIN_GetChainBuffersApplicableToOffset(&stream->streamBuffers, stream->streamOffset, &usedBuffers);
+	BCHAIN_ResetChain(&usedBuffers, 0);
+	BCHAIN_ChainAddChainTail(&stream->availableBuffers, &usedBuffers);
+	USR_RecordOccupancy(stream);
+
+	//Request data into the freed space, or realign for the new offset
+	USR_RequestUSBData(stream);
+	USR_ScheduleStream(stream);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Amount of contiguous data held for the stream client from offset
+  * @param	stream: pointer to the stream
+  * @param	offset: offset from which to count
+  * @retval	Amount of data available
+  */
+static uint32_t USR_GetAvailable(USR_StreamReader_td *stream, uint32_t offset)
+{
+	BCHAIN_Buffer_td *head = BCHAIN_CHAIN_HEAD(&stream->streamBuffers);
+	if((head == NULL) || (offset < head->offset) || (offset >= stream->streamEnd))
+		return 0;
+	return stream->streamEnd - offset;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Track the stream client waiting for data
+  * @param	stream: pointer to the stream
+  * @param	stalled: true if the client found no data
+  * @retval	None
+  */
+static void USR_RecordStall(USR_StreamReader_td *stream, bool stalled)
+{
+	if(stalled == ((stream->flags & USR_FLAG_STALLED) != 0))
+		return;
+
+	if(stalled)
+	{
+		stream->stats.stalls++;
+		stream->stallStart = usrTime;
+		stream->flags |= USR_FLAG_STALLED;
 	}
+	else
+	{
+		stream->stats.stallTime += usrTime - stream->stallStart;
+		stream->flags &= ~USR_FLAG_STALLED;
+	}
+}
 
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Account the time at the last occupancy and take the new one. Call
+  * 		when buffers are handed to or released by the stream client
+  * @param	stream: pointer to the stream
+  * @retval	None
+  */
+static void USR_RecordOccupancy(USR_StreamReader_td *stream)
+{
+	//Client buffers are contiguous, whole buffers from the head
+	BCHAIN_Buffer_td *head = BCHAIN_CHAIN_HEAD(&stream->streamBuffers);
+	uint32_t held = (head != NULL) ? (((stream->streamEnd - head->offset) + BCHAIN_SIZE - 1) / BCHAIN_SIZE) : 0;
+
+	stream->stats.occupancy[stream->occupancy] += usrTime - stream->occupancyTime;
+	stream->occupancyTime = usrTime;
+	stream->occupancy = (held < USR_BUFFERCOUNT) ? held : USR_BUFFERCOUNT;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Encode a telemetry frame for each stream into the telemetry queue.
+  * 		Frames that do not fit are dropped
+  * @param	None
+  * @retval	None
+  */
+static void USR_SendTelemetry(void)
+{
+	uint8_t data[USR_TELEMETRYLENGTH];
+	USR_Stats_td stats;
 
-	uint32_t lo = offsetsLo[0];
-	uint32_t hi = offsetsHi[0];
-	for(uint8_t i = 1; i < offsetPairCount; i++)
+	for(USR_StreamReader_td *stream = usrBaseStream; stream != NULL; stream = stream->next)
 	{
-		if((offsetsLo[i] <= hi) && (offsetsHi[i] > hi))
-			hi = offsetsHi[i];
+		USR_GetStats(stream, &stats);
+
+		data[0] = USR_TELEMETRYFRAME;
+		data[1] = stream->streamID;
+		USR_PutUint32(&data[2], usrTime);
+		USR_PutUint32(&data[6], stats.bytesDelivered);
+		USR_PutUint32(&data[10], stats.requestsSent);
+		USR_PutUint32(&data[14], stats.requestsRetried);
+		USR_PutUint32(&data[18], stats.requestsTimedOut);
+		USR_PutUint32(&data[22], stats.stalls);
+		USR_PutUint32(&data[26], stats.stallTime);
+		USR_PutUint32(&data[30], stream->flow.throughput);
+		data[34] = (uint8_t)(stream->flow.rto);
+		data[35] = (uint8_t)(stream->flow.rto >> 8);
+		data[36] = stream->flow.depth;
+		data[37] = stream->flow.requestBuffers;
+
+		uint16_t idx = 38;
+		for(uint8_t i = 0; i < USR_RTTBINS; i++, idx += 4)
+			USR_PutUint32(&data[idx], stats.rtt[i]);
+		for(uint8_t i = 0; i <= USR_BUFFERCOUNT; i++, idx += 4)
+			USR_PutUint32(&data[idx], stats.occupancy[i]);
+
+		PKT_Encode(data, USR_TELEMETRYLENGTH, usrTelemetryQueue);
 	}
+}
 
-	*offsetLo = lo;
-	*offsetHi = hi;
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Write a value little endian
+  * @param	data: pointer to the 4 bytes to write
+  * @param	value: value to write
+  * @retval	None
+  */
+static void USR_PutUint32(uint8_t *data, uint32_t value)
+{
+	data[0] = (uint8_t)(value);
+	data[1] = (uint8_t)(value >> 8);
+	data[2] = (uint8_t)(value >> 16);
+	data[3] = (uint8_t)(value >> 24);
 }
@@ -14,11 +14,49 @@
 /* Includes ------------------------------------------------------------------*/
 #include "bStream.h"
 #include "bBufferChaining.h"
+#include "bStreamCRC.h"
+#include "usrFlowControl.h"
+#include "bQueue.h"
 
 /* Exported defines ----------------------------------------------------------*/
 #define USR_BUFFERCOUNT					4
+#define USR_REQUESTCOUNT				USR_BUFFERCOUNT		//Maximum data requests outstanding at once
+#define USR_REQUESTBUFFERS				USR_BUFFERCOUNT		//Maximum buffers covered by a single data request
+#define USR_REQUESTRANGES				4					//Separate ranges received ahead of a hole tracked per request
+#define USR_INFLIGHTLIMIT				4096				//Data requested and not yet received across all streams. Around the link bandwidth delay product
+#define USR_RTTBINS						8					//Round trip time histogram bins, log2 ms: 0-1, 2-3, 4-7 .. 128+
 
 /* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	uint16_t start;						//Relative to the request offset
+	uint16_t end;
+}USR_Range_td;
+
+typedef struct
+{
+	uint32_t offset;					//Offset of the requested data
+	uint16_t length;					//Amount of data requested
+	uint16_t received;					//Amount of data received in order from offset
+	USR_Range_td ranges[USR_REQUESTRANGES];	//Data received beyond the first hole, sorted and disjoint
+	uint8_t rangeCount;
+	uint32_t sentTime;					//Time the request was sent or last received data
+	uint8_t retries;					//Times the request has been re-sent
+	uint8_t active;
+}USR_Request_td;
+
+typedef struct
+{
+	uint32_t bytesDelivered;			//New data received from the host
+	uint32_t requestsSent;				//Data requests sent, including re-sends
+	uint32_t requestsRetried;			//Re-sends of the holes of timed out requests
+	uint32_t requestsTimedOut;
+	uint32_t rtt[USR_RTTBINS];			//Round trip time samples
+	uint32_t stalls;					//Times the stream client found no data
+	uint32_t stallTime;					//Milliseconds the stream client waited for data
+	uint32_t occupancy[USR_BUFFERCOUNT + 1];	//Milliseconds with 0..USR_BUFFERCOUNT buffers held for the stream client
+}USR_Stats_td;
+
 typedef struct USR_StreamReader_td
 {
 	BSTREAM_Reader_td stream;			//Stream interface
@@ -30,26 +68,50 @@ typedef struct USR_StreamReader_td
 	BCHAIN_Chain_td streamBuffers;		//Chain of stream client buffers
 
 	uint32_t streamOffset;				//Offset required by stream client
+	uint32_t streamEnd;					//End of the contiguous data in streamBuffers
+	BSCRC_Verifier_td verifier;			//Verification of the received data against the stream CRC
+
+	USR_Request_td requests[USR_REQUESTCOUNT];	//Outstanding data requests over disjoint ranges
+	uint32_t requestOffset;				//Offset from which data has not yet been requested
+	USRFC_Flow_td flow;					//Request timeout, depth and length adaption
+
+	uint32_t keepAliveTime;				//Time the last keep alive was sent
+	uint32_t usbTime;					//Time the host was last heard from
+	uint32_t deadline;					//Time the stream next needs servicing
 
-	uint32_t requestedOffset;
-	uint16_t requestedLength;
-	uint32_t receivedOffset;
-	uint16_t receivedLength;
+	//SCHEDULING
+	uint8_t weight;						//Share of the bandwidth relative to other streams
+	uint32_t cap;						//Maximum data rate requested (bytes/s). 0 for unlimited
+	uint32_t capTokens;					//Data that may be requested under the cap
+	uint32_t capTime;					//Time the cap tokens were last added
+	int32_t deficit;					//Data this stream may request in the current round
+	uint32_t inFlight;					//Data requested and not yet received
 
-	uint16_t keepAliveTmr;
-	uint16_t reqTimeoutTmr;
-	uint16_t usbTimeoutTmr;
+	//STATISTICS
+	USR_Stats_td stats;
+	uint32_t stallStart;				//Time the stream client last found no data
+	uint32_t occupancyTime;				//Time the occupancy last changed
+	uint8_t occupancy;					//Buffers held for the stream client
 
-	uint8_t flags;				//@ref USR_FLAGs
+	uint16_t flags;				//@ref USR_FLAGs
 
 	struct USR_StreamReader_td *next;
+	struct USR_StreamReader_td *nextReady;
 }USR_StreamReader_td;
 
 /* Exported variables --------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
 void USR_millisecondTick(void);
+uint32_t USR_GetTimeToDeadline(void);
 BSTREAM_Enum USR_Start(USR_StreamReader_td *stream, uint32_t length, uint32_t crc);
 void USR_Cancel(USR_StreamReader_td *stream);
+BSTREAM_Enum USR_Resume(USR_StreamReader_td *stream);
+void USR_SetShare(USR_StreamReader_td *stream, uint8_t weight, uint32_t cap);
+uint32_t USR_GetBandwidth(USR_StreamReader_td *stream);
+void USR_GetStats(USR_StreamReader_td *stream, USR_Stats_td *stats);
+void USR_ResetStats(USR_StreamReader_td *stream);
+void USR_SetTelemetry(QUEUE_Typedef *queue, uint16_t period);
+BSTREAM_Enum USR_PeekData(USR_StreamReader_td *stream, uint32_t offset, uint8_t **data, uint32_t *length);
 void USR_DataReceivedHandler(USR_StreamReader_td *stream, uint32_t offset, uint8_t *data, uint16_t length);
 void USR_AliveHandler(USR_StreamReader_td *stream);
 USR_StreamReader_td* USR_GetStreamByID(uint8_t id);
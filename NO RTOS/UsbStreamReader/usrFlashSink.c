@@ -0,0 +1,259 @@
+/**
+  ******************************************************************************
+  * @file     	usrFlashSink.c
+  * @author		beede
+  * @version	1V0
+  * @date		Aug 9, 2024
+  * @brief		Program a USB stream straight into SPI flash
+  */
+/*
+ * INFORMATION
+ *
+ * 	o The sink is the stream client. Received buffers are taken with
+ * 	  USR_PeekData and page programmed from the stream buffer itself, so data
+ * 	  is copied once, from the USB packet into the buffer
+ * 	o A buffer is recycled to the receive window when the next buffer is
+ * 	  peeked, once it has been programmed
+ * 	o Stream buffers are BCHAIN_SIZE aligned from offset 0 and the stream is
+ * 	  programmed from a sector aligned address, so with BCHAIN_SIZE equal to
+ * 	  the page size each buffer is exactly one page program
+ * 	o Sectors are erased before the write pointer reaches them. While waiting
+ * 	  for data up to USRFS_ERASEAHEAD sectors are erased ahead, so erases
+ * 	  overlap the USB transfer rather than stalling programming
+ * 	o The next flash access is started from the completion of the last, not
+ * 	  from the tick, so the flash is kept busy while data is held
+ * 	o Data is programmed as it arrives. The stream CRC is only known once the
+ * 	  whole stream has been received, the result reports it and the flash
+ * 	  contents must not be used on BSTREAM_CRCERROR
+ * 	o A flash access failing aborts the sink and closes the stream
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usrFlashSink.h"
+#include "stddef.h"
+
+/* Private define ------------------------------------------------------------*/
+/* Private typedef -----------------------------------------------------------*/
+//FLAGS
+enum USRFS_FLAGs
+{
+	USRFS_FLAG_STARTED = 0x01,
+	USRFS_FLAG_PROGRAMMING = 0x02,
+	USRFS_FLAG_ERASING = 0x04,
+	USRFS_FLAG_COMPLETE = 0x08,
+
+	USRFS_FLAG_ACCESSING = (USRFS_FLAG_PROGRAMMING | USRFS_FLAG_ERASING)
+};
+
+/* Private variables ---------------------------------------------------------*/
+static USRFS_Sink_td *usrfsBaseSink;
+
+/* Private function prototypes -----------------------------------------------*/
+static void USRFS_Service(USRFS_Sink_td *sink);
+static void USRFS_Complete(USRFS_Sink_td *sink, BSTREAM_Enum result, BFLASH_ERR flashResult);
+static void USRFS_AccessComplete(BFLASH_Access_td *access, BFLASH_ERR result);
+static void USRFS_DeStackSink(USRFS_Sink_td *sink);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief	Program newly received data, and retry flash accesses refused.
+  * 		Call from the main loop or millisecond tick
+  * @param	None
+  * @retval	None
+  */
+void USRFS_tick(void)
+{
+	USRFS_Sink_td *sink = usrfsBaseSink;
+	while(sink != NULL)
+	{
+		USRFS_Sink_td *next = sink->next;		//Sink is destacked when complete
+		USRFS_Service(sink);
+		sink = next;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Start programming a stream into flash. The stream must have been
+  * 		started and not yet read. The sink opens and closes it
+  * @param	sink: pointer to the sink, zeroed before its first start. Set its
+  * 		completeCallback (or NULL) before starting
+  * @param	device: pointer to the flash to program
+  * @param	source: pointer to the stream to program
+  * @param	address: flash address to program the stream to. Sector aligned
+  * @retval	BFLASH_ERR
+  */
+BFLASH_ERR USRFS_Start(USRFS_Sink_td *sink, BFLASH_Device_td *device, USR_StreamReader_td *source, uint32_t address)
+{
+	if((sink->flags & USRFS_FLAG_STARTED) && !(sink->flags & USRFS_FLAG_COMPLETE))
+		return BFLASH_ERRBUSY;
+
+	BFLASH_Info_td *info = BFLASH_GetInfo(device);
+	uint32_t length = source->stream.length;
+	if(!info->isReady)
+		return BFLASH_ERRNOTSUPPORTED;
+	if((address & (info->sectorSize - 1)) || (address > info->flashSize) || (length > (info->flashSize - address)))
+		return BFLASH_ERRNOTSUPPORTED;
+
+	sink->source = source;
+	sink->device = device;
+	sink->address = address;
+	sink->writeOffset = 0;
+	sink->eraseAddress = address;
+	sink->eraseEnd = address + (((length + info->sectorSize - 1) / info->sectorSize) * info->sectorSize);
+	sink->result = BSTREAM_BUSY;
+	sink->flashResult = BFLASH_ERROK;
+	sink->flags = USRFS_FLAG_STARTED;
+	sink->access.completeCallback = USRFS_AccessComplete;
+
+	//Stack for retries
+	USRFS_DeStackSink(sink);
+	sink->next = usrfsBaseSink;
+	usrfsBaseSink = sink;
+
+	source->stream.open(&source->stream);
+	USRFS_Service(sink);
+	return BFLASH_ERROK;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Check if the sink has finished. See result and flashResult
+  * @param	sink: pointer to the sink
+  * @retval	1 if complete
+  */
+uint8_t USRFS_IsComplete(USRFS_Sink_td *sink)
+{
+	return (sink->flags & USRFS_FLAG_COMPLETE) ? 1 : 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Start the next flash access: program the received buffer if its
+  * 		sector is erased, otherwise erase the next sector
+  * @param	sink: pointer to the sink
+  * @retval	None
+  */
+static void USRFS_Service(USRFS_Sink_td *sink)
+{
+	if(sink->flags & (USRFS_FLAG_ACCESSING | USRFS_FLAG_COMPLETE))
+		return;
+
+	//Whole stream programmed
+	if(sink->writeOffset >= sink->source->stream.length)
+	{
+		USRFS_Complete(sink, BSTREAM_OK, BFLASH_ERROK);
+		return;
+	}
+
+	//Taking the next buffer recycles the one programmed
+	uint8_t *data;
+	uint32_t available;
+	BSTREAM_Enum result = USR_PeekData(sink->source, sink->writeOffset, &data, &available);
+	if(result != BSTREAM_OK)
+	{
+		USRFS_Complete(sink, result, BFLASH_ERROK);
+		return;
+	}
+
+	//Program from the stream buffer
+	uint32_t address = sink->address + sink->writeOffset;
+	if((available > 0) && ((address + available) <= sink->eraseAddress))
+	{
+		sink->access.address = address;
+		sink->access.data = data;
+		sink->access.size = available;
+		if(BFLASH_Write(sink->device, &sink->access) == BFLASH_ERROK)
+			sink->flags |= USRFS_FLAG_PROGRAMMING;
+		return;
+	}
+
+	//Erase the sector the data needs, or ahead of the write pointer while waiting
+	BFLASH_Info_td *info = BFLASH_GetInfo(sink->device);
+	if((sink->eraseAddress < sink->eraseEnd) && (sink->eraseAddress < (address + available + (USRFS_ERASEAHEAD * info->sectorSize))))
+	{
+		sink->access.address = sink->eraseAddress;
+		sink->access.size = info->sectorSize;
+		if(BFLASH_EraseSector(sink->device, &sink->access) == BFLASH_ERROK)
+			sink->flags |= USRFS_FLAG_ERASING;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Finish the sink, closing the stream
+  * @param	sink: pointer to the sink
+  * @param	result: stream result
+  * @param	flashResult: flash result
+  * @retval	None
+  */
+static void USRFS_Complete(USRFS_Sink_td *sink, BSTREAM_Enum result, BFLASH_ERR flashResult)
+{
+	//Close reports the CRC result once the stream has been received
+	BSTREAM_Enum closeResult = sink->source->stream.close(&sink->source->stream);
+	if(result == BSTREAM_OK)
+		result = closeResult;
+	if((result == BSTREAM_OK) && (flashResult != BFLASH_ERROK))
+		result = BSTREAM_CLOSED;
+
+	USRFS_DeStackSink(sink);
+	sink->result = result;
+	sink->flashResult = flashResult;
+	sink->flags |= USRFS_FLAG_COMPLETE;
+
+	if(sink->completeCallback != NULL)
+		sink->completeCallback(sink, result);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Flash access complete. Start the next straight away
+  * @param	access: pointer to the sink access
+  * @param	result: result of the access
+  * @retval	None
+  */
+static void USRFS_AccessComplete(BFLASH_Access_td *access, BFLASH_ERR result)
+{
+	USRFS_Sink_td *sink = (USRFS_Sink_td*)access;
+	uint8_t flags = sink->flags;
+	sink->flags &= ~USRFS_FLAG_ACCESSING;
+
+	if(result != BFLASH_ERROK)
+	{
+		USRFS_Complete(sink, BSTREAM_CLOSED, result);
+		return;
+	}
+
+	if(flags & USRFS_FLAG_ERASING)
+		sink->eraseAddress += access->size;
+	else
+		sink->writeOffset += access->size;
+
+	USRFS_Service(sink);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Remove a sink from the stack
+  * @param	sink: pointer to the sink
+  * @retval	None
+  */
+static void USRFS_DeStackSink(USRFS_Sink_td *sink)
+{
+	USRFS_Sink_td *srch = usrfsBaseSink;
+	USRFS_Sink_td *prev = NULL;
+	while((srch != NULL) && (srch != sink))
+	{
+		prev = srch;
+		srch = srch->next;
+	}
+	if(srch == NULL)	//Not on stack
+		return;
+
+	if(prev == NULL)
+		usrfsBaseSink = srch->next;
+	else
+		prev->next = srch->next;
+	srch->next = NULL;
+}
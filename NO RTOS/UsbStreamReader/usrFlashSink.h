@@ -0,0 +1,51 @@
+/**
+  ******************************************************************************
+  * @file     	usrFlashSink.h
+  * @author		beede
+  * @version	1V0
+  * @date		Aug 9, 2024
+  * @brief		Program a USB stream straight into SPI flash
+  */
+
+
+#ifndef INC_USRFLASHSINK_H_
+#define INC_USRFLASHSINK_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbStreamReader.h"
+#include "bSPIFlash.h"
+
+/* Exported defines ----------------------------------------------------------*/
+#define USRFS_ERASEAHEAD				2			//Sectors erased ahead of the write pointer while waiting for data
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct USRFS_Sink_td
+{
+	BFLASH_Access_td access;			//Flash access in progress. First so the flash callback finds the sink
+
+	//Set by the caller. Zero the sink before its first start
+	void (*completeCallback)(struct USRFS_Sink_td *sink, BSTREAM_Enum result);	//Called once complete. NULL to poll USRFS_IsComplete
+
+	//Set by the sink
+	USR_StreamReader_td *source;		//Stream being programmed
+	BFLASH_Device_td *device;			//Flash programmed
+
+	uint32_t address;					//Flash address of the start of the stream. Sector aligned
+	uint32_t writeOffset;				//Stream offset programmed up to
+	uint32_t eraseAddress;				//Flash erased up to
+	uint32_t eraseEnd;					//End of the flash area to erase
+
+	BSTREAM_Enum result;				//Stream result once complete
+	BFLASH_ERR flashResult;				//Flash result once complete
+	uint8_t flags;						//@ref USRFS_FLAGs
+
+	struct USRFS_Sink_td *next;
+}USRFS_Sink_td;
+
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+void USRFS_tick(void);
+BFLASH_ERR USRFS_Start(USRFS_Sink_td *sink, BFLASH_Device_td *device, USR_StreamReader_td *source, uint32_t address);
+uint8_t USRFS_IsComplete(USRFS_Sink_td *sink);
+
+#endif /* INC_USRFLASHSINK_H_ */
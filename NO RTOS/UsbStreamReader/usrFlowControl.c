@@ -0,0 +1,189 @@
+/**
+  ******************************************************************************
+  * @file     	usrFlowControl.c
+  * @author		beede
+  * @version	1V0
+  * @date		Aug 2, 2024
+  * @brief		Adaptive request sizing and flow control for USB streams
+  */
+/*
+ * INFORMATION
+ *
+ * 	o Retry timeout
+ * 		o Round trip time is sampled from a request being sent to its first
+ * 		  data arriving. Re-sent requests are not sampled as the reply could
+ * 		  belong to either send
+ * 		o rto = srtt + 4 * rttvar (Jacobson/Karels), doubled on every timeout
+ * 		  until the next sample
+ * 	o Window depth (outstanding requests) is AIMD
+ * 		o +1 once a full window of requests completes without a retry
+ * 		o Halved on a timeout
+ * 	o Request length
+ * 		o Delivered throughput is sampled as data arrives, over periods of at
+ * 		  least USRFC_THROUGHPUTPERIOD. Nothing needs ticking
+ * 		o Each request covers its share of the bandwidth delay product
+ * 		  (throughput * srtt / depth), in whole buffers, and is halved on a
+ * 		  timeout
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usrFlowControl.h"
+#include "bBufferChaining.h"
+
+/* Private define ------------------------------------------------------------*/
+/* Private typedef -----------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+static void USRFC_UpdateRequestSize(USRFC_Flow_td *flow);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief	Initialize flow control for a stream
+  * @param	flow: pointer to the flow control
+  * @param	maxDepth: maximum number of outstanding requests
+  * @param	maxRequestBuffers: maximum number of buffers covered by a request
+  * @param	now: current time (ms)
+  * @retval	None
+  */
+void USRFC_Init(USRFC_Flow_td *flow, uint8_t maxDepth, uint8_t maxRequestBuffers, uint32_t now)
+{
+	flow->srtt = 0;
+	flow->rttvar = 0;
+	flow->rto = USRFC_INITIALRTO;
+
+	flow->maxDepth = maxDepth;
+	flow->depth = (USRFC_INITIALDEPTH < maxDepth) ? USRFC_INITIALDEPTH : maxDepth;
+	flow->completed = 0;
+
+	flow->maxRequestBuffers = maxRequestBuffers;
+	flow->requestBuffers = 1;
+
+	flow->throughput = 0;
+	flow->delivered = 0;
+	flow->sampleStart = now;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Add a round trip time sample
+  * @param	flow: pointer to the flow control
+  * @param	rtt: time from the request being sent to its first data (ms)
+  * @retval	None
+  */
+void USRFC_RTTSample(USRFC_Flow_td *flow, uint32_t rtt)
+{
+	if(rtt == 0)
+		rtt = 1;
+	if(rtt > USRFC_MAXRTO)
+		rtt = USRFC_MAXRTO;
+
+	if(flow->srtt == 0)
+	{
+		flow->srtt = (uint16_t)rtt << 3;
+		flow->rttvar = (uint16_t)rtt << 1;
+	}
+	else
+	{
+		int16_t err = (int16_t)rtt - (int16_t)(flow->srtt >> 3);
+		flow->srtt += err;
+		if(err < 0)
+			err = -err;
+		flow->rttvar += err - (flow->rttvar >> 2);
+	}
+
+	uint16_t rto = (flow->srtt >> 3) + flow->rttvar;
+	if(rto < USRFC_MINRTO)
+		rto = USRFC_MINRTO;
+	if(rto > USRFC_MAXRTO)
+		rto = USRFC_MAXRTO;
+	flow->rto = rto;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Account for data delivered from the host
+  * @param	flow: pointer to the flow control
+  * @param	length: amount of data delivered
+  * @param	now: current time (ms)
+  * @retval	None
+  */
+void USRFC_Delivered(USRFC_Flow_td *flow, uint32_t length, uint32_t now)
+{
+	flow->delivered += length;
+
+	uint32_t period = now - flow->sampleStart;
+	if(period < USRFC_THROUGHPUTPERIOD)
+		return;
+
+	uint32_t sample = (flow->delivered * 1000) / period;
+	if(flow->throughput == 0)
+		flow->throughput = sample;
+	else
+		flow->throughput = ((flow->throughput * 3) + sample) / 4;
+	flow->delivered = 0;
+	flow->sampleStart = now;
+
+	USRFC_UpdateRequestSize(flow);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	A request completed without being re-sent. Additive increase
+  * @param	flow: pointer to the flow control
+  * @retval	None
+  */
+void USRFC_RequestComplete(USRFC_Flow_td *flow)
+{
+	flow->completed++;
+	if(flow->completed < flow->depth)
+		return;
+
+	flow->completed = 0;
+	if(flow->depth < flow->maxDepth)
+	{
+		flow->depth++;
+		USRFC_UpdateRequestSize(flow);
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	A request timed out. Back off the retry timeout and multiplicative
+  * 		decrease
+  * @param	flow: pointer to the flow control
+  * @retval	None
+  */
+void USRFC_RequestTimeout(USRFC_Flow_td *flow)
+{
+	flow->rto = ((flow->rto << 1) < USRFC_MAXRTO) ? (flow->rto << 1) : USRFC_MAXRTO;
+
+	flow->completed = 0;
+	flow->depth >>= 1;
+	if(flow->depth == 0)
+		flow->depth = 1;
+	flow->requestBuffers >>= 1;
+	if(flow->requestBuffers == 0)
+		flow->requestBuffers = 1;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Size requests to cover the bandwidth delay product between the
+  * 		outstanding requests
+  * @param	flow: pointer to the flow control
+  * @retval	None
+  */
+static void USRFC_UpdateRequestSize(USRFC_Flow_td *flow)
+{
+	if((flow->srtt == 0) || (flow->throughput == 0))
+		return;
+
+	uint32_t bdp = (flow->throughput * (flow->srtt >> 3)) / 1000;
+	uint32_t buffers = ((bdp / flow->depth) + BCHAIN_SIZE - 1) / BCHAIN_SIZE;
+	if(buffers < 1)
+		buffers = 1;
+	if(buffers > flow->maxRequestBuffers)
+		buffers = flow->maxRequestBuffers;
+	flow->requestBuffers = buffers;
+}
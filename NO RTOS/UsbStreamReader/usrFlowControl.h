@@ -0,0 +1,51 @@
+/**
+  ******************************************************************************
+  * @file     	usrFlowControl.h
+  * @author		beede
+  * @version	1V0
+  * @date		Aug 2, 2024
+  * @brief		Adaptive request sizing and flow control for USB streams
+  */
+
+
+#ifndef INC_USRFLOWCONTROL_H_
+#define INC_USRFLOWCONTROL_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+
+/* Exported defines ----------------------------------------------------------*/
+#define USRFC_INITIALRTO				100			//Retry timeout until the RTT has been measured (ms)
+#define USRFC_MINRTO					10			//ms
+#define USRFC_MAXRTO					250			//ms. Several retries must fit within the USB timeout
+#define USRFC_INITIALDEPTH				2			//Outstanding requests allowed at the start of a stream
+#define USRFC_THROUGHPUTPERIOD			100			//Minimum throughput sample period (ms)
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	uint16_t srtt;						//Smoothed round trip time (ms x8). 0 until measured
+	uint16_t rttvar;					//Round trip time variation (ms x4)
+	uint16_t rto;						//Retry timeout (ms)
+
+	uint8_t depth;						//Outstanding requests allowed
+	uint8_t maxDepth;
+	uint8_t completed;					//Requests completed since the depth last increased
+
+	uint8_t requestBuffers;				//Buffers covered by each request
+	uint8_t maxRequestBuffers;
+
+	uint32_t throughput;				//Delivered data (bytes/s)
+	uint32_t delivered;					//Data delivered this sample period
+	uint32_t sampleStart;				//Time the sample period started (ms)
+}USRFC_Flow_td;
+
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+void USRFC_Init(USRFC_Flow_td *flow, uint8_t maxDepth, uint8_t maxRequestBuffers, uint32_t now);
+void USRFC_RTTSample(USRFC_Flow_td *flow, uint32_t rtt);
+void USRFC_Delivered(USRFC_Flow_td *flow, uint32_t length, uint32_t now);
+void USRFC_RequestComplete(USRFC_Flow_td *flow);
+void USRFC_RequestTimeout(USRFC_Flow_td *flow);
+
+#endif /* INC_USRFLOWCONTROL_H_ */
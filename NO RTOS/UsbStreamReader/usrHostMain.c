@@ -0,0 +1,452 @@
+/**
+  ******************************************************************************
+  * @file     	usrHostMain.c
+  * @author		beede
+  * @version	1V0
+  * @date		Aug 19, 2024
+  * @brief		Host build entry point for checking and profiling the stream
+  * 			readers off target
+  */
+/*
+ * INFORMATION
+ *
+ * 	o Only built for the Linux host build. Link with the UsbStreamReader
+ * 	  sources, bOutbound.c, bPacket.c, bQueue.c and utils.c. usrHostSim.c
+ * 	  takes the place of the USB handler
+ * 	o usrHost <command>. Returns 0 if every check of the command passed
+ * 		o crc: stream CRC verifier. In order, out of order and repeated data,
+ * 		  more gaps than BSCRC_PENDINGCOUNT, closing unverified streams, and
+ * 		  a USB stream client seeking forward more than BSCRC_PENDINGCOUNT
+ * 		  times
+ * 		o cache: block cache. Random reads through caches of 1 to 512 blocks
+ * 		  return the source data, and the time per read is printed for
+ * 		  each cache size
+ * 		o prefetch: read-ahead wrapper. Random all-or-nothing reads larger
+ * 		  than the random read-ahead, and reads larger than the window
+ * 		o sweep: transfers a stream over each link configuration in
+ * 		  usrhostLinks with USRSIM_Run and prints the goodput, stall time,
+ * 		  retries and link effects of each. Fails if a transfer fails
+ * 		o streams: starts 1 to 255 concurrent streams and prints the time to
+ * 		  start a stream (USR_Start, including the ID allocation) and to
+ * 		  route a packet to its stream (USR_GetStreamByID) at each count.
+ * 		  Fails if a lookup returns the wrong stream, or if the IDs do not
+ * 		  run out at 256 streams
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usrHostSim.h"
+#if defined(__linux__)
+#include "bStreamCRC.h"
+#include "bStreamCache.h"
+#include "bStreamMem.h"
+#include "bStreamPrefetch.h"
+#include "utils.h"
+#include "stdio.h"
+#include "stdbool.h"
+#include "string.h"
+#include "time.h"
+
+/* Private define ------------------------------------------------------------*/
+#define USRHOST_DATASIZE					200000
+#define USRHOST_CRCCHUNK					100
+#define USRHOST_SEEKS						(BSCRC_PENDINGCOUNT + 5)
+#define USRHOST_SEEKSTEP					5000
+#define USRHOST_STREAMCOUNT					255			//Stream IDs are a byte
+#define USRHOST_LOOKUPS						1000000
+#define USRHOST_CACHEBLOCKS					512
+#define USRHOST_CACHEREADS					200000
+#define USRHOST_PREFETCHWINDOW				256
+#define USRHOST_PREFETCHREAD				128			//Larger than BSPF_RANDOMREADAHEAD
+
+#define USRHOST_CHECK(CONDITION)			USRHOST_Check((CONDITION), #CONDITION, __LINE__)
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+	const char *name;
+	bool (*run)(void);
+}USRHOST_Command_td;
+
+typedef struct
+{
+	const char *name;
+	USRSIM_Config_td config;
+}USRHOST_Link_td;
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t usrhostData[USRHOST_DATASIZE];
+static uint32_t usrhostFailures;
+
+//Link configurations swept
+static const USRHOST_Link_td usrhostLinks[] =
+{
+	{"ideal",		{.latency = 1, .bandwidth = 1000, .packetSize = 64, .seed = 1, .timeLimit = 60000}},
+	{"latency 20",	{.latency = 20, .bandwidth = 1000, .packetSize = 64, .seed = 1, .timeLimit = 60000}},
+	{"slow",		{.latency = 5, .bandwidth = 100, .packetSize = 64, .seed = 1, .timeLimit = 60000}},
+	{"loss 1%",		{.latency = 5, .bandwidth = 1000, .packetSize = 64, .loss = 10, .seed = 2, .timeLimit = 60000}},
+	{"loss 5%",		{.latency = 5, .bandwidth = 200, .packetSize = 64, .loss = 50, .seed = 2, .timeLimit = 60000}},
+	{"reorder",		{.latency = 20, .bandwidth = 500, .packetSize = 64, .reorder = 100, .reorderDelay = 10, .seed = 3, .timeLimit = 60000}},
+	{"duplicate",	{.latency = 5, .bandwidth = 500, .packetSize = 64, .duplicate = 50, .seed = 3, .timeLimit = 60000}},
+	{"send fail",	{.latency = 5, .bandwidth = 1000, .packetSize = 64, .sendFail = 50, .seed = 4, .timeLimit = 60000}},
+	{"uplink",		{.latency = 5, .bandwidth = 1000, .uplink = 32, .packetSize = 64, .seed = 4, .timeLimit = 60000}},
+	{"consumer",	{.latency = 5, .bandwidth = 1000, .packetSize = 64, .consumeRate = 100, .seed = 4, .timeLimit = 60000}},
+	{"worst",		{.latency = 20, .bandwidth = 200, .packetSize = 64, .loss = 20, .reorder = 50, .reorderDelay = 10, .duplicate = 20, .sendFail = 20, .seed = 5, .timeLimit = 60000}},
+};
+
+/* Private function prototypes -----------------------------------------------*/
+static bool USRHOST_CheckCRC(void);
+static bool USRHOST_CheckCache(void);
+static bool USRHOST_CheckPrefetch(void);
+static bool USRHOST_Sweep(void);
+static bool USRHOST_Streams(void);
+static uint64_t USRHOST_GetNanoseconds(void);
+static void USRHOST_Check(bool condition, const char *text, uint32_t line);
+
+static const USRHOST_Command_td usrhostCommands[] =
+{
+	{"crc", USRHOST_CheckCRC},
+	{"cache", USRHOST_CheckCache},
+	{"prefetch", USRHOST_CheckPrefetch},
+	{"sweep", USRHOST_Sweep},
+	{"streams", USRHOST_Streams},
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief	Run a command
+  * @param	argc: argument count
+  * @param	argv: arguments, the command first
+  * @retval	0 if the command passed
+  */
+int main(int argc, char **argv)
+{
+	uint32_t seed = 1;
+	for(uint32_t i = 0; i < USRHOST_DATASIZE; i++)
+	{
+		seed = (seed * 1103515245) + 12345;
+		usrhostData[i] = (uint8_t)(seed >> 16);
+	}
+
+	for(uint8_t i = 0; (argc > 1) && (i < (sizeof(usrhostCommands) / sizeof(usrhostCommands[0]))); i++)
+	{
+		if(strcmp(argv[1], usrhostCommands[i].name) != 0)
+			continue;
+		bool passed = usrhostCommands[i].run();
+		printf("%s: %s\n", usrhostCommands[i].name, passed ? "PASS" : "FAIL");
+		return passed ? 0 : 1;
+	}
+
+	printf("usage: usrHost <command>\n");
+	for(uint8_t i = 0; i < (sizeof(usrhostCommands) / sizeof(usrhostCommands[0])); i++)
+		printf("\t%s\n", usrhostCommands[i].name);
+	return 2;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Check the stream CRC verifier
+  * @param	None
+  * @retval	true if every check passed
+  */
+static bool USRHOST_CheckCRC(void)
+{
+	usrhostFailures = 0;
+	uint32_t crc = crc32_calculateData(0, usrhostData, 0, USRHOST_DATASIZE);
+	BSCRC_Verifier_td verifier;
+
+	//In order
+	BSCRC_Init(&verifier, USRHOST_DATASIZE, crc);
+	for(uint32_t offset = 0; offset < USRHOST_DATASIZE; offset += USRHOST_CRCCHUNK)
+		BSCRC_Update(&verifier, offset, &usrhostData[offset], USRHOST_CRCCHUNK);
+	USRHOST_CHECK(BSCRC_GetResult(&verifier) == BSTREAM_OK);
+
+	//Wrong CRC
+	BSCRC_Init(&verifier, USRHOST_DATASIZE, crc ^ 1);
+	BSCRC_Update(&verifier, 0, usrhostData, USRHOST_DATASIZE);
+	USRHOST_CHECK(BSCRC_GetResult(&verifier) == BSTREAM_CRCERROR);
+
+	//Odd chunks then even chunks, with the odd chunks repeated. Holds BSCRC_PENDINGCOUNT gaps
+	uint32_t length = USRHOST_CRCCHUNK * BSCRC_PENDINGCOUNT * 2;
+	uint32_t partCRC = crc32_calculateData(0, usrhostData, 0, length);
+	BSCRC_Init(&verifier, length, partCRC);
+	for(uint8_t pass = 0; pass < 2; pass++)
+	{
+		for(uint32_t offset = USRHOST_CRCCHUNK; offset < length; offset += USRHOST_CRCCHUNK * 2)
+			BSCRC_Update(&verifier, offset, &usrhostData[offset], USRHOST_CRCCHUNK);
+	}
+	USRHOST_CHECK(BSCRC_GetResult(&verifier) == BSTREAM_NOTENOUGHDATA);
+	for(uint32_t offset = 0; offset < length; offset += USRHOST_CRCCHUNK * 2)
+		BSCRC_Update(&verifier, offset, &usrhostData[offset], USRHOST_CRCCHUNK);
+	USRHOST_CHECK(BSCRC_GetResult(&verifier) == BSTREAM_OK);
+
+	//One gap more than can be held. Unverified, not a mismatch, until the dropped segment is delivered again
+	length += USRHOST_CRCCHUNK * 2;
+	partCRC = crc32_calculateData(0, usrhostData, 0, length);
+	BSCRC_Init(&verifier, length, partCRC);
+	for(uint32_t offset = USRHOST_CRCCHUNK; offset < length; offset += USRHOST_CRCCHUNK * 2)
+		BSCRC_Update(&verifier, offset, &usrhostData[offset], USRHOST_CRCCHUNK);
+	for(uint32_t offset = 0; offset < (length - (USRHOST_CRCCHUNK * 2)); offset += USRHOST_CRCCHUNK * 2)
+		BSCRC_Update(&verifier, offset, &usrhostData[offset], USRHOST_CRCCHUNK);
+	USRHOST_CHECK(BSCRC_GetResult(&verifier) == BSTREAM_NOTENOUGHDATA);
+	for(uint32_t offset = 0; offset < length; offset += USRHOST_CRCCHUNK)
+		BSCRC_Update(&verifier, offset, &usrhostData[offset], USRHOST_CRCCHUNK);
+	USRHOST_CHECK(BSCRC_GetResult(&verifier) == BSTREAM_OK);
+
+	//More gaps than can be held with a wrong CRC. Only a mismatch once all of it is delivered
+	BSCRC_Init(&verifier, length, partCRC ^ 1);
+	for(uint32_t offset = USRHOST_CRCCHUNK; offset < length; offset += USRHOST_CRCCHUNK * 2)
+		BSCRC_Update(&verifier, offset, &usrhostData[offset], USRHOST_CRCCHUNK);
+	USRHOST_CHECK(BSCRC_GetResult(&verifier) == BSTREAM_NOTENOUGHDATA);
+	BSCRC_Update(&verifier, 0, usrhostData, length);
+	USRHOST_CHECK(BSCRC_GetResult(&verifier) == BSTREAM_CRCERROR);
+
+	//Verifying reader closed before the end of the stream
+	BSMEM_Reader_td memory = {0};
+	BSCRC_Reader_td reader;
+	uint8_t buffer[USRHOST_CRCCHUNK];
+	USRHOST_CHECK(BSMEM_StartRAM(&memory, usrhostData, USRHOST_DATASIZE, crc) == BSTREAM_OK);
+	BSCRC_Start(&reader, &memory.stream);
+	reader.stream.open(&reader.stream);
+	reader.stream.readData(&reader.stream, 0, buffer, sizeof(buffer), NULL);
+	USRHOST_CHECK(reader.stream.close(&reader.stream) == BSTREAM_CRCERROR);
+
+	//Verifying reader read to the end
+	USRHOST_CHECK(BSMEM_StartRAM(&memory, usrhostData, USRHOST_DATASIZE, crc) == BSTREAM_OK);
+	BSCRC_Start(&reader, &memory.stream);
+	reader.stream.open(&reader.stream);
+	for(uint32_t offset = 0; offset < USRHOST_DATASIZE; offset += sizeof(buffer))
+		reader.stream.readData(&reader.stream, offset, buffer, sizeof(buffer), NULL);
+	USRHOST_CHECK(reader.stream.close(&reader.stream) == BSTREAM_OK);
+
+	//USB stream closed by the client before the whole stream was received
+	static USR_StreamReader_td streams[3];
+	USR_StreamReader_td *stream = &streams[0];
+	USRSIM_Config_td config = {.latency = 5, .bandwidth = 100, .packetSize = 64, .seed = 1};
+	USRSIM_Init(&config, NULL);
+	USRSIM_Serve(stream, usrhostData);
+	USR_Start(stream, USRHOST_DATASIZE, crc);
+	stream->stream.open(&stream->stream);
+	for(uint8_t i = 0; i < 20; i++)
+		USRSIM_millisecondTick();
+	USRHOST_CHECK(stream->stream.close(&stream->stream) == BSTREAM_CRCERROR);
+
+	//USB stream client seeking forward more than BSCRC_PENDINGCOUNT times. Clean data is never a CRC error, close reports it unverified
+	stream = &streams[1];
+	USRSIM_Init(&config, NULL);
+	USRSIM_Serve(stream, usrhostData);
+	USR_Start(stream, USRHOST_DATASIZE, crc);
+	stream->stream.open(&stream->stream);
+	for(uint32_t seek = 1; seek <= USRHOST_SEEKS; seek++)
+	{
+		uint32_t offset = seek * USRHOST_SEEKSTEP;
+		BSTREAM_Enum result = BSTREAM_NOTENOUGHDATA;
+		for(uint16_t tick = 0; (tick < 1000) && (result == BSTREAM_NOTENOUGHDATA); tick++)
+		{
+			result = stream->stream.readData(&stream->stream, offset, buffer, sizeof(buffer), NULL);
+			USRSIM_millisecondTick();
+		}
+		USRHOST_CHECK(result == BSTREAM_OK);
+		USRHOST_CHECK(memcmp(buffer, &usrhostData[offset], sizeof(buffer)) == 0);
+	}
+	USRHOST_CHECK(stream->stream.close(&stream->stream) == BSTREAM_CRCERROR);
+
+	//USB stream received in full
+	USRSIM_Stats_td stats;
+	stream = &streams[2];
+	config.timeLimit = 10000;
+	USRHOST_CHECK(USRSIM_Run(&config, stream, usrhostData, USRHOST_DATASIZE, &stats) == BSTREAM_OK);
+
+	return (usrhostFailures == 0);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Check the block cache and time reads at each cache size
+  * @param	None
+  * @retval	true if every read returned the source data
+  */
+static bool USRHOST_CheckCache(void)
+{
+	static BSCACHE_Block_td blocks[USRHOST_CACHEBLOCKS];
+	static const uint16_t counts[] = {1, 4, 16, 64, 256, USRHOST_CACHEBLOCKS};
+	uint8_t buffer[USRHOST_CRCCHUNK];
+	usrhostFailures = 0;
+
+	printf("%8s %10s %10s %10s\n", "blocks", "hits", "misses", "read (ns)");
+	for(uint8_t i = 0; i < (sizeof(counts) / sizeof(counts[0])); i++)
+	{
+		BSMEM_Reader_td memory = {0};
+		BSCACHE_Reader_td reader = {0};
+		USRHOST_CHECK(BSMEM_StartRAM(&memory, usrhostData, USRHOST_DATASIZE, 0) == BSTREAM_OK);
+		USRHOST_CHECK(BSCACHE_Start(&reader, &memory.stream, blocks, counts[i]) == BSTREAM_OK);
+		USRHOST_CHECK(reader.stream.open(&reader.stream) == BSTREAM_OK);
+
+		//Reads over a region that fits the largest cache
+		uint32_t seed = 1;
+		uint32_t mismatches = 0;
+		uint64_t start = USRHOST_GetNanoseconds();
+		for(uint32_t read = 0; read < USRHOST_CACHEREADS; read++)
+		{
+			seed = (seed * 1103515245) + 12345;
+			uint32_t offset = (seed >> 8) % ((USRHOST_CACHEBLOCKS * BSCACHE_BLOCKSIZE) - sizeof(buffer));
+			if((reader.stream.readData(&reader.stream, offset, buffer, sizeof(buffer), NULL) != BSTREAM_OK) ||
+					(memcmp(buffer, &usrhostData[offset], sizeof(buffer)) != 0))
+				mismatches++;
+		}
+		uint64_t readTime = (USRHOST_GetNanoseconds() - start) / USRHOST_CACHEREADS;
+		USRHOST_CHECK(mismatches == 0);
+
+		BSCACHE_Stats_td stats;
+		BSCACHE_GetStats(&reader, &stats);
+		printf("%8u %10u %10u %10u\n", (unsigned)counts[i], (unsigned)stats.hits, (unsigned)stats.misses, (unsigned)readTime);
+		USRHOST_CHECK(reader.stream.close(&reader.stream) == BSTREAM_OK);
+	}
+	return (usrhostFailures == 0);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Check the read-ahead wrapper
+  * @param	None
+  * @retval	true if every check passed
+  */
+static bool USRHOST_CheckPrefetch(void)
+{
+	static uint8_t window[USRHOST_PREFETCHWINDOW];
+	uint8_t buffer[USRHOST_PREFETCHWINDOW * 2];
+	BSMEM_Reader_td memory = {0};
+	BSPF_Reader_td reader = {0};
+	usrhostFailures = 0;
+
+	USRHOST_CHECK(BSMEM_StartRAM(&memory, usrhostData, USRHOST_DATASIZE, 0) == BSTREAM_OK);
+	USRHOST_CHECK(BSPF_Start(&reader, &memory.stream, window, sizeof(window), sizeof(window)) == BSTREAM_OK);
+	USRHOST_CHECK(reader.stream.open(&reader.stream) == BSTREAM_OK);
+
+	//Random all-or-nothing reads larger than the random read-ahead
+	uint32_t offset = 1000;
+	for(uint8_t i = 0; i < 50; i++)
+	{
+		offset = (offset * 7919) % (USRHOST_DATASIZE - USRHOST_PREFETCHREAD);
+		USRHOST_CHECK(reader.stream.readData(&reader.stream, offset, buffer, USRHOST_PREFETCHREAD, NULL) == BSTREAM_OK);
+		USRHOST_CHECK(memcmp(buffer, &usrhostData[offset], USRHOST_PREFETCHREAD) == 0);
+	}
+
+	//All-or-nothing read of the whole window, then one larger than the window
+	USRHOST_CHECK(reader.stream.readData(&reader.stream, 5000, buffer, sizeof(window), NULL) == BSTREAM_OK);
+	USRHOST_CHECK(memcmp(buffer, &usrhostData[5000], sizeof(window)) == 0);
+	USRHOST_CHECK(reader.stream.readData(&reader.stream, 9000, buffer, sizeof(window) + 1, NULL) == BSTREAM_NOTENOUGHSPACE);
+
+	//Partial read larger than the window returns what the window holds
+	uint32_t actual = 0;
+	USRHOST_CHECK(reader.stream.readData(&reader.stream, 9000, buffer, sizeof(buffer), &actual) == BSTREAM_OK);
+	USRHOST_CHECK((actual > 0) && (actual <= sizeof(window)));
+	USRHOST_CHECK(memcmp(buffer, &usrhostData[9000], actual) == 0);
+
+	USRHOST_CHECK(reader.stream.close(&reader.stream) == BSTREAM_OK);
+	return (usrhostFailures == 0);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Transfer a stream over each link configuration and report
+  * @param	None
+  * @retval	true if every transfer completed with the correct data
+  */
+static bool USRHOST_Sweep(void)
+{
+	static USR_StreamReader_td streams[sizeof(usrhostLinks) / sizeof(usrhostLinks[0])];
+	uint32_t failures = 0;
+
+	printf("%-12s %6s %7s %8s %6s %8s %8s %6s %6s %6s %6s\n", "link", "result", "time", "goodput", "stall", "retries", "retried", "lost", "reord", "dup", "refuse");
+	for(uint8_t i = 0; i < (sizeof(usrhostLinks) / sizeof(usrhostLinks[0])); i++)
+	{
+		USRSIM_Stats_td stats;
+		BSTREAM_Enum result = USRSIM_Run(&usrhostLinks[i].config, &streams[i], usrhostData, USRHOST_DATASIZE, &stats);
+		if((result != BSTREAM_OK) || (stats.mismatches != 0))
+			failures++;
+
+		printf("%-12s %6u %7u %8u %6u %8u %8u %6u %6u %6u %6u\n", usrhostLinks[i].name, (unsigned)result, (unsigned)stats.time,
+				(unsigned)stats.goodput, (unsigned)stats.stallTime, (unsigned)stats.retries, (unsigned)stats.retriedBytes,
+				(unsigned)stats.lost, (unsigned)stats.reordered, (unsigned)stats.duplicated, (unsigned)stats.sendFails);
+	}
+
+	return (failures == 0);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Time stream ID allocation and lookup with 1 to 255 streams
+  * @param	None
+  * @retval	true if every lookup found its stream and the IDs ran out at 256
+  */
+static bool USRHOST_Streams(void)
+{
+	static USR_StreamReader_td streams[USRHOST_STREAMCOUNT + 2];
+	static const uint16_t counts[] = {1, 2, 4, 8, 16, 32, 64, 128, 192, USRHOST_STREAMCOUNT};
+	usrhostFailures = 0;
+
+	USRSIM_Config_td config = {.latency = 1, .bandwidth = 1000, .packetSize = 64, .seed = 1};
+	USRSIM_Init(&config, NULL);
+
+	printf("%8s %12s %12s\n", "streams", "start (ns)", "lookup (ns)");
+	uint16_t started = 0;
+	for(uint8_t i = 0; i < (sizeof(counts) / sizeof(counts[0])); i++)
+	{
+		//Allocate the IDs up to the count
+		uint64_t start = USRHOST_GetNanoseconds();
+		uint16_t added = counts[i] - started;
+		for(; started < counts[i]; started++)
+			USRHOST_CHECK(USR_Start(&streams[started], USRHOST_DATASIZE, 0) == BSTREAM_OK);
+		uint64_t startTime = (USRHOST_GetNanoseconds() - start) / added;
+
+		//Route packets across the streams
+		volatile uintptr_t found = 0;
+		start = USRHOST_GetNanoseconds();
+		for(uint32_t lookup = 0; lookup < USRHOST_LOOKUPS; lookup++)
+			found += (uintptr_t)USR_GetStreamByID(streams[lookup % started].streamID);
+		uint64_t lookupTime = ((USRHOST_GetNanoseconds() - start) * 1000) / USRHOST_LOOKUPS;
+
+		for(uint16_t stream = 0; stream < started; stream++)
+			USRHOST_CHECK(USR_GetStreamByID(streams[stream].streamID) == &streams[stream]);
+
+		printf("%8u %12u %12.2f\n", (unsigned)started, (unsigned)startTime, (double)lookupTime / 1000);
+	}
+
+	//One ID left. Further streams are refused
+	USRHOST_CHECK(USR_Start(&streams[USRHOST_STREAMCOUNT], USRHOST_DATASIZE, 0) == BSTREAM_OK);
+	USRHOST_CHECK(USR_Start(&streams[USRHOST_STREAMCOUNT + 1], USRHOST_DATASIZE, 0) == BSTREAM_BUSY);
+
+	return (usrhostFailures == 0);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Host monotonic time
+  * @param	None
+  * @retval	Nanoseconds
+  */
+static uint64_t USRHOST_GetNanoseconds(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return ((uint64_t)time.tv_sec * 1000000000) + time.tv_nsec;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Record a check
+  * @param	condition: result of the check
+  * @param	text: the check
+  * @param	line: source line of the check
+  * @retval	None
+  */
+static void USRHOST_Check(bool condition, const char *text, uint32_t line)
+{
+	if(condition)
+		return;
+	usrhostFailures++;
+	printf("\tline %u: %s\n", (unsigned)line, text);
+}
+
+#endif
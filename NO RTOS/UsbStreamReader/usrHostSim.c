@@ -0,0 +1,556 @@
+/**
+  ******************************************************************************
+  * @file     	usrHostSim.c
+  * @author		beede
+  * @version	1V0
+  * @date		Aug 12, 2024
+  * @brief		Simulated USB stream host for profiling the USB stream reader
+  * 			off target
+  */
+/*
+ * INFORMATION
+ *
+ * 	o Only built for the Linux host build. Provides USBHND_sendPacket in place
+ * 	  of the USB handler, so usbStreamReader.c runs unmodified against a
+ * 	  simulated host server
+ * 	o Device transfers are decoded as the stream of bPacket frames sent by
+ * 	  the outbound scheduler (bOutbound.c)
+ * 	o USRSIM_millisecondTick is the time base. It ticks the stream reader
+ * 	  and outbound scheduler, then the host, then delivers the packets due,
+ * 	  all in virtual time
+ * 	o HOST
+ * 		o Serves data requests in the order received, "latency" ms after they
+ * 		  were sent, as packets of up to packetSize at "bandwidth" bytes per ms
+ * 		o Answers alive with alive, drops the queued requests of closed streams
+ * 		o Serves the data registered with USRSIM_Serve for a stream
+ * 	o LINK (all per 1000 packets, from a seeded generator so runs repeat)
+ * 		o loss: packet dropped. It still used the bandwidth
+ * 		o reorder: packet held back 1 to reorderDelay ms, so later packets
+ * 		  overtake it
+ * 		o duplicate: packet delivered twice
+ * 		o sendFail: USBHND_sendPacket refuses the transfer, as when the USB
+ * 		  endpoint is busy
+ * 		o uplink: device transfers are refused once "uplink" bytes have been
+ * 		  sent in the millisecond
+ * 	o USRSIM_Run starts a stream, reads it through the stream interface at
+ * 	  consumeRate and reports
+ * 		o goodput, time and the ms the consumer found no data (stallTime)
+ * 		o retries, requests for data already requested. Assumes the consumer
+ * 		  reads in order, a seek back also counts
+ * 		o host packet counts and link effects applied
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usrHostSim.h"
+#if defined(__linux__)
+#include "usbPacketIDs.h"
+#include "usbHandler.h"
+#include "bOutbound.h"
+#include "bPacket.h"
+#include "utils.h"
+#include "string.h"
+#include "stdbool.h"
+
+/* Private define ------------------------------------------------------------*/
+#define USRSIM_IDCOUNT						256
+#define USRSIM_STREAMCOUNT					16			//Streams served at once
+#define USRSIM_RECEIVESIZE					2048		//Device transfers being decoded. Power of 2
+
+/* Private typedef -----------------------------------------------------------*/
+//PACKETS
+enum USRSIM_PACKETs
+{
+	USRSIM_PACKET_DATA = 0,
+	USRSIM_PACKET_ALIVE,
+};
+
+typedef struct
+{
+	uint8_t id;
+	uint32_t offset;
+	uint16_t length;					//Left to serve. 0 once served or dropped
+	uint32_t time;						//Time the host serves the request
+}USRSIM_Request_td;
+
+typedef struct
+{
+	uint8_t type;						//@ref USRSIM_PACKETs
+	uint8_t id;
+	uint32_t offset;
+	uint16_t length;
+	uint32_t time;						//Time the packet arrives at the device
+}USRSIM_Packet_td;
+
+typedef struct
+{
+	USR_StreamReader_td *stream;
+	uint8_t *data;
+}USRSIM_Stream_td;
+
+/* Private variables ---------------------------------------------------------*/
+static USRSIM_Config_td usrsimConfig;
+static USRSIM_Stats_td *usrsimStats;
+static USRSIM_Stats_td usrsimDiscard;	//Stats when none are given
+
+static USRSIM_Stream_td usrsimStreams[USRSIM_STREAMCOUNT];
+static uint32_t usrsimRequested[USRSIM_IDCOUNT];		//End of the data requested per stream ID
+
+static USRSIM_Request_td usrsimRequests[USRSIM_REQUESTCOUNT];
+static uint8_t usrsimRequestHead;
+static uint8_t usrsimRequestCount;
+
+static USRSIM_Packet_td usrsimPackets[USRSIM_PACKETCOUNT];
+static uint16_t usrsimPacketCount;
+
+static uint8_t usrsimReceiveBuffer[USRSIM_RECEIVESIZE];
+static QUEUE_Typedef usrsimReceive = {usrsimReceiveBuffer, USRSIM_RECEIVESIZE, 0, 0};
+
+static uint32_t usrsimTime;
+static uint32_t usrsimCredit;			//Bytes the host may send
+static uint32_t usrsimUplinkCredit;		//Bytes the device may send
+static uint32_t usrsimRandom;
+
+/* Private function prototypes -----------------------------------------------*/
+static void USRSIM_HandlePacket(uint8_t *data, uint16_t length);
+static void USRSIM_ServeRequests(void);
+static void USRSIM_DeliverPackets(void);
+static void USRSIM_SendPacket(uint8_t type, uint8_t id, uint32_t offset, uint16_t length);
+static void USRSIM_AddPacket(uint8_t type, uint8_t id, uint32_t offset, uint16_t length, uint32_t time);
+static uint8_t *USRSIM_GetData(USR_StreamReader_td *stream);
+static bool USRSIM_Chance(uint16_t perMille);
+static uint32_t USRSIM_Random(void);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief	Reset the simulated host and link
+  * @param	config: pointer to the link configuration
+  * @param	stats: pointer to the statistics to update. May be NULL
+  * @retval	None
+  */
+void USRSIM_Init(const USRSIM_Config_td *config, USRSIM_Stats_td *stats)
+{
+	usrsimConfig = *config;
+	if(usrsimConfig.packetSize == 0)
+		usrsimConfig.packetSize = 64;
+	usrsimStats = (stats != NULL) ? stats : &usrsimDiscard;
+	memset(usrsimStats, 0, sizeof(USRSIM_Stats_td));
+
+	memset(usrsimStreams, 0, sizeof(usrsimStreams));
+	memset(usrsimRequested, 0, sizeof(usrsimRequested));
+	usrsimRequestHead = 0;
+	usrsimRequestCount = 0;
+	usrsimPacketCount = 0;
+	QUEUE_Initialize(&usrsimReceive, usrsimReceiveBuffer, USRSIM_RECEIVESIZE);
+	usrsimCredit = 0;
+	usrsimUplinkCredit = config->uplink;
+	usrsimRandom = (config->seed != 0) ? config->seed : 1;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Serve data for a stream. Its requests are answered from data
+  * @param	stream: pointer to the stream
+  * @param	data: pointer to the stream data, stream length long
+  * @retval	None
+  */
+void USRSIM_Serve(USR_StreamReader_td *stream, uint8_t *data)
+{
+	USRSIM_Stream_td *slot = NULL;
+	for(uint8_t i = 0; i < USRSIM_STREAMCOUNT; i++)
+	{
+		if(usrsimStreams[i].stream == stream)
+		{
+			usrsimStreams[i].data = data;
+			return;
+		}
+		if((slot == NULL) && (usrsimStreams[i].stream == NULL))
+			slot = &usrsimStreams[i];
+	}
+
+	if(slot != NULL)
+	{
+		slot->stream = stream;
+		slot->data = data;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Advance virtual time by a millisecond
+  * @param	None
+  * @retval	None
+  */
+void USRSIM_millisecondTick(void)
+{
+	usrsimTime++;
+	usrsimUplinkCredit = usrsimConfig.uplink;
+	USR_millisecondTick();
+	BOUT_millisecondTick();
+	USRSIM_ServeRequests();
+	USRSIM_DeliverPackets();
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Get the virtual time
+  * @param	None
+  * @retval	Milliseconds
+  */
+uint32_t USRSIM_GetTime(void)
+{
+	return usrsimTime;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Transfer a stream over the simulated link and report
+  * @param	config: pointer to the link and consumer configuration
+  * @param	stream: pointer to the stream reader to use
+  * @param	data: pointer to the data to transfer
+  * @param	length: amount of data to transfer
+  * @param[out]	stats: pointer to the statistics. May be NULL
+  * @retval	BSTREAM_Enum, result of the transfer
+  */
+BSTREAM_Enum USRSIM_Run(const USRSIM_Config_td *config, USR_StreamReader_td *stream, uint8_t *data, uint32_t length, USRSIM_Stats_td *stats)
+{
+	USRSIM_Init(config, stats);
+	stats = usrsimStats;
+	USRSIM_Serve(stream, data);
+
+	BSTREAM_Enum result = USR_Start(stream, length, crc32_calculateData(0, data, 0, length));
+	if(result != BSTREAM_OK)
+		return result;
+	stream->stream.open(&stream->stream);
+
+	uint32_t start = usrsimTime;
+	uint32_t offset = 0;
+	uint8_t buffer[256];
+	while((offset < length) && (result == BSTREAM_OK))
+	{
+		if((config->timeLimit != 0) && ((usrsimTime - start) >= config->timeLimit))
+		{
+			result = BSTREAM_BUSY;
+			break;
+		}
+		USRSIM_millisecondTick();
+
+		//Consume up to the rate
+		uint32_t budget = (config->consumeRate != 0) ? config->consumeRate : length;
+		bool consumed = false;
+		while((budget > 0) && (offset < length))
+		{
+			uint32_t actual = 0;
+			uint32_t request = (budget < sizeof(buffer)) ? budget : sizeof(buffer);
+			result = stream->stream.readData(&stream->stream, offset, buffer, request, &actual);
+			if(result != BSTREAM_OK)
+				break;
+			if(actual == 0)
+			{
+				if(!consumed)
+					stats->stallTime++;
+				break;
+			}
+			consumed = true;
+			if(memcmp(buffer, &data[offset], actual) != 0)
+				stats->mismatches++;
+			offset += actual;
+			budget -= actual;
+		}
+	}
+
+	BSTREAM_Enum closeResult = stream->stream.close(&stream->stream);
+	if(result == BSTREAM_OK)
+		result = closeResult;
+
+	stats->time = usrsimTime - start;
+	stats->goodput = (stats->time > 0) ? (uint32_t)(((uint64_t)offset * 1000) / stats->time) : 0;
+	stats->result = result;
+	return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Device transfer to the host. Replaces the USB handler
+  * @param	data: pointer to the transfer
+  * @param	length: length of the transfer
+  * @retval	false if refused
+  */
+bool USBHND_sendPacket(uint8_t *data, uint16_t length)
+{
+	if(USRSIM_Chance(usrsimConfig.sendFail))
+	{
+		usrsimStats->sendFails++;
+		return false;
+	}
+	if(usrsimConfig.uplink != 0)
+	{
+		if(length > usrsimUplinkCredit)
+			return false;
+		usrsimUplinkCredit -= length;
+	}
+	usrsimStats->transfers++;
+
+	//Decode the frames. Corrupt data is skipped a byte at a time
+	if(QUEUE_AddArray(&usrsimReceive, data, length) != QUEUE_OK)
+		return false;
+	static BPKT_Packet_TD packet;
+	while(1)
+	{
+		BPKT_STATUS_ENUM result = PKT_Decode(&usrsimReceive, &packet);
+		if(result == BPKT_NOTENOUGHDATA)
+			break;
+		if(result != BPKT_OK)
+		{
+			QUEUE_Remove(&usrsimReceive, 1);
+			continue;
+		}
+		QUEUE_Remove(&usrsimReceive, BPKT_PACKETSIZE(packet.length));
+		USRSIM_HandlePacket(packet.data, packet.length);
+	}
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Handle a packet from the device
+  * @param	data: pointer to the packet
+  * @param	length: length of the packet
+  * @retval	None
+  */
+static void USRSIM_HandlePacket(uint8_t *data, uint16_t length)
+{
+	switch(data[0])
+	{
+	case pktUSRDataRequest:
+	{
+		uint8_t id = data[1];
+		uint32_t offset = BYTESTOUINT32(data, 2);
+		uint16_t requestLength = BYTESTOUINT16(data, 6);
+		uint32_t end = offset + requestLength;
+
+		usrsimStats->requests++;
+		if(offset < usrsimRequested[id])
+		{
+			usrsimStats->retries++;
+			usrsimStats->retriedBytes += ((end < usrsimRequested[id]) ? end : usrsimRequested[id]) - offset;
+		}
+		if(end > usrsimRequested[id])
+			usrsimRequested[id] = end;
+
+		if(usrsimRequestCount >= USRSIM_REQUESTCOUNT)		//Host overwhelmed, request lost
+		{
+			usrsimStats->lost++;
+			break;
+		}
+		USRSIM_Request_td *request = &usrsimRequests[(usrsimRequestHead + usrsimRequestCount) % USRSIM_REQUESTCOUNT];
+		request->id = id;
+		request->offset = offset;
+		request->length = requestLength;
+		request->time = usrsimTime + usrsimConfig.latency;
+		usrsimRequestCount++;
+		break;
+	}
+
+	case pktUSRAlive:
+		usrsimStats->alivePackets++;
+		for(uint16_t i = 1; i < length; i++)
+			USRSIM_SendPacket(USRSIM_PACKET_ALIVE, data[i], 0, 0);
+		break;
+
+	case pktUSRClose:
+		usrsimStats->closePackets++;
+		for(uint16_t i = 1; i < length; i++)
+		{
+			for(uint8_t r = 0; r < usrsimRequestCount; r++)
+			{
+				USRSIM_Request_td *request = &usrsimRequests[(usrsimRequestHead + r) % USRSIM_REQUESTCOUNT];
+				if(request->id == data[i])
+					request->length = 0;
+			}
+			usrsimRequested[data[i]] = 0;
+		}
+		break;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Serve the due requests in order, within the bandwidth
+  * @param	None
+  * @retval	None
+  */
+static void USRSIM_ServeRequests(void)
+{
+	//Unused bandwidth is not saved beyond a packet
+	usrsimCredit += usrsimConfig.bandwidth;
+	if(usrsimCredit > (usrsimConfig.bandwidth + usrsimConfig.packetSize))
+		usrsimCredit = usrsimConfig.bandwidth + usrsimConfig.packetSize;
+
+	while(usrsimRequestCount > 0)
+	{
+		USRSIM_Request_td *request = &usrsimRequests[usrsimRequestHead];
+		if(request->length > 0)
+		{
+			if((int32_t)(usrsimTime - request->time) < 0)
+				break;
+
+			uint16_t length = (request->length < usrsimConfig.packetSize) ? request->length : usrsimConfig.packetSize;
+			if(length > usrsimCredit)
+				break;
+			usrsimCredit -= length;
+
+			USRSIM_SendPacket(USRSIM_PACKET_DATA, request->id, request->offset, length);
+			request->offset += length;
+			request->length -= length;
+			if(request->length > 0)
+				continue;
+		}
+		usrsimRequestHead = (usrsimRequestHead + 1) % USRSIM_REQUESTCOUNT;
+		usrsimRequestCount--;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Deliver the packets that have arrived at the device
+  * @param	None
+  * @retval	None
+  */
+static void USRSIM_DeliverPackets(void)
+{
+	uint16_t i = 0;
+	while(i < usrsimPacketCount)
+	{
+		USRSIM_Packet_td packet = usrsimPackets[i];
+		if((int32_t)(usrsimTime - packet.time) < 0)
+		{
+			i++;
+			continue;
+		}
+
+		//Remove before delivering, the device may reply
+		usrsimPacketCount--;
+		memmove(&usrsimPackets[i], &usrsimPackets[i + 1], (usrsimPacketCount - i) * sizeof(USRSIM_Packet_td));
+
+		USR_StreamReader_td *stream = USR_GetStreamByID(packet.id);
+		if(stream == NULL)
+			continue;
+		if(packet.type == USRSIM_PACKET_ALIVE)
+		{
+			USR_AliveHandler(stream);
+			continue;
+		}
+
+		uint8_t *data = USRSIM_GetData(stream);
+		if((data != NULL) && ((packet.offset + packet.length) <= stream->stream.length))
+			USR_DataReceivedHandler(stream, packet.offset, &data[packet.offset], packet.length);
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Send a packet from the host over the link
+  * @param	type: @ref USRSIM_PACKETs
+  * @param	id: stream ID
+  * @param	offset: offset of the data
+  * @param	length: length of the data
+  * @retval	None
+  */
+static void USRSIM_SendPacket(uint8_t type, uint8_t id, uint32_t offset, uint16_t length)
+{
+	if(type == USRSIM_PACKET_DATA)
+	{
+		usrsimStats->packets++;
+		usrsimStats->bytes += length;
+	}
+
+	if(USRSIM_Chance(usrsimConfig.loss))
+	{
+		usrsimStats->lost++;
+		return;
+	}
+
+	uint32_t time = usrsimTime;
+	if(USRSIM_Chance(usrsimConfig.reorder))
+	{
+		usrsimStats->reordered++;
+		time += 1 + ((usrsimConfig.reorderDelay > 1) ? (USRSIM_Random() % usrsimConfig.reorderDelay) : 0);
+	}
+	USRSIM_AddPacket(type, id, offset, length, time);
+
+	if(USRSIM_Chance(usrsimConfig.duplicate))
+	{
+		usrsimStats->duplicated++;
+		USRSIM_AddPacket(type, id, offset, length, time);
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Queue a packet for delivery
+  * @param	type: @ref USRSIM_PACKETs
+  * @param	id: stream ID
+  * @param	offset: offset of the data
+  * @param	length: length of the data
+  * @param	time: arrival time
+  * @retval	None
+  */
+static void USRSIM_AddPacket(uint8_t type, uint8_t id, uint32_t offset, uint16_t length, uint32_t time)
+{
+	if(usrsimPacketCount >= USRSIM_PACKETCOUNT)
+	{
+		usrsimStats->lost++;
+		return;
+	}
+
+	USRSIM_Packet_td *packet = &usrsimPackets[usrsimPacketCount++];
+	packet->type = type;
+	packet->id = id;
+	packet->offset = offset;
+	packet->length = length;
+	packet->time = time;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Get the data served for a stream
+  * @param	stream: pointer to the stream
+  * @retval	pointer to the data, NULL if not served
+  */
+static uint8_t *USRSIM_GetData(USR_StreamReader_td *stream)
+{
+	for(uint8_t i = 0; i < USRSIM_STREAMCOUNT; i++)
+	{
+		if(usrsimStreams[i].stream == stream)
+			return usrsimStreams[i].data;
+	}
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Random event
+  * @param	perMille: chance of the event per 1000
+  * @retval	true if the event occurs
+  */
+static bool USRSIM_Chance(uint16_t perMille)
+{
+	return (perMille > 0) && ((USRSIM_Random() % 1000) < perMille);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+  * @brief	Xorshift random number
+  * @param	None
+  * @retval	Random number
+  */
+static uint32_t USRSIM_Random(void)
+{
+	usrsimRandom ^= usrsimRandom << 13;
+	usrsimRandom ^= usrsimRandom >> 17;
+	usrsimRandom ^= usrsimRandom << 5;
+	return usrsimRandom;
+}
+
+#endif
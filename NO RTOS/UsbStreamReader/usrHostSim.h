@@ -0,0 +1,75 @@
+/**
+  ******************************************************************************
+  * @file     	usrHostSim.h
+  * @author		beede
+  * @version	1V0
+  * @date		Aug 12, 2024
+  * @brief		Simulated USB stream host for profiling the USB stream reader
+  * 			off target
+  */
+
+
+#ifndef INC_USRHOSTSIM_H_
+#define INC_USRHOSTSIM_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbStreamReader.h"
+
+/* Exported defines ----------------------------------------------------------*/
+#define USRSIM_REQUESTCOUNT				64			//Data requests queued at the host
+#define USRSIM_PACKETCOUNT				256			//Packets travelling to the device
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+	//LINK
+	uint32_t latency;					//Milliseconds from a request being sent to the host serving it
+	uint32_t bandwidth;					//Bytes per millisecond from the host
+	uint32_t uplink;					//Bytes per millisecond to the host. 0 for unlimited
+	uint16_t packetSize;				//Largest data packet from the host
+	uint16_t loss;						//Packets lost (per 1000)
+	uint16_t reorder;					//Packets delayed behind later packets (per 1000)
+	uint16_t reorderDelay;				//Longest delay of a reordered packet (ms)
+	uint16_t duplicate;					//Packets delivered twice (per 1000)
+	uint16_t sendFail;					//Device packets refused by the USB stack (per 1000)
+	uint32_t seed;						//Random seed, runs are repeatable
+
+	//CONSUMER (USRSIM_Run)
+	uint32_t consumeRate;				//Bytes read per millisecond. 0 for as fast as available
+	uint32_t timeLimit;					//Milliseconds before giving up
+}USRSIM_Config_td;
+
+typedef struct
+{
+	uint32_t time;						//Milliseconds to complete
+	uint32_t goodput;					//Stream bytes per second
+	uint32_t stallTime;					//Milliseconds the consumer waited for data
+	uint32_t mismatches;				//Reads not matching the source data
+
+	uint32_t transfers;					//USB transfers from the device
+	uint32_t requests;					//Data requests received by the host
+	uint32_t retries;					//Requests for data already requested
+	uint32_t retriedBytes;
+	uint32_t packets;					//Data packets sent by the host
+	uint32_t bytes;						//Data bytes sent by the host
+	uint32_t lost;
+	uint32_t reordered;
+	uint32_t duplicated;
+	uint32_t alivePackets;
+	uint32_t closePackets;
+	uint32_t sendFails;
+
+	BSTREAM_Enum result;				//Stream close result
+}USRSIM_Stats_td;
+
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+#if defined(__linux__)
+void USRSIM_Init(const USRSIM_Config_td *config, USRSIM_Stats_td *stats);
+void USRSIM_Serve(USR_StreamReader_td *stream, uint8_t *data);
+void USRSIM_millisecondTick(void);
+uint32_t USRSIM_GetTime(void);
+BSTREAM_Enum USRSIM_Run(const USRSIM_Config_td *config, USR_StreamReader_td *stream, uint8_t *data, uint32_t length, USRSIM_Stats_td *stats);
+#endif
+
+#endif /* INC_USRHOSTSIM_H_ */
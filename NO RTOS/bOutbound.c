@@ -0,0 +1,287 @@
+/**
+  ******************************************************************************
+  * @file     	bOutbound.c
+  * @author		beede
+  * @version	1V0
+  * @date		Aug 14, 2024
+  * @brief		Prioritised outbound packet scheduler in front of the USB handler
+  */
+
+
+/* Information ---------------------------------------------------------------*/
+/*
+SCHEDULER
+o All outbound packets are queued here instead of calling USBHND_sendPacket
+  directly. Callers no longer retry on their own timers, BOUT_Send only
+  fails when the priority queue is full
+o Each packet is encoded as a bPacket frame into the bQueue of its priority,
+  after its deadline:
+	o Deadline      4 bytes         ms, little endian. Not sent
+	o Frame                         bPacket frame
+o The host decodes the USB data as a stream of bPacket frames (PKT_Decode)
+
+ORDERING
+o Frames whose deadline has passed go first, earliest deadline first, so low
+  priorities are never starved
+o Otherwise the highest priority frame goes first, FIFO within a priority
+o A control frame waits for at most the transfer in progress and the frames
+  already overdue
+
+COALESCING
+o Whole frames are packed into one transfer up to BOUT_TRANSFERSIZE, in the
+  order above. A frame that does not fit leaves room for smaller ones
+o A frame larger than BOUT_TRANSFERSIZE is sent in a transfer of its own
+o Frames are only removed once the USB handler accepts the transfer. Sending
+  is tried on BOUT_Send, on BOUT_TransmitCompleteHandler and every tick
+
+CONTEXTS
+o BOUT_Send builds the frame in a staging queue on its own stack, then
+  copies it into the priority queue with interrupts masked. A flush only
+  ever sees whole frames, and sends from several contexts do not interleave
+o BOUT_Flush runs from the main loop, the tick and the USB interrupt. One
+  context flushes at a time, claimed with interrupts masked. A flush asked
+  for while another context holds it is run again by the holder before it
+  lets go, so a transfer complete is never missed
+*/
+
+/* Includes ------------------------------------------------------------------*/
+#include "bOutbound.h"
+#include "bPacket.h"
+#include "usbHandler.h"
+#include "string.h"
+#if !defined(__linux__)
+#include "main.h"
+#endif
+
+/* Private define ------------------------------------------------------------*/
+#define BOUT_DEADLINESIZE					4
+#define BOUT_FRAMESIZE(Q, OFFSET)			BPKT_PACKETSIZE(QUEUE_TOU16((Q), (Q)->out + (OFFSET) + BOUT_DEADLINESIZE + 2))
+#define BOUT_STAGINGSIZE					512			//Power of 2, holds the largest frame and its deadline
+
+#if ((BOUT_DEADLINESIZE + BPKT_PACKETSIZE(BPKT_MAXDATALENGTH)) >= BOUT_STAGINGSIZE)
+#error "BOUT_STAGINGSIZE too small for the largest frame"
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+static uint8_t boutRequestBuffer[BOUT_REQUESTQUEUESIZE];
+static uint8_t boutControlBuffer[BOUT_CONTROLQUEUESIZE];
+static uint8_t boutBulkBuffer[BOUT_BULKQUEUESIZE];
+static QUEUE_Typedef boutQueues[BOUT_PRIORITYCOUNT] =
+{
+	{boutRequestBuffer, BOUT_REQUESTQUEUESIZE, 0, 0},
+	{boutControlBuffer, BOUT_CONTROLQUEUESIZE, 0, 0},
+	{boutBulkBuffer, BOUT_BULKQUEUESIZE, 0, 0},
+};
+static const uint16_t boutDeadlines[BOUT_PRIORITYCOUNT] = {BOUT_REQUESTDEADLINE, BOUT_CONTROLDEADLINE, BOUT_BULKDEADLINE};
+static uint32_t boutTime;
+static volatile bool boutFlushing;			//A context is flushing
+static volatile bool boutFlushAgain;		//Flush asked for while flushing
+
+/* Private function prototypes -----------------------------------------------*/
+static int8_t BOUT_NextFrame(uint32_t *taken, uint16_t length);
+static bool BOUT_ClaimFlush(void);
+static bool BOUT_ReleaseFlush(void);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief	Tick at 1 millisecond. Retries frames the USB handler refused
+  * @param	None
+  * @retval	None
+  */
+void BOUT_millisecondTick(void)
+{
+	boutTime++;
+	BOUT_Flush();
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Queue a packet to send
+  * @param	data: pointer to the packet
+  * @param	length: length of the packet
+  * @param	priority: BOUT_Priority_Enum
+  * @param	deadline: ms within which the packet should be sent. 0 for the
+  * 		default of its priority
+  * @retval	false if there is no space for the packet
+  */
+bool BOUT_Send(uint8_t *data, uint16_t length, BOUT_Priority_Enum priority, uint16_t deadline)
+{
+	if((priority >= BOUT_PRIORITYCOUNT) || (length > BPKT_MAXDATALENGTH))
+		return false;
+
+	QUEUE_Typedef *queue = &boutQueues[priority];
+	if(QUEUE_SPACE(queue) < (uint32_t)(BOUT_DEADLINESIZE + BPKT_PACKETSIZE(length)))
+		return false;
+
+	//Build the frame where no flush can see it
+	uint8_t stagingBuffer[BOUT_STAGINGSIZE];
+	QUEUE_Typedef staging = {stagingBuffer, BOUT_STAGINGSIZE, 0, 0};
+	uint32_t due = boutTime + ((deadline != 0) ? deadline : boutDeadlines[priority]);
+	QUEUE_Add(&staging, (uint8_t)due);
+	QUEUE_Add(&staging, (uint8_t)(due >> 8));
+	QUEUE_Add(&staging, (uint8_t)(due >> 16));
+	QUEUE_Add(&staging, (uint8_t)(due >> 24));
+	PKT_Encode(data, length, &staging);
+
+	//Publish the whole frame at once
+#if !defined(__linux__)
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+#endif
+	bool queued = (QUEUE_AddArray(queue, stagingBuffer, QUEUE_COUNT(&staging)) == QUEUE_OK);
+#if !defined(__linux__)
+	__set_PRIMASK(primask);
+#endif
+	if(!queued)
+		return false;
+
+	BOUT_Flush();
+	return true;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Send queued frames until the USB handler refuses a transfer
+  * @param	None
+  * @retval	None
+  */
+void BOUT_Flush(void)
+{
+	if(!BOUT_ClaimFlush())
+		return;
+
+	uint8_t transfer[BPKT_PACKETSIZE(BPKT_MAXDATALENGTH)];
+	uint32_t taken[BOUT_PRIORITYCOUNT];
+	do
+	{
+		boutFlushAgain = false;
+		while(1)
+		{
+			//Coalesce frames into a transfer
+			memset(taken, 0, sizeof(taken));
+			uint16_t length = 0;
+			int8_t priority;
+			while((priority = BOUT_NextFrame(taken, length)) >= 0)
+			{
+				QUEUE_Typedef *queue = &boutQueues[priority];
+				uint16_t frameLength = BOUT_FRAMESIZE(queue, taken[priority]);
+				QUEUE_ReadToArray(queue, taken[priority] + BOUT_DEADLINESIZE, &transfer[length], frameLength);
+				length += frameLength;
+				taken[priority] += BOUT_DEADLINESIZE + frameLength;
+			}
+
+			//Frames are kept until the transfer is accepted
+			if((length == 0) || !USBHND_sendPacket(transfer, length))
+				break;
+			for(uint8_t i = 0; i < BOUT_PRIORITYCOUNT; i++)
+				QUEUE_Remove(&boutQueues[i], taken[i]);
+		}
+	}while(!BOUT_ReleaseFlush());
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Amount of data queued at a priority
+  * @param	priority: BOUT_Priority_Enum
+  * @retval	Bytes queued, including framing
+  */
+uint32_t BOUT_GetPending(BOUT_Priority_Enum priority)
+{
+	if(priority >= BOUT_PRIORITYCOUNT)
+		return 0;
+	return QUEUE_COUNT(&boutQueues[priority]);
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Notify the scheduler that the USB handler has finished a transfer
+  * @param	None
+  * @retval	None
+  */
+void BOUT_TransmitCompleteHandler(void)
+{
+	BOUT_Flush();
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Choose the next frame for a transfer: the earliest overdue frame,
+  * 		otherwise the highest priority frame, that fits
+  * @param	taken: data already taken into the transfer from each queue
+  * @param	length: length of the transfer so far
+  * @retval	priority of the queue holding the frame, -1 if none
+  */
+static int8_t BOUT_NextFrame(uint32_t *taken, uint16_t length)
+{
+	int8_t next = -1;
+	bool nextOverdue = false;
+	uint32_t nextDue = 0;
+
+	for(uint8_t i = 0; i < BOUT_PRIORITYCOUNT; i++)
+	{
+		QUEUE_Typedef *queue = &boutQueues[i];
+		if(QUEUE_COUNT(queue) <= taken[i])
+			continue;
+
+		//Frames larger than a transfer go alone
+		uint16_t frameLength = BOUT_FRAMESIZE(queue, taken[i]);
+		if((length > 0) && ((length + frameLength) > BOUT_TRANSFERSIZE))
+			continue;
+
+		uint32_t due = QUEUE_TOU32(queue, queue->out + taken[i]);
+		bool overdue = ((int32_t)(boutTime - due) >= 0);
+		if((next < 0) || (overdue && (!nextOverdue || ((int32_t)(due - nextDue) < 0))))
+		{
+			next = i;
+			nextOverdue = overdue;
+			nextDue = due;
+		}
+	}
+	return next;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Claim the flush for this context
+  * @param	None
+  * @retval	false if another context is flushing. It will flush again
+  */
+static bool BOUT_ClaimFlush(void)
+{
+#if !defined(__linux__)
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+#endif
+	bool claimed = !boutFlushing;
+	if(claimed)
+		boutFlushing = true;
+	else
+		boutFlushAgain = true;
+#if !defined(__linux__)
+	__set_PRIMASK(primask);
+#endif
+	return claimed;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Let go of the flush, unless another context asked for one
+  * @param	None
+  * @retval	false if the flush must run again
+  */
+static bool BOUT_ReleaseFlush(void)
+{
+#if !defined(__linux__)
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+#endif
+	bool released = !boutFlushAgain;
+	if(released)
+		boutFlushing = false;
+#if !defined(__linux__)
+	__set_PRIMASK(primask);
+#endif
+	return released;
+}
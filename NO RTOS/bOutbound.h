@@ -0,0 +1,45 @@
+/**
+  ******************************************************************************
+  * @file     	bOutbound.h
+  * @author		beede
+  * @version	1V0
+  * @date		Aug 14, 2024
+  * @brief		Prioritised outbound packet scheduler in front of the USB handler
+  */
+
+#ifndef BEN_OUTBOUND_H
+#define BEN_OUTBOUND_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "bQueue.h"
+#include "stdbool.h"
+
+/* Exported defines ----------------------------------------------------------*/
+#define BOUT_TRANSFERSIZE				64			//Frames coalesced into a transfer up to this size
+#define BOUT_REQUESTQUEUESIZE			256			//Power of 2
+#define BOUT_CONTROLQUEUESIZE			256			//Power of 2
+#define BOUT_BULKQUEUESIZE				512			//Power of 2
+
+//Default deadlines (ms), after which a frame is sent ahead of higher priorities
+#define BOUT_REQUESTDEADLINE			2
+#define BOUT_CONTROLDEADLINE			10
+#define BOUT_BULKDEADLINE				100
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+	BOUT_PRIORITY_REQUEST = 0,			//Data requests, the critical path
+	BOUT_PRIORITY_CONTROL,				//Keep alive, close and other control
+	BOUT_PRIORITY_BULK,					//Telemetry and application data
+	BOUT_PRIORITYCOUNT
+}BOUT_Priority_Enum;
+
+/* Exported variables --------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+void BOUT_millisecondTick(void);
+bool BOUT_Send(uint8_t *data, uint16_t length, BOUT_Priority_Enum priority, uint16_t deadline);
+void BOUT_Flush(void);
+uint32_t BOUT_GetPending(BOUT_Priority_Enum priority);
+void BOUT_TransmitCompleteHandler(void);
+
+#endif /* BEN_OUTBOUND_H */
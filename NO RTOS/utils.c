@@ -17,6 +17,9 @@
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 /* Private function prototypes -----------------------------------------------*/
+static uint32_t gf2_matrix_times(uint32_t *mat, uint32_t vec);
+static void gf2_matrix_square(uint32_t *square, uint32_t *mat);
+
 /* Private functions ---------------------------------------------------------*/
 
 
@@ -61,6 +64,87 @@ uint32_t crc32_calculateData(uint32_t crc, uint8_t *data, uint32_t offset, uint3
     return ~crc;
 }
 
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Combine the CRC32 values of two consecutive blocks of data without
+  * 		access to the data
+  * @param	crc1: CRC32 value of the first block
+  * @param	crc2: CRC32 value of the second block
+  * @param	len2: length of the second block
+  * @retval	CRC32 value of both blocks
+  */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint32_t len2)
+{
+	uint32_t even[32];		//Even power of two zeros operator
+	uint32_t odd[32];		//Odd power of two zeros operator
+
+	if(len2 == 0)
+		return crc1;
+
+	//Operator for one zero bit
+	odd[0] = POLY;
+	uint32_t row = 1;
+	for(uint8_t n = 1; n < 32; n++)
+	{
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	gf2_matrix_square(even, odd);		//Two zero bits
+	gf2_matrix_square(odd, even);		//Four zero bits
+
+	//Apply len2 zeros to crc1
+	do
+	{
+		gf2_matrix_square(even, odd);
+		if(len2 & 1)
+			crc1 = gf2_matrix_times(even, crc1);
+		len2 >>= 1;
+		if(len2 == 0)
+			break;
+
+		gf2_matrix_square(odd, even);
+		if(len2 & 1)
+			crc1 = gf2_matrix_times(odd, crc1);
+		len2 >>= 1;
+	} while(len2 != 0);
+
+	return crc1 ^ crc2;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Multiply a GF(2) 32x32 matrix by a vector
+  * @param	mat: pointer to the matrix
+  * @param	vec: vector
+  * @retval	Product
+  */
+static uint32_t gf2_matrix_times(uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+	while(vec)
+	{
+		if(vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+	return sum;
+}
+
+/* ---------------------------------------------------------------------------*/
+/**
+  * @brief	Square a GF(2) 32x32 matrix
+  * @param[out]	square: pointer to the returned matrix
+  * @param	mat: pointer to the matrix to square
+  * @retval	None
+  */
+static void gf2_matrix_square(uint32_t *square, uint32_t *mat)
+{
+	for(uint8_t n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
 /* ---------------------------------------------------------------------------*/
 /**
   * @brief	Calculate CRC16 value on a queue. Starting value of 0xffff
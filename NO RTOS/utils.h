@@ -25,6 +25,7 @@
 /* Public function prototypes ------------------------------------------------*/
 uint32_t crc32_calculateQueue(uint32_t crc, QUEUE_Typedef *queue, uint32_t offset, uint32_t len);
 uint32_t crc32_calculateData(uint32_t crc, uint8_t *data, uint32_t offset, uint32_t len);
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint32_t len2);
 uint16_t crc16_ccitt_calculateQueue(uint16_t crc, QUEUE_Typedef *queue, uint32_t offset, uint32_t length);
 uint16_t crc16_ccitt_calculateData(uint16_t crc, uint8_t *data, uint32_t offset, uint32_t length);
 uint16_t crc16_ccitt_accumulate(uint16_t crc, uint8_t value);